@@ -0,0 +1,56 @@
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "falcon.h"
+
+// Time to move a large blob over a reliable stream on loopback, fragmented by the sender and reassembled by the server.
+
+static bool WaitFor(const Falcon& falcon, uint64_t reassembled, std::chrono::seconds limit) {
+    const auto deadline = std::chrono::steady_clock::now() + limit;
+    while (falcon.GetStats().messagesReassembled < reassembled) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return true;
+}
+
+int main() {
+    FalconConfig config;
+    config.packetPoolSize = 1024;
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5556, config);
+    const auto client = std::make_unique<Falcon>(config);
+    if (!server) {
+        std::fprintf(stderr, "listen failed\n");
+        return 1;
+    }
+    client->ConnectTo("127.0.0.1", 5556);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto stream = client->CreateStream(true);
+    std::printf("%10s %12s %12s %14s %14s\n", "size MB", "ms", "MB/s", "retransmits", "fast retrans.");
+    uint64_t reassembled = 0;
+    for (const size_t megabytes : {1, 2, 5, 10}) {
+        const std::vector<char> blob(megabytes * 1024 * 1024, 'b');
+        const FalconStats before = client->GetStats();
+
+        const auto start = std::chrono::steady_clock::now();
+        stream->SendData(blob);
+        if (!WaitFor(*server, ++reassembled, std::chrono::seconds(60))) {
+            std::fprintf(stderr, "%zu MB blob was not delivered\n", megabytes);
+            return 1;
+        }
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        const FalconStats after = client->GetStats();
+        std::printf("%10zu %12.1f %12.1f %14llu %14llu\n", megabytes, ms, megabytes * 1000.0 / ms,
+            static_cast<unsigned long long>(after.retransmissions - before.retransmissions),
+            static_cast<unsigned long long>(after.fastRetransmissions - before.fastRetransmissions));
+    }
+    client->CloseStream(*stream);
+    return 0;
+}
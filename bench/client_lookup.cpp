@@ -0,0 +1,69 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "falcon.h"
+
+// Per-packet cost of finding the sender of a datagram among the connected clients,
+// through the ClientTable endpoint index the server uses versus the linear scan it replaced.
+
+static Endpoint MakeEndpoint(uint32_t i) {
+    return Endpoint::FromIPv4({10, static_cast<uint8_t>(i >> 16), static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i)}, static_cast<uint16_t>(1024 + i % 50000));
+}
+
+template<typename Lookup>
+static double NanosecondsPerPacket(const std::vector<Endpoint>& senders, Lookup&& lookup) {
+    uint64_t found = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (const Endpoint& sender : senders) {
+        found += lookup(sender);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (found != senders.size()) {
+        std::printf("lookup missed %zu senders\n", senders.size() - found);
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(senders.size());
+}
+
+int main() {
+    constexpr size_t packets = 200000;
+    std::mt19937 rng(42);
+
+    std::printf("%10s %18s %18s\n", "clients", "index ns/packet", "scan ns/packet");
+    for (const uint32_t clientCount : {10u, 100u, 1000u, 10000u}) {
+        ClientTable table;
+        for (uint32_t i = 0; i < clientCount; ++i) {
+            table.Add({i + 1, MakeEndpoint(i), false, std::chrono::steady_clock::now()});
+        }
+
+        std::vector<Endpoint> senders(packets);
+        std::uniform_int_distribution<uint32_t> pick(0, clientCount - 1);
+        for (Endpoint& sender : senders) {
+            sender = MakeEndpoint(pick(rng));
+        }
+
+        const double indexed = NanosecondsPerPacket(senders, [&](const Endpoint& from) {
+            Client* client = table.FindByEndpoint(from);
+            if (client) {
+                client->pinged = false;
+            }
+            return client != nullptr;
+        });
+
+        // the scan is O(clients), keep its run short for big tables
+        const std::vector<Endpoint> scanSenders(senders.begin(), senders.begin() + std::min<size_t>(packets, 20000000 / clientCount));
+        const double scanned = NanosecondsPerPacket(scanSenders, [&](const Endpoint& from) {
+            for (auto& [id, c] : table) {
+                if (c.endpoint == from) {
+                    c.pinged = false;
+                    return true;
+                }
+            }
+            return false;
+        });
+
+        std::printf("%10u %18.1f %18.1f\n", clientCount, indexed, scanned);
+    }
+    return 0;
+}
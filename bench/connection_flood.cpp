@@ -0,0 +1,170 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "falcon.h"
+#include "log.h"
+
+// Loopback load test: a connected client streams small unreliable messages while the server is flooded with
+// connection requests, and the rate the server delivers the client's messages is compared before and during
+// the flood. Like a spoofed flood, every request comes from a different source: the flooders pick the source
+// address of each datagram (IP_PKTINFO) across 127.0.0.0/16, 256 /24 prefixes, so without cookies each request
+// takes a slot in the client table. Nothing reads the replies, they cost the server the send only. The flood
+// is paced, an unpaced one on the same machine mostly measures the flooders stealing the cores of the client.
+
+#if defined(__linux__)
+namespace {
+struct Mode {
+    const char* name;
+    bool cookies;
+    double ratePerPrefix;
+};
+
+constexpr int flooderThreads = 4;
+constexpr int requestsPerSecond = 25000; // per thread
+constexpr uint32_t sourceAddresses = 256 * 254; // 127.0.0.0/16 without .0 and .255
+
+double MeasureRate(const std::atomic<uint64_t>& delivered, std::chrono::milliseconds duration) {
+    const uint64_t before = delivered;
+    std::this_thread::sleep_for(duration);
+    return static_cast<double>(delivered - before) / std::chrono::duration<double>(duration).count();
+}
+
+// Sends request to the server from source, a loopback address, on the port socket was given
+bool SendFrom(int socket, uint32_t source, const sockaddr_in& server, std::span<const char> request) {
+    iovec data{const_cast<char*>(request.data()), request.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(in_pktinfo))] = {};
+    msghdr message{};
+    message.msg_name = const_cast<sockaddr_in*>(&server);
+    message.msg_namelen = sizeof(server);
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = IPPROTO_IP;
+    header->cmsg_type = IP_PKTINFO;
+    header->cmsg_len = CMSG_LEN(sizeof(in_pktinfo));
+    in_pktinfo info{};
+    info.ipi_spec_dst.s_addr = htonl(source);
+    std::memcpy(CMSG_DATA(header), &info, sizeof(info));
+    return sendmsg(socket, &message, 0) >= 0;
+}
+}
+
+int main() {
+    constexpr auto duration = std::chrono::milliseconds(2000);
+    const Mode modes[] = {
+        {"open", false, 0},
+        {"cookies", true, 0},
+        {"cookies+limit", true, 100},
+    };
+    // the server logs every connection, keep that out of the measurement
+    FalconLogger().set_level(spdlog::level::warn);
+
+    std::printf("%u source addresses, %d threads at %d requests/s each, %lld ms per phase\n", sourceAddresses,
+        flooderThreads, requestsPerSecond, static_cast<long long>(duration.count()));
+    std::printf("%14s %14s %14s %8s %8s %12s %12s %12s\n", "mode", "baseline/s", "flood/s", "kept", "table",
+        "requests", "challenges", "limited");
+    uint16_t port = 5700;
+    for (const Mode& mode : modes) {
+        FalconConfig config;
+        config.ioBatchSize = 32;
+        config.connectionCookies = mode.cookies;
+        config.connectionRatePerPrefix = mode.ratePerPrefix;
+        const auto server = Falcon::Listen("127.0.0.1", port, config);
+        if (!server) {
+            std::fprintf(stderr, "listen failed\n");
+            return 1;
+        }
+        std::atomic<uint64_t> delivered = 0;
+        std::atomic<int64_t> tableSize = 0;
+        server->OnClientConnected([&](uint64_t) { tableSize++; });
+        server->OnClientDisconnected([&](uint64_t) { tableSize--; });
+        server->OnStreamOpened([&](Stream& stream) {
+            stream.OnDataReceived([&](std::span<const char>) { delivered++; });
+        });
+
+        const auto client = std::make_unique<Falcon>();
+        client->ConnectTo("127.0.0.1", port);
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        std::atomic<bool> sending = true;
+        std::thread sender([&]() {
+            auto stream = client->CreateStream(false);
+            const std::vector<char> update(64, 'x');
+            while (sending) {
+                stream->SendData(update);
+            }
+            client->CloseStream(*stream);
+        });
+        const double baseline = MeasureRate(delivered, duration);
+
+        sockaddr_in serverAddress{};
+        serverAddress.sin_family = AF_INET;
+        serverAddress.sin_port = htons(port);
+        serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        std::atomic<bool> flooding = true;
+        std::atomic<uint64_t> requests = 0;
+        std::vector<std::thread> flooders;
+        for (int i = 0; i < flooderThreads; ++i) {
+            flooders.emplace_back([&, i]() {
+                // never read, the replies overflow its buffer and are dropped
+                const int socket = ::socket(AF_INET, SOCK_DGRAM, 0);
+                if (socket < 0) {
+                    return;
+                }
+                uint64_t sequence = 0;
+                auto next = std::chrono::steady_clock::now();
+                while (flooding) {
+                    if (sequence % 100 == 0) {
+                        next += std::chrono::microseconds(100 * 1000000 / requestsPerSecond);
+                        std::this_thread::sleep_until(next);
+                    }
+                    // a new source address each time, alternating fresh requests and forged cookies
+                    const auto host = static_cast<uint32_t>((sequence * flooderThreads + i) % sourceAddresses);
+                    const uint32_t source = 0x7F000000u | (host / 254) << 8 | (host % 254 + 1);
+                    const MsgConn request = {MSG_CONN, static_cast<uint32_t>(sequence & 1 ? sequence : 0), sequence & 1 ? sequence * 0x9E3779B97F4A7C15ull : 0};
+                    MessageBuffer<MsgConn> buffer;
+                    SendFrom(socket, source, serverAddress, {buffer.data(), Falcon::SerializeMessage(request, buffer)});
+                    ++sequence;
+                }
+                close(socket);
+                requests += sequence;
+            });
+        }
+        const double flood = MeasureRate(delivered, duration);
+        flooding = false;
+        for (auto& flooder : flooders) {
+            flooder.join();
+        }
+        const int64_t table = tableSize;
+        sending = false;
+        sender.join();
+
+        const FalconStats stats = server->GetStats();
+        std::printf("%14s %14.0f %14.0f %7.0f%% %8lld %12llu %12llu %12llu\n", mode.name, baseline, flood,
+            baseline > 0 ? 100 * flood / baseline : 0.0, static_cast<long long>(table),
+            static_cast<unsigned long long>(requests.load()), static_cast<unsigned long long>(stats.connectionChallenges),
+            static_cast<unsigned long long>(stats.connectionsRateLimited));
+        ++port;
+    }
+    return 0;
+}
+#else
+int main() {
+    std::fprintf(stderr, "connection_flood_bench picks the source address of each datagram, which needs Linux\n");
+    return 0;
+}
+#endif
@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "falcon.h"
+#include "log.h"
+
+// Loopback throughput and latency suite. Every scenario runs a server and its clients in this process:
+// clients send timestamped messages at a fixed rate, the server records the one-way latency and echoes
+// each message back on a stream of its own, and the clients record the round trip.
+//
+// falcon_bench [--duration <ms>] [--rate <messages/s per client>] [--json <file|->]
+//              [--loss <0..1>] [--latency <ms>] [--jitter <ms>] [--bandwidth <bytes/s>] [--seed <n>]
+// The network options impair both directions through the built-in network simulator.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::milliseconds duration{1000};
+        int rate = 2000;
+        std::string jsonPath;
+        NetworkConditions network;
+    };
+
+    struct Scenario {
+        bool reliable;
+        size_t payloadSize;
+        int clientCount;
+    };
+
+    struct Percentiles {
+        double p50 = 0;
+        double p99 = 0;
+        double p999 = 0;
+    };
+
+    struct Result {
+        Scenario scenario;
+        uint64_t sent = 0;
+        uint64_t received = 0;
+        uint64_t echoed = 0;
+        double packetsPerSecond = 0;
+        double bytesPerSecond = 0;
+        Percentiles oneWay{};
+        Percentiles roundTrip{};
+    };
+
+    // Latencies in microseconds, filled from the network threads
+    struct Samples {
+        std::mutex mutex;
+        std::vector<double> values;
+
+        void Add(double value) {
+            std::lock_guard lock(mutex);
+            values.push_back(value);
+        }
+    };
+
+    int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    double MicrosecondsSince(std::span<const char> data) {
+        int64_t sentAt;
+        std::memcpy(&sentAt, data.data(), sizeof(sentAt));
+        return static_cast<double>(Now() - sentAt) / 1000.0;
+    }
+
+    Percentiles ComputePercentiles(std::vector<double>& values) {
+        if (values.empty()) {
+            return {};
+        }
+        std::ranges::sort(values);
+        const auto at = [&](double p) { return values[static_cast<size_t>(p * static_cast<double>(values.size() - 1))]; };
+        return {at(0.50), at(0.99), at(0.999)};
+    }
+
+    bool Run(const Scenario& scenario, const Options& options, uint16_t port, Result& result) {
+        // declared first, the network threads record into them until the server is gone
+        Samples oneWay;
+        Samples roundTrip;
+
+        FalconConfig config;
+        config.packetPoolSize = 1024;
+        config.simulation = options.network;
+        const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", port, config);
+        if (!server) {
+            std::fprintf(stderr, "listen on port %u failed\n", port);
+            return false;
+        }
+
+        std::vector<std::unique_ptr<Falcon>> clients;
+        std::vector<std::unique_ptr<Stream>> streams;
+        std::vector<std::unique_ptr<Stream>> echoes;
+
+        // runs on the server network thread only
+        server->OnStreamOpened([&](Stream& stream) {
+            echoes.push_back(server->CreateStream(stream.clientID, scenario.reliable));
+            Stream* echo = echoes.back().get();
+            stream.OnDataReceived([&, echo](std::span<const char> data) {
+                oneWay.Add(MicrosecondsSince(data));
+                echo->SendData(data);
+            });
+        });
+
+        for (int i = 0; i < scenario.clientCount; ++i) {
+            // different seeds, or every peer would lose the same datagrams
+            config.simulation.seed = options.network.seed + i + 1;
+            auto client = std::make_unique<Falcon>(config);
+            client->OnStreamOpened([&](Stream& stream) {
+                stream.OnDataReceived([&](std::span<const char> data) { roundTrip.Add(MicrosecondsSince(data)); });
+            });
+            client->ConnectTo("127.0.0.1", port);
+            clients.push_back(std::move(client));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        for (const auto& client : clients) {
+            streams.push_back(client->CreateStream(scenario.reliable));
+        }
+
+        // every datagram the server takes in, acks of its echoes included
+        const FalconStats before = server->GetStats();
+        std::vector<char> payload(scenario.payloadSize, 'x');
+        const auto start = Clock::now();
+        const auto end = start + options.duration;
+        for (auto tick = start; tick < end; tick += std::chrono::milliseconds(1)) {
+            // send whatever the rate says should be out by now, so a slow tick catches up on the next one
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(tick - start).count();
+            const uint64_t due = static_cast<uint64_t>(elapsed) * static_cast<uint64_t>(options.rate) / 1000000 + 1;
+            while (result.sent / static_cast<uint64_t>(scenario.clientCount) < due) {
+                for (const auto& stream : streams) {
+                    const int64_t now = Now();
+                    std::memcpy(payload.data(), &now, sizeof(now));
+                    stream->SendData(payload);
+                    result.sent++;
+                }
+            }
+            std::this_thread::sleep_until(tick + std::chrono::milliseconds(1));
+        }
+        const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const FalconStats after = server->GetStats();
+
+        // let retransmissions and the last echoes land before reading the samples
+        std::this_thread::sleep_for(std::chrono::milliseconds(scenario.reliable ? 500 : 100) +
+            2 * (options.network.latency + options.network.jitter));
+
+        for (size_t i = 0; i < streams.size(); ++i) {
+            clients[i]->CloseStream(*streams[i]);
+        }
+        // stop the clients so nothing reaches the echo streams once they are destroyed
+        streams.clear();
+        clients.clear();
+        std::lock_guard oneWayLock(oneWay.mutex);
+        std::lock_guard roundTripLock(roundTrip.mutex);
+        result.received = oneWay.values.size();
+        result.echoed = roundTrip.values.size();
+        result.packetsPerSecond = static_cast<double>(after.datagramsReceived - before.datagramsReceived) / seconds;
+        result.bytesPerSecond = static_cast<double>(result.received * scenario.payloadSize) / seconds;
+        result.oneWay = ComputePercentiles(oneWay.values);
+        result.roundTrip = ComputePercentiles(roundTrip.values);
+        return true;
+    }
+
+    void WriteJson(std::FILE* out, const Options& options, const std::vector<Result>& results) {
+        std::fprintf(out, "{\n  \"benchmark\": \"falcon\",\n  \"duration_ms\": %lld,\n  \"rate_per_client\": %d,\n"
+            "  \"network\": {\"loss\": %g, \"latency_ms\": %lld, \"jitter_ms\": %lld, \"bandwidth\": %llu, \"seed\": %llu},\n  \"results\": [\n",
+            static_cast<long long>(options.duration.count()), options.rate, options.network.lossRate,
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(options.network.latency).count()),
+            static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(options.network.jitter).count()),
+            static_cast<unsigned long long>(options.network.bandwidth), static_cast<unsigned long long>(options.network.seed));
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            std::fprintf(out,
+                "    {\"reliable\": %s, \"payload_bytes\": %zu, \"clients\": %d, \"sent\": %llu, \"received\": %llu, "
+                "\"echoed\": %llu, \"packets_per_second\": %.1f, \"bytes_per_second\": %.1f, "
+                "\"one_way_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f}, "
+                "\"round_trip_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f}}%s\n",
+                r.scenario.reliable ? "true" : "false", r.scenario.payloadSize, r.scenario.clientCount,
+                static_cast<unsigned long long>(r.sent), static_cast<unsigned long long>(r.received),
+                static_cast<unsigned long long>(r.echoed), r.packetsPerSecond, r.bytesPerSecond,
+                r.oneWay.p50, r.oneWay.p99, r.oneWay.p999, r.roundTrip.p50, r.roundTrip.p99, r.roundTrip.p999,
+                i + 1 < results.size() ? "," : "");
+        }
+        std::fprintf(out, "  ]\n}\n");
+    }
+
+    bool ParseOptions(int argc, char** argv, Options& options) try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (i + 1 >= argc) {
+                return false;
+            }
+            if (arg == "--duration") {
+                options.duration = std::chrono::milliseconds(std::stoi(argv[++i]));
+            }
+            else if (arg == "--rate") {
+                options.rate = std::max(1, std::stoi(argv[++i]));
+            }
+            else if (arg == "--json") {
+                options.jsonPath = argv[++i];
+            }
+            else if (arg == "--loss") {
+                options.network.lossRate = std::stod(argv[++i]);
+            }
+            else if (arg == "--latency") {
+                options.network.latency = std::chrono::milliseconds(std::stoi(argv[++i]));
+            }
+            else if (arg == "--jitter") {
+                options.network.jitter = std::chrono::milliseconds(std::stoi(argv[++i]));
+            }
+            else if (arg == "--bandwidth") {
+                options.network.bandwidth = std::stoull(argv[++i]);
+            }
+            else if (arg == "--seed") {
+                options.network.seed = std::stoull(argv[++i]);
+            }
+            else {
+                return false;
+            }
+        }
+        options.network.enabled = options.network.lossRate > 0 || options.network.latency.count() > 0 ||
+            options.network.jitter.count() > 0 || options.network.bandwidth > 0;
+        return true;
+    } catch (const std::exception&) {
+        // not a number, or out of range
+        return false;
+    }
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s [--duration <ms>] [--rate <messages/s per client>] [--json <file|->] "
+            "[--loss <0..1>] [--latency <ms>] [--jitter <ms>] [--bandwidth <bytes/s>] [--seed <n>]\n", argv[0]);
+        return 2;
+    }
+    // keep the library's connection logs out of the table
+    FalconLogger().set_level(spdlog::level::warn);
+
+    // the table goes to stderr when the JSON takes stdout
+    std::FILE* table = options.jsonPath == "-" ? stderr : stdout;
+    std::fprintf(table, "%-10s %8s %8s %10s %12s %12s %10s %10s %10s %10s %10s %10s\n",
+        "stream", "payload", "clients", "lost %", "packets/s", "MB/s",
+        "1way p50", "1way p99", "1way p999", "rtt p50", "rtt p99", "rtt p999");
+
+    std::vector<Result> results;
+    uint16_t port = 5700;
+    for (const bool reliable : {false, true}) {
+        for (const size_t payloadSize : {64, 512, 1024}) {
+            for (const int clientCount : {1, 4}) {
+                Result result{{reliable, payloadSize, clientCount}};
+                if (!Run(result.scenario, options, port++, result)) {
+                    return 1;
+                }
+                const double lost = result.sent == 0 ? 0 : 100.0 * static_cast<double>(result.sent - std::min(result.sent, result.received)) / static_cast<double>(result.sent);
+                std::fprintf(table, "%-10s %8zu %8d %10.2f %12.0f %12.2f %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                    reliable ? "reliable" : "unreliable", payloadSize, clientCount, lost,
+                    result.packetsPerSecond, result.bytesPerSecond / (1024 * 1024),
+                    result.oneWay.p50, result.oneWay.p99, result.oneWay.p999,
+                    result.roundTrip.p50, result.roundTrip.p99, result.roundTrip.p999);
+                results.push_back(result);
+            }
+        }
+    }
+    std::fprintf(table, "latencies in microseconds\n");
+
+    if (!options.jsonPath.empty()) {
+        std::FILE* out = options.jsonPath == "-" ? stdout : std::fopen(options.jsonPath.c_str(), "w");
+        if (!out) {
+            std::fprintf(stderr, "cannot open %s\n", options.jsonPath.c_str());
+            return 1;
+        }
+        WriteJson(out, options, results);
+        if (out != stdout) {
+            std::fclose(out);
+        }
+    }
+    return 0;
+}
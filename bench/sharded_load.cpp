@@ -0,0 +1,67 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "sharded_server.h"
+
+// Loopback load test: clients flood small unreliable messages at a server split in 1, 2, 4... shards
+// and the rate the server processes is measured. Clients run on the same machine, so scaling flattens
+// once the shards and the clients compete for the same cores.
+
+int main() {
+    constexpr int clientCount = 8;
+    constexpr auto duration = std::chrono::seconds(2);
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::printf("%d clients, %u hardware threads\n", clientCount, cores);
+    std::printf("%8s %16s %12s\n", "shards", "messages/s", "speedup");
+    double baseline = 0;
+    uint16_t port = 5600;
+    for (size_t shards = 1; shards <= std::max(4u, cores); shards *= 2, ++port) {
+        FalconConfig config;
+        config.ioBatchSize = 32;
+        const auto server = ShardedServer::Listen("127.0.0.1", port, shards, config);
+        if (!server) {
+            std::fprintf(stderr, "listen failed\n");
+            return 1;
+        }
+
+        std::vector<std::unique_ptr<Falcon>> clients;
+        for (int i = 0; i < clientCount; ++i) {
+            clients.push_back(std::make_unique<Falcon>());
+            clients.back()->ConnectTo("127.0.0.1", port);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        std::atomic<bool> running = true;
+        std::vector<std::thread> senders;
+        for (auto& client : clients) {
+            senders.emplace_back([&running, falcon = client.get()]() {
+                auto stream = falcon->CreateStream(false);
+                const std::vector<char> update(64, 'x');
+                while (running) {
+                    stream->SendData(update);
+                }
+                falcon->CloseStream(*stream);
+            });
+        }
+
+        const uint64_t before = server->GetStats().datagramsReceived;
+        std::this_thread::sleep_for(duration);
+        const uint64_t received = server->GetStats().datagramsReceived - before;
+        running = false;
+        for (auto& sender : senders) {
+            sender.join();
+        }
+
+        const double rate = static_cast<double>(received) / std::chrono::duration<double>(duration).count();
+        if (shards == 1) {
+            baseline = rate;
+        }
+        std::printf("%8zu %16.0f %11.2fx\n", shards, rate, rate / baseline);
+    }
+    return 0;
+}
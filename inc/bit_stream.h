@@ -0,0 +1,224 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+// Bits needed to hold every value in [0, range]
+constexpr unsigned BitsRequired(uint64_t range) {
+    return range == 0 ? 0 : static_cast<unsigned>(std::bit_width(range));
+}
+
+// Packs values LSB first into a caller-provided buffer, never allocates. Writing past the end of the buffer or
+// a value outside its declared range fails the writer, everything written after that is dropped.
+class BitWriter {
+public:
+    explicit BitWriter(std::span<char> buffer);
+
+    void WriteBits(uint64_t value, unsigned bits); // bits <= 64
+    void WriteBool(bool value) { WriteBits(value, 1); }
+    // 7 bits per group, each followed by a continuation bit
+    void WriteVarint(uint64_t value);
+    void WriteRanged(int64_t value, int64_t min, int64_t max);
+    // Rounded to the nearest multiple of resolution above min, clamped into [min, max]
+    void WriteQuantized(float value, float min, float max, float resolution);
+
+    // Pads the last byte with zeros, returns the bytes used, 0 if the writer failed
+    size_t Flush();
+    [[nodiscard]] bool Failed() const { return failed; }
+    [[nodiscard]] size_t BitsWritten() const { return bytes * 8 + pendingBits; }
+
+private:
+    std::span<char> buffer;
+    size_t bytes = 0;
+    uint32_t pending = 0; // bits of the byte being filled
+    unsigned pendingBits = 0;
+    bool failed = false;
+};
+
+// Reads what BitWriter wrote, bounds-checked and without allocating. The first failed read fails every one
+// after it, so a schema can read all its fields and check once.
+class BitReader {
+public:
+    explicit BitReader(std::span<const char> data);
+
+    bool ReadBits(unsigned bits, uint64_t& value); // bits <= 64
+    bool ReadBool(bool& value);
+    bool ReadVarint(uint64_t& value);
+    bool ReadRanged(int64_t min, int64_t max, int64_t& value);
+    bool ReadQuantized(float min, float max, float resolution, float& value);
+
+    [[nodiscard]] bool Failed() const { return failed; }
+    [[nodiscard]] size_t BitsRead() const { return position; }
+
+private:
+    std::span<const char> data;
+    size_t position = 0; // in bits
+    bool failed = false;
+};
+
+// Number of quantization steps of a float in [min, max]
+constexpr uint64_t QuantizedSteps(float min, float max, float resolution) {
+    const double steps = (static_cast<double>(max) - min) / resolution;
+    const auto whole = static_cast<uint64_t>(steps);
+    return whole < steps ? whole + 1 : whole;
+}
+
+template<auto Member>
+struct MemberTraits;
+
+template<typename T, typename Field, Field T::*Member>
+struct MemberTraits<Member> {
+    using Message = T;
+    using Type = Field;
+};
+
+template<auto Member>
+using MemberType = typename MemberTraits<Member>::Type;
+
+// Fields of a message schema. Each one knows the most bits it may take, so a schema knows at compile time
+// how large a buffer its messages need.
+
+// Fixed width, unsigned integers and enums
+template<auto Member, unsigned Bits = sizeof(MemberType<Member>) * 8>
+struct BitsField {
+    static_assert(Bits > 0 && Bits <= 64);
+    static constexpr size_t MAX_BITS = Bits;
+
+    template<typename T>
+    static void Write(const T& message, BitWriter& writer) {
+        writer.WriteBits(static_cast<uint64_t>(message.*Member), Bits);
+    }
+    template<typename T>
+    static bool Read(BitReader& reader, T& message) {
+        uint64_t value = 0;
+        if (!reader.ReadBits(Bits, value)) {
+            return false;
+        }
+        message.*Member = static_cast<MemberType<Member>>(value);
+        return true;
+    }
+};
+
+template<auto Member>
+struct BoolField {
+    static constexpr size_t MAX_BITS = 1;
+
+    template<typename T>
+    static void Write(const T& message, BitWriter& writer) { writer.WriteBool(message.*Member); }
+    template<typename T>
+    static bool Read(BitReader& reader, T& message) { return reader.ReadBool(message.*Member); }
+};
+
+// Integer known to lie in [Min, Max], takes only the bits of the range
+template<auto Member, int64_t Min, int64_t Max>
+struct RangedField {
+    static_assert(Min <= Max);
+    static constexpr size_t MAX_BITS = BitsRequired(static_cast<uint64_t>(Max) - static_cast<uint64_t>(Min));
+
+    template<typename T>
+    static void Write(const T& message, BitWriter& writer) {
+        writer.WriteRanged(static_cast<int64_t>(message.*Member), Min, Max);
+    }
+    template<typename T>
+    static bool Read(BitReader& reader, T& message) {
+        int64_t value = 0;
+        if (!reader.ReadRanged(Min, Max, value)) {
+            return false;
+        }
+        message.*Member = static_cast<MemberType<Member>>(value);
+        return true;
+    }
+};
+
+// Small values in few bits: unsigned integers as they are, signed ones zigzagged, durations and time points
+// by their tick count
+template<auto Member>
+struct VarintField {
+    static constexpr size_t MAX_BITS = 10 * 8;
+
+    template<typename T>
+    static void Write(const T& message, BitWriter& writer) {
+        writer.WriteVarint(Encode(message.*Member));
+    }
+    template<typename T>
+    static bool Read(BitReader& reader, T& message) {
+        uint64_t value = 0;
+        if (!reader.ReadVarint(value)) {
+            return false;
+        }
+        message.*Member = Decode(value);
+        return true;
+    }
+
+private:
+    using Type = MemberType<Member>;
+
+    static uint64_t Encode(const Type& value) {
+        if constexpr (requires { value.time_since_epoch(); }) {
+            return ZigZag(value.time_since_epoch().count());
+        } else if constexpr (requires { value.count(); }) {
+            return ZigZag(value.count());
+        } else if constexpr (std::is_signed_v<Type>) {
+            return ZigZag(value);
+        } else {
+            return static_cast<uint64_t>(value);
+        }
+    }
+    static Type Decode(uint64_t value) {
+        if constexpr (requires { typename Type::duration; }) {
+            return Type(typename Type::duration(static_cast<typename Type::rep>(UnZigZag(value))));
+        } else if constexpr (requires { typename Type::rep; }) {
+            return Type(static_cast<typename Type::rep>(UnZigZag(value)));
+        } else if constexpr (std::is_signed_v<Type>) {
+            return static_cast<Type>(UnZigZag(value));
+        } else {
+            return static_cast<Type>(value);
+        }
+    }
+    static uint64_t ZigZag(int64_t value) {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+    static int64_t UnZigZag(uint64_t value) {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+};
+
+template<auto Member, float Min, float Max, float Resolution>
+struct QuantizedField {
+    static_assert(Min < Max && Resolution > 0);
+    static constexpr size_t MAX_BITS = BitsRequired(QuantizedSteps(Min, Max, Resolution));
+
+    template<typename T>
+    static void Write(const T& message, BitWriter& writer) {
+        writer.WriteQuantized(message.*Member, Min, Max, Resolution);
+    }
+    template<typename T>
+    static bool Read(BitReader& reader, T& message) {
+        return reader.ReadQuantized(Min, Max, Resolution, message.*Member);
+    }
+};
+
+// Wire layout of T, its fields in order:
+//   using PlayerStateSchema = MessageSchema<PlayerState, RangedField<&PlayerState::health, 0, 100>,
+//       QuantizedField<&PlayerState::x, -512.f, 512.f, 0.01f>, BoolField<&PlayerState::crouching>>;
+template<typename T, typename... Fields>
+struct MessageSchema {
+    using Message = T;
+    static constexpr size_t MAX_BITS = (Fields::MAX_BITS + ... + 0);
+    static constexpr size_t MAX_SIZE = (MAX_BITS + 7) / 8;
+
+    // Returns the bytes used, 0 if out is too small or a field is out of its range
+    static size_t Write(const T& message, std::span<char> out) {
+        BitWriter writer(out);
+        (Fields::Write(message, writer), ...);
+        return writer.Flush();
+    }
+    // False if in is truncated or a field is out of its range, message may then be partly filled
+    static bool Read(std::span<const char> in, T& message) {
+        BitReader reader(in);
+        return (Fields::Read(reader, message) && ...);
+    }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+#include "endpoint.h"
+
+struct Client {
+    uint64_t ID;
+    Endpoint endpoint;
+    bool pinged;
+    std::chrono::time_point<std::chrono::steady_clock> lastPing;
+    uint64_t keepAliveTimer = 0; // TimerQueue::TimerID of the pending keep-alive check
+};
+
+// Clients by ID with a second index by endpoint, both kept in sync on Add/Erase so finding the
+// sender of a datagram is a single hash lookup whatever the number of connected clients.
+class ClientTable {
+public:
+    using Map = std::unordered_map<uint64_t, Client>;
+    using iterator = Map::iterator;
+    using const_iterator = Map::const_iterator;
+
+    // Replaces any client already registered with the same ID
+    Client& Add(const Client& client) {
+        Erase(client.ID);
+        auto [it, inserted] = clients.emplace(client.ID, client);
+        byEndpoint[client.endpoint] = &it->second; // map nodes are stable, the pointer survives rehashing
+        return it->second;
+    }
+
+    bool Erase(uint64_t id) {
+        const auto it = clients.find(id);
+        if (it == clients.end()) {
+            return false;
+        }
+        Erase(it);
+        return true;
+    }
+
+    iterator Erase(iterator it) {
+        byEndpoint.erase(it->second.endpoint);
+        return clients.erase(it);
+    }
+
+    [[nodiscard]] Client* Find(uint64_t id) {
+        const auto it = clients.find(id);
+        return it != clients.end() ? &it->second : nullptr;
+    }
+
+    [[nodiscard]] Client* FindByEndpoint(const Endpoint& endpoint) {
+        const auto it = byEndpoint.find(endpoint);
+        return it != byEndpoint.end() ? it->second : nullptr;
+    }
+
+    [[nodiscard]] size_t size() const { return clients.size(); }
+    [[nodiscard]] bool empty() const { return clients.empty(); }
+
+    iterator begin() { return clients.begin(); }
+    iterator end() { return clients.end(); }
+    const_iterator begin() const { return clients.begin(); }
+    const_iterator end() const { return clients.end(); }
+
+private:
+    Map clients;
+    std::unordered_map<Endpoint, Client*> byEndpoint;
+};
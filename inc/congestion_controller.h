@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+// Send budget of reliable traffic on one connection
+struct CongestionConfig {
+    bool enabled = true;
+
+    // Bytes of reliable datagrams in flight (sent and not acked yet). The window doubles every round trip in
+    // slow start, then grows by one datagram per round trip. A loss halves it, a retransmission timeout
+    // drops it to minWindow, queuing delay above delayThreshold shrinks it by 15% (0 ignores delay).
+    // Queuing delay is measured against the smallest RTT of the last minRttWindow, so a route change
+    // that lengthens the path is only mistaken for a queue until the window has slid past it.
+    size_t initialWindow = 32 * 1200;
+    size_t minWindow = 4 * 1200;
+    size_t maxWindow = 16 * 1024 * 1024;
+    std::chrono::milliseconds delayThreshold{50};
+    std::chrono::milliseconds minRttWindow{10000};
+
+    // Datagrams leave at pacingGain * window / smoothed RTT, in bursts of at most maxBurst bytes.
+    // Unpaced until the first RTT sample.
+    double pacingGain = 2.0;
+    size_t maxBurst = 16 * 1200;
+};
+
+// AIMD congestion window and token bucket pacer of one connection, driven by the ack traces of its reliable
+// streams. Unreliable datagrams are never held back, but they draw on the same pacing budget so reliable
+// traffic leaves them their share of the link. Not thread-safe.
+class CongestionController {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Duration = std::chrono::microseconds;
+
+    CongestionController(const CongestionConfig& config, size_t datagramSize);
+
+    // Whether a new reliable datagram may leave now
+    [[nodiscard]] bool CanSend(Clock::time_point now);
+    // When the pacer lets the next one go, empty while the window is full since only an ack can open it
+    [[nodiscard]] std::optional<Clock::time_point> NextSendTime(Clock::time_point now);
+
+    // A new reliable datagram of bytes, in flight until acked
+    void OnReliableSent(size_t bytes, Clock::time_point now);
+    // Unreliable datagrams and resends only spend pacing budget
+    void OnUnreliableSent(size_t bytes, Clock::time_point now);
+    void OnRetransmit(size_t bytes, Clock::time_point now);
+
+    void OnAcked(size_t bytes, Clock::time_point sentTime);
+    // Losses of datagrams sent before the last reduction belong to the same congestion event
+    void OnLoss(Clock::time_point sentTime, Clock::time_point now);
+    void OnTimeout(Clock::time_point sentTime, Clock::time_point now);
+    void OnRttSample(Duration rtt, Duration smoothedRtt, Clock::time_point now);
+
+    [[nodiscard]] size_t Window() const { return window; }
+    [[nodiscard]] size_t BytesInFlight() const { return inFlight; }
+    [[nodiscard]] bool InSlowStart() const { return window < slowStartThreshold; }
+    // Bytes per second, 0 while unpaced
+    [[nodiscard]] double PacingRate() const;
+    [[nodiscard]] uint64_t CongestionEvents() const { return congestionEvents; }
+
+private:
+    void Refill(Clock::time_point now);
+    void Spend(size_t bytes, Clock::time_point now);
+    void Reduce(size_t newWindow, Clock::time_point now);
+    void UpdateMinRtt(Duration rtt, Clock::time_point now);
+
+    // minRttWindow is split in buckets, the oldest is forgotten as a new one starts
+    static constexpr size_t MIN_RTT_BUCKETS = 4;
+
+    CongestionConfig config;
+    size_t datagramSize;
+
+    size_t window;
+    size_t slowStartThreshold = SIZE_MAX;
+    size_t inFlight = 0;
+    size_t ackedSinceGrowth = 0; // congestion avoidance grows the window once a window worth of bytes was acked
+    Clock::time_point recoveryStart{};
+    uint64_t congestionEvents = 0;
+
+    Duration minRtt = Duration::max();
+    std::array<Duration, MIN_RTT_BUCKETS> minRttBuckets;
+    size_t minRttBucket = 0;
+    Clock::time_point minRttBucketStart{};
+    Duration smoothedRtt{0};
+
+    double tokens; // may go negative down to -maxBurst, unreliable datagrams are sent regardless
+    Clock::time_point lastRefill{};
+};
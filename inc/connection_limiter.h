@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "endpoint.h"
+
+// Token bucket per source prefix (/24 for IPv4, /48 for IPv6) for connection requests, so one network
+// flooding them can't crowd out the others. Not thread-safe.
+class ConnectionLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // rate requests per second with bursts of up to burst, rate 0 allows everything. Past maxPrefixes
+    // tracked prefixes, the new ones share a single bucket.
+    ConnectionLimiter(double rate, uint32_t burst, size_t maxPrefixes);
+
+    bool Allow(const Endpoint& from, Clock::time_point now);
+
+    static uint64_t Prefix(const Endpoint& endpoint);
+    [[nodiscard]] size_t TrackedPrefixes() const { return buckets.size(); }
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        Clock::time_point updated;
+    };
+
+    bool Take(Bucket& bucket, Clock::time_point now) const;
+
+    double rate;
+    double burst;
+    size_t maxPrefixes;
+    std::unordered_map<uint64_t, Bucket> buckets;
+    Bucket overflow;
+    bool overflowStarted = false;
+    Clock::time_point lastSweep{};
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+// Resolved peer address. It is kept normalized (IPv4-mapped IPv6 addresses are stored as IPv4) so that
+// comparing and hashing are a few integer operations, the backend converts it to a sockaddr_storage
+// only when talking to the socket. Parsing and formatting are backend specific and never needed per packet.
+class Endpoint {
+public:
+    enum class Family : uint8_t {
+        None,
+        IPv4,
+        IPv6
+    };
+
+    Endpoint() = default;
+
+    static Endpoint FromIPv4(const std::array<uint8_t, 4>& address, uint16_t port) {
+        Endpoint endpoint;
+        endpoint.family = Family::IPv4;
+        endpoint.port = port;
+        std::memcpy(endpoint.address.data(), address.data(), address.size());
+        return endpoint;
+    }
+
+    static Endpoint FromIPv6(const std::array<uint8_t, 16>& address, uint16_t port, uint32_t scopeID = 0) {
+        Endpoint endpoint;
+        endpoint.family = Family::IPv6;
+        endpoint.port = port;
+        endpoint.scopeID = scopeID;
+        endpoint.address = address;
+        return endpoint;
+    }
+
+    // Numeric address only ("127.0.0.1", "::1"), returns an invalid endpoint if ip cannot be parsed
+    static Endpoint Parse(const std::string& ip, uint16_t port);
+
+    [[nodiscard]] std::string Ip() const;
+    [[nodiscard]] std::string ToString() const; // "ip:port" or "[ip]:port"
+
+    [[nodiscard]] bool IsValid() const { return family != Family::None; }
+    [[nodiscard]] Family GetFamily() const { return family; }
+    [[nodiscard]] uint16_t Port() const { return port; }
+    [[nodiscard]] uint32_t ScopeID() const { return scopeID; }
+    [[nodiscard]] const std::array<uint8_t, 16>& Address() const { return address; } // IPv4 uses the first 4 bytes
+
+    bool operator==(const Endpoint& other) const = default;
+
+    [[nodiscard]] size_t Hash() const {
+        uint64_t low, high;
+        std::memcpy(&low, address.data(), sizeof(low));
+        std::memcpy(&high, address.data() + 8, sizeof(high));
+        uint64_t h = low ^ (high * 0x9E3779B97F4A7C15ull) ^ (uint64_t(port) << 48) ^ (uint64_t(family) << 40) ^ scopeID;
+        // murmur3 finalizer
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ull;
+        h ^= h >> 33;
+        return static_cast<size_t>(h);
+    }
+
+private:
+    Family family = Family::None;
+    uint16_t port = 0;
+    uint32_t scopeID = 0;
+    std::array<uint8_t, 16> address{};
+};
+
+template<>
+struct std::hash<Endpoint> {
+    size_t operator()(const Endpoint& endpoint) const noexcept {
+        return endpoint.Hash();
+    }
+};
@@ -10,7 +10,29 @@
 #include <cstring>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
 #include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <array>
+
+#include "packet_pool.h"
+#include "endpoint.h"
+#include "client_table.h"
+#include "timer_queue.h"
+#include "sequence_buffer.h"
+#include "rtt_estimator.h"
+#include "wire.h"
+#include "bit_stream.h"
+#include "spsc_queue.h"
+#include "flat_hash_map.h"
+#include "network_simulator.h"
+#include "metrics.h"
+#include "congestion_controller.h"
+#include "connection_limiter.h"
+#include "send_scheduler.h"
 
 #ifdef WIN32
     using SocketType = unsigned int;
@@ -20,7 +42,40 @@
 
 static constexpr uint32_t RELIABLESTREAMMASK = 1<<30;
 static constexpr uint32_t SERVERSTREAMMASK = 1<<31;
+static constexpr uint32_t ORDEREDSTREAMMASK = 1<<29; // reliable streams delivering messages in the order they were sent
 static constexpr uint64_t RELIABLE_ACK_MASK = uint64_t(1)<<63;
+static constexpr size_t RELIABLE_WINDOW = 64; // unacked messages per reliable stream, one bit each in MsgAck::trace
+static constexpr int FAST_RETRANSMIT_THRESHOLD = 3; // newer messages acked past a gap before it is resent early
+static constexpr uint32_t MAX_FRAGMENTS = 32768; // half the sequence space, fragments of two messages never share a sequence
+
+// Chosen when a stream is created. The peer learns it from the compressed flag of each message, it needs the
+// same dictionary registered under dictionaryID to read them.
+struct CompressionOptions {
+    bool enabled = false;
+    uint32_t dictionaryID = 0; // 0 for none, see Falcon::RegisterDictionary
+};
+
+// Chosen by whoever creates a stream, both directions of the stream follow it
+enum class StreamDelivery : uint8_t {
+    Unreliable, // may be lost, duplicated or reordered
+    ReliableUnordered, // every message once, as soon as it arrives
+    ReliableOrdered // every message once, in send order: a lost one holds back the rest of its stream only
+};
+
+class Falcon;
+
+// Shared by a Falcon and its streams so a stream may be destroyed after its Falcon: the Falcon clears falcon
+// once its network thread stopped, and a stream only unregisters itself while it is set. Using a stream
+// after its Falcon is gone is still an error. A stream pins the Falcon and unregisters outside the mutex, which
+// is never held together with another lock, and the Falcon waits for the pins before it goes away.
+struct FalconLifetime {
+    explicit FalconLifetime(Falcon* falcon) : falcon(falcon) {}
+
+    std::mutex mutex;
+    std::condition_variable unpinned;
+    Falcon* falcon;
+    int pins = 0;
+};
 
 #include "stream.h"
 
@@ -29,17 +84,24 @@ enum MsgType: uint8_t {
     MSG_CONN_ACK,
     MSG_STANDARD,
     MSG_ACK,
-    PING
+    PING,
+    PONG, // reply to a PING, same layout
+    MSG_BUNDLE, // several messages coalesced in one datagram, each prefixed by its varint size
+    MSG_CONN_CHALLENGE // reply to a MSG_CONN without a valid cookie, same layout
 };
 
 struct Msg {
-    std::string IP;
-    int Port;
-    std::vector<char> data;
+    Endpoint from;
+    PacketHandle packet; // keeps the received buffer alive, empty for messages we are sending
+    std::span<const char> data; // only the bytes actually received
 };
 
+// The first request carries no cookie. The server answers with a challenge signing the client's address
+// and the time, and only accepts the connection once the client sends it back.
 struct MsgConn {
     uint8_t messageType;
+    uint32_t timestamp; // seconds on the server's clock when it issued the cookie
+    uint64_t cookie;
 };
 
 struct MsgConnAck {
@@ -47,19 +109,25 @@ struct MsgConnAck {
     uint64_t clientID;
 };
 
-struct MsgStandard {
-    uint8_t messageType;
+// Stream message decoded in place, data points into the received packet instead of being copied. On the wire
+// it is the compact header of wire.h followed by only the payload bytes.
+struct MsgStandardView {
     uint64_t clientID;
     uint32_t streamID;
-    uint8_t messageID;
-    char data[1024];
+    uint16_t messageID;
+    std::span<const char> data;
+    // see StandardHeader, fragmentCount is 0 for a whole message
+    uint32_t fragmentIndex = 0;
+    uint32_t fragmentCount = 0;
+    uint32_t fragmentSize = 0;
+    bool compressed = false; // the payload (reassembled one for a fragment) goes through Falcon's decompression
 };
 
 struct MsgAck {
     uint8_t messageType;
     uint64_t clientID;
     uint32_t streamID;
-    uint8_t messageID;
+    uint16_t messageID;
     uint64_t trace;
 };
 
@@ -70,12 +138,289 @@ struct Ping {
     std::chrono::steady_clock::time_point time;
 };
 
-struct Client {
-    uint64_t ID;
-    std::string IP;
-    int Port;
-    bool pinged;
-    std::chrono::time_point<std::chrono::steady_clock> lastPing;
+// Wire layout of the control messages, the message type is always the first byte
+template<typename T>
+struct MessageSchemaOf;
+template<>
+struct MessageSchemaOf<MsgConn> : MessageSchema<MsgConn, BitsField<&MsgConn::messageType>, BitsField<&MsgConn::timestamp>,
+    BitsField<&MsgConn::cookie>> {};
+template<>
+struct MessageSchemaOf<MsgConnAck> : MessageSchema<MsgConnAck, BitsField<&MsgConnAck::messageType>, VarintField<&MsgConnAck::clientID>> {};
+template<>
+struct MessageSchemaOf<MsgAck> : MessageSchema<MsgAck, BitsField<&MsgAck::messageType>, VarintField<&MsgAck::clientID>,
+    BitsField<&MsgAck::streamID>, BitsField<&MsgAck::messageID>, BitsField<&MsgAck::trace, RELIABLE_WINDOW>> {};
+template<>
+struct MessageSchemaOf<Ping> : MessageSchema<Ping, BitsField<&Ping::messageType>, VarintField<&Ping::clientID>,
+    BitsField<&Ping::pingID>, VarintField<&Ping::time>> {};
+
+// Stack buffer large enough for any message of type T
+template<typename T>
+using MessageBuffer = std::array<char, MessageSchemaOf<T>::MAX_SIZE>;
+
+// Reliable message waiting for its ack, the serialized datagram stays in a pooled buffer for resends
+struct SentMessage {
+    PacketHandle packet;
+    Endpoint to;
+    std::chrono::steady_clock::time_point sentTime;
+    uint32_t size = 0; // datagram bytes, in flight for the congestion controller until acked
+    uint32_t transmissions = 0; // more than one means its ack can't be used as an RTT sample
+    bool fastRetransmitted = false;
+    TimerQueue::TimerID retransmitTimer = TimerQueue::INVALID_TIMER;
+};
+
+// Reliable messages seen on a stream, bit 63 is latestID and bit 63 - n is latestID - n
+struct ReceiveWindow {
+    uint16_t latestID = 0;
+    uint64_t received = 0;
+
+    // Already received, or too old to tell
+    [[nodiscard]] bool IsDuplicate(uint16_t messageID) const {
+        if (received == 0) {
+            return false;
+        }
+        const auto delta = static_cast<int16_t>(messageID - latestID);
+        if (delta > 0) {
+            return false;
+        }
+        return -delta >= 64 || (received & RELIABLE_ACK_MASK >> -delta);
+    }
+
+    // Too far behind latestID for the window to tell whether it was received
+    [[nodiscard]] bool IsOutOfWindow(uint16_t messageID) const {
+        return received != 0 && -static_cast<int16_t>(messageID - latestID) >= 64;
+    }
+
+    void Record(uint16_t messageID) {
+        if (received == 0) {
+            latestID = messageID;
+            received = RELIABLE_ACK_MASK;
+            return;
+        }
+        const auto delta = static_cast<int16_t>(messageID - latestID);
+        if (delta > 0) {
+            received = delta < 64 ? (received >> delta) | RELIABLE_ACK_MASK : RELIABLE_ACK_MASK;
+            latestID = messageID;
+        } else if (-delta < 64) {
+            received |= RELIABLE_ACK_MASK >> -delta;
+        }
+    }
+};
+
+// Reliable message waiting for room in the send window, it leaves the backlog one fragment at a time
+struct PendingMessage {
+    std::shared_ptr<const std::vector<char>> data;
+    uint32_t fragmentSize = 0;
+    uint32_t fragmentCount = 0; // 0 when sent whole
+    uint32_t nextFragment = 0;
+    bool compressed = false;
+};
+
+// Complete message of an ordered stream received ahead of the next one to deliver
+struct ReorderedMessage {
+    std::vector<char> data;
+    uint32_t sequenceCount = 1; // its fragments, the next message starts at its first sequence + sequenceCount
+    bool compressed = false;
+};
+
+// Fragments of one message received so far, they are copied straight to their place in data
+struct Reassembly {
+    uint16_t firstSequence = 0;
+    uint32_t fragmentCount = 0;
+    uint32_t fragmentSize = 0;
+    uint32_t fragmentsReceived = 0;
+    size_t lastFragmentSize = 0;
+    std::vector<char> data; // fragmentCount * fragmentSize bytes, trimmed once complete
+    std::vector<bool> received;
+    std::chrono::steady_clock::time_point lastProgress;
+};
+
+static constexpr size_t COMPLETED_REASSEMBLIES = 64; // per stream, remembered to drop their late duplicates
+
+// Fragmented message reassembled lately
+struct CompletedReassembly {
+    uint16_t firstSequence = 0;
+    uint32_t fragmentCount = 0;
+    std::chrono::steady_clock::time_point completed;
+};
+
+struct StreamState {
+    uint16_t nextMessageID = 0;
+    SequenceBuffer<SentMessage, RELIABLE_WINDOW> sent;
+    ReceiveWindow received;
+
+    Endpoint peer; // where the backlog goes
+    std::deque<PendingMessage> backlog;
+    size_t backlogBytes = 0;
+
+    std::vector<Reassembly> reassemblies;
+    // the last COMPLETED_REASSEMBLIES ones: late duplicates of their fragments (unreliable streams have no receive
+    // window to catch them) are dropped for reassemblyTimeout instead of starting a reassembly that never completes
+    std::vector<CompletedReassembly> completedReassemblies;
+    size_t nextCompletedReassembly = 0;
+
+    // ordered streams: first sequence of the next message to deliver, and the messages waiting behind it by
+    // first sequence. The sender can't get RELIABLE_WINDOW sequences past a message we haven't acked.
+    uint16_t nextDelivery = 0;
+    SequenceBuffer<ReorderedMessage, RELIABLE_WINDOW> reorder;
+    size_t reorderMessages = 0;
+    size_t reorderBytes = 0;
+
+    std::shared_ptr<StreamCounters> counters = std::make_shared<StreamCounters>();
+    std::shared_ptr<ClientCounters> client; // of the connection the stream belongs to
+};
+
+// Send budget of a connection's reliable streams
+struct ConnectionCongestion {
+    ConnectionCongestion(const CongestionConfig& config, size_t datagramSize) : controller(config, datagramSize) {}
+
+    CongestionController controller;
+    std::vector<uint64_t> blockedStreams; // StreamKeys with a backlog held back by the controller
+    TimerQueue::TimerID pacingTimer = TimerQueue::INVALID_TIMER;
+    // messages sent together expire together, the RTO only backs off once per timeout like a single timer would
+    std::chrono::steady_clock::time_point nextBackoff{};
+};
+
+// Something that happened on the network thread, queued for Falcon::Poll when pollEvents is set
+struct FalconEvent {
+    enum class Type : uint8_t {
+        ClientConnected,
+        ClientDisconnected,
+        ConnectionResult, // client side, success tells whether the server accepted us
+        Disconnected, // client side, the server stopped answering
+        Data // creates the stream first if the peer opened it
+    };
+
+    Type type = Type::Data;
+    bool success = false;
+    uint32_t streamID = 0;
+    Client client{}; // the client that connected or disconnected, the server info for ConnectionResult, the sender for Data
+    // Data: points into packet for a message received whole, into message for a reassembled one
+    std::span<const char> data;
+    PacketHandle packet;
+    std::vector<char> message;
+};
+
+struct FalconConfig {
+    // Datagrams moved per recvmmsg/sendmmsg call (plain loop on backends without them).
+    // 1 disables batching: sends go out immediately instead of being queued until the next loop iteration.
+    uint32_t ioBatchSize = 1;
+
+    // Receive buffers are taken from a pool allocated once, datagrams bigger than a buffer are dropped
+    size_t packetBufferSize = 4096;
+    size_t packetPoolSize = 256;
+    // Buffers holding outgoing stream messages, reliable ones keep theirs until acknowledged
+    size_t sendPoolSize = 512;
+
+    // Keep-alive: a silent peer is pinged after pingInterval and dropped after timeout
+    std::chrono::milliseconds pingInterval{1000};
+    std::chrono::milliseconds timeout{2000};
+    // How long a client waits for the server to accept its connection
+    std::chrono::milliseconds connectTimeout{1000};
+
+    // Retransmission timeout of reliable messages before the first RTT sample, and its bounds afterwards
+    std::chrono::milliseconds initialRetransmitTimeout{1000};
+    std::chrono::milliseconds minRetransmitTimeout{100};
+    std::chrono::milliseconds maxRetransmitTimeout{10000};
+
+    // Coalescing: messages to the same peer are packed into one datagram of up to maxDatagramSize bytes.
+    // Bundles go out on Flush(), when full, at the end of a network loop iteration that added to them (acks, pings),
+    // and at the latest coalesceDelay after the first message buffered by another thread.
+    bool coalesceMessages = false;
+    size_t maxDatagramSize = 1200; // stays under the usual path MTU, also the size of fragments
+    std::chrono::milliseconds coalesceDelay{5};
+
+    // Messages that don't fit in one datagram are split in fragments and reassembled by the receiver
+    size_t maxMessageSize = 16 * 1024 * 1024;
+    // Bytes of reliable messages per stream waiting for room in the send window
+    size_t maxSendBacklog = 64 * 1024 * 1024;
+    // Memory of all partially received messages, and how long one may go without a new fragment
+    size_t reassemblyMemoryLimit = 64 * 1024 * 1024;
+    std::chrono::milliseconds reassemblyTimeout{5000};
+    // Bytes waiting in the reorder buffer of an ordered stream. Past it, messages received whole are left
+    // unacked until the gap is filled.
+    size_t maxReorderBytes = 4 * 1024 * 1024;
+
+    // Connection handshake: with cookies the server keeps nothing about a client until it echoes a challenge
+    // signed for its address, so requests from spoofed addresses cost a hash and a reply the size of the request.
+    // Echoes of a cookie that was never signed for their address cost only the hash.
+    // Requests beyond connectionRatePerPrefix per second (bursts of connectionBurstPerPrefix) from one /24 or
+    // /48 are ignored. With cookies only echoes of a valid one count, so spoofed requests can't lock a prefix
+    // out. 0 disables the limit.
+    bool connectionCookies = true;
+    std::chrono::seconds cookieLifetime{10};
+    double connectionRatePerPrefix = 100;
+    uint32_t connectionBurstPerPrefix = 200;
+    size_t maxTrackedPrefixes = 4096;
+
+    // Set by ShardedServer: the socket shares its port with the other shards (SO_REUSEPORT),
+    // and client IDs are firstClientID, firstClientID + clientIDStride, ... so they stay unique across shards
+    bool reusePort = false;
+    uint64_t firstClientID = 1;
+    uint64_t clientIDStride = 1;
+
+    // Poll mode: handlers no longer run on the network thread, events wait in a lock-free ring of
+    // eventQueueSize entries until Falcon::Poll runs them on the caller's thread. Received data keeps its
+    // pooled buffer until it is polled, a game loop that stops polling eventually runs the pool dry.
+    bool pollEvents = false;
+    size_t eventQueueSize = 4096;
+
+    // Network simulator: outgoing datagrams are lost, delayed, duplicated and reordered as described, to test
+    // on loopback. It only impairs what this instance sends, configure both peers to impair both directions.
+    // The connection handshake bypasses it.
+    NetworkConditions simulation;
+
+    // Logs GetStats() this often from the network thread, totals at info level and each connection at debug.
+    // 0 disables it.
+    std::chrono::milliseconds statsDumpInterval{0};
+
+    // Pacing and congestion control of each connection. Reliable messages wait in their stream's backlog while
+    // the congestion window is full or the pacer is out of budget, unreliable ones are never held back.
+    CongestionConfig congestion;
+
+    // Priority scheduling of stream messages under a bandwidth cap: with a bytesPerTick budget, SendData only
+    // queues and each Flush() sends every client's share, see SendScheduler and Stream::SetPriority.
+    SendSchedulerConfig scheduler;
+};
+
+struct FalconStats {
+    uint64_t datagramsReceived = 0;
+    uint64_t datagramsSent = 0;
+    uint64_t receiveCalls = 0; // receive syscalls that returned data
+    uint64_t sendCalls = 0;
+    uint32_t maxReceiveBatch = 0; // most datagrams moved by a single receive call
+    uint32_t maxSendBatch = 0;
+    uint64_t datagramsDropped = 0; // truncated, or received while every pooled buffer was in use
+    uint64_t retransmissions = 0; // reliable messages resent after their timer expired
+    uint64_t fastRetransmissions = 0; // resent early because newer messages were acked past them
+    uint64_t messagesCoalesced = 0; // messages that shared their datagram with others
+    uint64_t messagesFragmented = 0;
+    uint64_t messagesReassembled = 0;
+    uint64_t reassembliesDropped = 0; // over the memory limit or timed out
+    // datagrams the network simulator dropped (loss or full queue), sent twice, or held back to reorder them
+    uint64_t simulatedLost = 0;
+    uint64_t simulatedDuplicated = 0;
+    uint64_t simulatedReordered = 0;
+    // messages sent compressed, and sent raw because compressing didn't make them smaller
+    uint64_t messagesCompressed = 0;
+    uint64_t compressionSkipped = 0;
+    // sizes before and after compression of the messages sent compressed
+    uint64_t compressionInputBytes = 0;
+    uint64_t compressionOutputBytes = 0;
+    // CPU time spent in the codec, skipped attempts included
+    std::chrono::nanoseconds compressionTime{0};
+    std::chrono::nanoseconds decompressionTime{0};
+    // handshake: challenges sent, echoed cookies that were forged or expired, requests over the prefix limit
+    uint64_t connectionChallenges = 0;
+    uint64_t connectionCookiesRejected = 0;
+    uint64_t connectionsRateLimited = 0;
+
+    // per connection and per stream, in no particular order
+    std::vector<ClientStats> clients;
+
+    // original size over compressed size, 1 until a message was sent compressed
+    [[nodiscard]] double CompressionRatio() const {
+        return compressionOutputBytes == 0 ? 1.0 : double(compressionInputBytes) / double(compressionOutputBytes);
+    }
 };
 
 class Stream;
@@ -83,16 +428,22 @@ class Stream;
 class Falcon {
 public:
     Falcon();
+    explicit Falcon(const FalconConfig& config);
     ~Falcon();
     Falcon(const Falcon&) = default;
     Falcon& operator=(const Falcon&) = default;
     Falcon(Falcon&&) = default;
     Falcon& operator=(Falcon&&) = default;
 
-    [[nodiscard]] static std::unique_ptr<Falcon> Listen(const std::string& endpoint, uint16_t port);
+    [[nodiscard]] static std::unique_ptr<Falcon> Listen(const std::string& endpoint, uint16_t port, const FalconConfig& config = {});
     void ConnectTo(const std::string& serverIp, uint16_t port);
 
+    int SendTo(const Endpoint& to, std::span<const char> message);
     int SendTo(const std::string& to, uint16_t port, std::span<const char> message);
+    // Sends every coalesced bundle and batched datagram now, call it at the end of a game tick.
+    // With a scheduler budget, first sends this tick's share of the queued stream messages.
+    void Flush();
+    int ReceiveFrom(Endpoint& from, std::span<char, 65535> message);
     int ReceiveFrom(std::string& from, std::span<char, 65535> message);
 
     void OnClientConnected(const std::function<void(uint64_t)>& handler);
@@ -100,85 +451,299 @@ public:
     void OnClientDisconnected(const std::function<void(uint64_t)>& handler);
     void OnDisconnect(const std::function<void()>& handler);
     void OnStreamCreated(const std::function<void(uint32_t)> &handler);
+    // A stream opened by the peer, owned by this Falcon and valid until CloseStream or until the
+    // OnClientDisconnected handlers of its client returned. Register its data handlers here.
+    void OnStreamOpened(const std::function<void(Stream&)>& handler);
 
     // Gestion des Streams
-    [[nodiscard]] std::unique_ptr<Stream> CreateStream(uint64_t client, bool reliable); // Server API
-    [[nodiscard]] std::unique_ptr<Stream> CreateStream(bool reliable); // Client API
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(uint64_t client, StreamDelivery delivery, const CompressionOptions& compression = {}); // Server API
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(StreamDelivery delivery, const CompressionOptions& compression = {}); // Client API
+    // reliable streams are unordered
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(uint64_t client, bool reliable, const CompressionOptions& compression = {}); // Server API
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(bool reliable, const CompressionOptions& compression = {}); // Client API
     void CloseStream(const Stream& stream);
 
+    // Shared dictionary for compressed streams, usually trained offline with TrainLzDictionary on typical
+    // messages. Both ends must register the same bytes under the same ID before messages using it are sent.
+    void RegisterDictionary(uint32_t id, std::span<const char> dictionary);
+
 
+    // In poll mode both return the state as of the last Poll, safe to call from the polling thread
     Client GetClient(const uint64_t id) {
-        return clients[id];
+        if (m_config.pollEvents) {
+            const auto it = m_polledClients.find(id);
+            return it != m_polledClients.end() ? it->second : Client{};
+        }
+        const Client* client = clients.Find(id);
+        return client ? *client : Client{};
     }
 
     Client GetClientInfoFromServer() {
-        return clientInfoFromServer;
+        return m_config.pollEvents ? m_polledServerInfo : clientInfoFromServer;
     }
 
+    // Poll mode only: runs the handlers of up to maxEvents queued events on the calling thread, returns how many ran.
+    // Only one thread may poll a given Falcon.
+    size_t Poll(size_t maxEvents = SIZE_MAX);
+
+    // Round-trip estimate of a connection, empty until it has been measured
+    [[nodiscard]] std::optional<RttEstimator> GetRtt(uint64_t clientID); // Server API
+    [[nodiscard]] std::optional<RttEstimator> GetRtt(); // Client API
+
+    [[nodiscard]] FalconStats GetStats() const;
+
     template<typename T>
     static bool DeserializeMessage(const Msg &msg, uint8_t expectedType, T& out) {
-        if (msg.data.size() >= sizeof(T)) {
-            T message;
-            std::memcpy(&message, msg.data.data(), sizeof(T));
-            if (message.messageType == expectedType) {
-                out = message;
-                return true;
-            }
-        }
-        return false;
+        // messageType is always the first byte, check it before decoding anything
+        return !msg.data.empty() && static_cast<uint8_t>(msg.data[0]) == expectedType && MessageSchemaOf<T>::Read(msg.data, out);
     }
 
+    static bool ParseStandardMessage(const Msg &msg, MsgStandardView& out);
+
+    // Encodes into out, a MessageBuffer<T> always has room. Returns the bytes used, 0 if out is too small.
     template<typename T>
-    [[nodiscard]] static std::vector<char> SerializeMessage(const T &message) {
-        std::vector<char> buffer(sizeof(T));
-        std::memcpy(buffer.data(), &message, sizeof(T));
-        return buffer;
+    [[nodiscard]] static size_t SerializeMessage(const T &message, std::span<char> out) {
+        return MessageSchemaOf<T>::Write(message, out);
     }
 
 
 private:
 
-    uint64_t nextClientID = 1; // ID unique attribué aux clients
+    FalconConfig m_config;
+    PacketPool m_packetPool{m_config.packetBufferSize, m_config.packetPoolSize};
+    PacketPool m_sendPool{m_config.packetBufferSize, m_config.sendPoolSize};
+
+    uint64_t nextClientID = m_config.firstClientID; // ID unique attribué aux clients
     uint32_t nextStreamID = 1; // ID unique attribué aux Stream
-    std::vector<uint32_t> streams; // Liste des Stream
-    std::unordered_map<uint32_t, std::vector<MsgStandard>> reliableMessagesReceived;
-    std::unordered_map<uint32_t, std::vector<MsgStandard>> reliableMessagesSent;
 
-    SocketType m_socket;
+    // open streams by StreamKey, the ones the peer opened are owned here. Recursive so handlers
+    // running under it may create and close streams.
+    struct StreamEntry {
+        Stream* stream = nullptr;
+        std::unique_ptr<Stream> owned;
+    };
+    std::recursive_mutex m_streamRegistryMutex;
+    const std::shared_ptr<FalconLifetime> m_lifetime = std::make_shared<FalconLifetime>(this);
+    FlatHashMap<StreamEntry> m_streamRegistry;
+
+    // sequence numbers and reliable windows, keyed by StreamKey since every client numbers its streams from 1
+    mutable std::mutex m_streamsMutex;
+    std::unordered_map<uint64_t, StreamState> streamStates;
+    static uint64_t StreamKey(uint64_t clientID, uint32_t streamID) { return clientID << 32 | streamID; }
+    std::unordered_map<uint64_t, RttEstimator> connectionRtt; // by clientID, guarded by m_streamsMutex
+    std::unordered_map<uint64_t, std::shared_ptr<ClientCounters>> clientCounters; // same
+    std::unordered_map<uint64_t, ConnectionCongestion> connectionCongestion; // same
+    size_t m_reassemblyBytes = 0; // guarded by m_streamsMutex
+
+    SocketType m_socket = static_cast<SocketType>(-1);
+    Endpoint::Family m_socketFamily = Endpoint::Family::None; // an IPv6 socket is dual-stack, IPv4 peers get mapped
 
     std::thread m_thread;
+    // set by the network thread itself, m_thread may still be being assigned when it first runs
+    std::atomic<std::thread::id> m_networkThreadID{};
     std::atomic<bool> m_running = true;
+    TimerQueue m_timers; // keep-alives and every other deadline of the network thread
+
+    // Readiness notification for the network thread, defined by each backend
+    // (epoll + eventfd on Linux, poll + pipe on other POSIX, WSA events on Windows)
+    struct Reactor;
+    std::unique_ptr<Reactor> m_reactor;
+
+    struct Datagram {
+        Endpoint from;
+        PacketHandle packet;
+    };
+    std::vector<Datagram> m_receiveBatch;
+
+    // outgoing datagrams waiting for the next sendmmsg flush when ioBatchSize > 1
+    struct QueuedDatagram {
+        Endpoint to;
+        size_t offset; // into m_sendQueueData
+        size_t size;
+    };
+    std::mutex m_sendQueueMutex;
+    std::vector<QueuedDatagram> m_sendQueue;
+    std::vector<char> m_sendQueueData;
+
+    // messages waiting to be coalesced when coalesceMessages is set, one bundle per destination
+    struct Bundle {
+        std::vector<char> data; // MSG_BUNDLE followed by size-prefixed messages
+        size_t messages = 0;
+    };
+    std::mutex m_bundleMutex;
+    std::unordered_map<Endpoint, Bundle> m_bundles;
+    TimerQueue::TimerID m_bundleFlushTimer = TimerQueue::INVALID_TIMER;
+    bool m_networkThreadBundled = false; // only touched by the network thread
+
+    // datagrams in simulated flight when simulation is enabled, sent for real by the network thread once due
+    mutable std::mutex m_simulatorMutex;
+    NetworkSimulator m_simulator{m_config.simulation};
+    std::vector<NetworkSimulator::Datagram> m_simulatorDue; // network thread only
+
+    // stream messages waiting for their tick when scheduler.bytesPerTick is set, by clientID
+    mutable std::mutex m_schedulerMutex;
+    std::unordered_map<uint64_t, SendScheduler> m_schedulers;
+
+    std::atomic<uint64_t> m_datagramsReceived = 0;
+    std::atomic<uint64_t> m_datagramsSent = 0;
+    std::atomic<uint64_t> m_receiveCalls = 0;
+    std::atomic<uint64_t> m_sendCalls = 0;
+    std::atomic<uint32_t> m_maxReceiveBatch = 0;
+    std::atomic<uint32_t> m_maxSendBatch = 0;
+    std::atomic<uint64_t> m_datagramsDropped = 0;
+    std::atomic<uint64_t> m_retransmissions = 0;
+    std::atomic<uint64_t> m_fastRetransmissions = 0;
+    std::atomic<uint64_t> m_messagesCoalesced = 0;
+    std::atomic<uint64_t> m_messagesFragmented = 0;
+    std::atomic<uint64_t> m_messagesReassembled = 0;
+    std::atomic<uint64_t> m_reassembliesDropped = 0;
+    std::atomic<uint64_t> m_messagesCompressed = 0;
+    std::atomic<uint64_t> m_compressionSkipped = 0;
+    std::atomic<uint64_t> m_compressionInputBytes = 0;
+    std::atomic<uint64_t> m_compressionOutputBytes = 0;
+    std::atomic<int64_t> m_compressionNanoseconds = 0;
+    std::atomic<int64_t> m_decompressionNanoseconds = 0;
+    std::atomic<uint64_t> m_connectionChallenges = 0;
+    std::atomic<uint64_t> m_connectionCookiesRejected = 0;
+    std::atomic<uint64_t> m_connectionsRateLimited = 0;
+
+    // network thread only. The cookie key is drawn at construction, restarting invalidates pending cookies.
+    ConnectionLimiter m_connectionLimiter{m_config.connectionRatePerPrefix, m_config.connectionBurstPerPrefix, m_config.maxTrackedPrefixes};
+    const std::array<uint64_t, 2> m_cookieKey = NewCookieKey();
+
+    // by ID, entries are never replaced in place so a codec call keeps using the dictionary it looked up
+    mutable std::mutex m_dictionariesMutex;
+    std::unordered_map<uint32_t, std::shared_ptr<const std::vector<char>>> m_dictionaries;
 
     std::vector<std::function<void(uint64_t)>> onClientConnectedHandlers;
     std::vector<std::function<void(bool, uint64_t)>> onConnectionEventHandlers;
     std::vector<std::function<void(uint64_t)>> onClientDisconnectedHandlers;
     std::vector<std::function<void()>> onDisconnectHandlers;
     std::vector<std::function<void(uint32_t)>> onStreamCreatedHandlers;
-
-    std::unordered_map<uint64_t,Client> clients; // server reference to clients
-    Client clientInfoFromServer; // store client info from server
-
-
-
-    int SendToInternal(const std::string& to, uint16_t port, std::span<const char> message);
-    int ReceiveFromInternal(std::string& from, std::span<char, 65535> message);
-    [[nodiscard]] static std::unique_ptr<Falcon> ListenInternal(const std::string& endpoint, uint16_t port);
-
-    std::pair<std::string, int> portFromIp(const std::string &ip);
-
-
-    void handleConnectionMessage(const MsgConn &msg_conn, const std::string& msgIp, int msgPort);
+    std::vector<std::function<void(Stream&)>> onStreamOpenedHandlers;
+
+    ClientTable clients; // server reference to clients, indexed by ID and by endpoint
+    Client clientInfoFromServer{}; // store client info from server, ID 0 until connected
+
+    // poll mode: the network thread produces, the polling thread consumes. A full ring spills into the
+    // overflow vector, and events keep going there until it is drained so they stay in order.
+    SpscQueue<FalconEvent> m_events{m_config.pollEvents ? m_config.eventQueueSize : 1};
+    std::mutex m_eventOverflowMutex;
+    std::vector<FalconEvent> m_eventOverflow;
+    std::atomic<bool> m_eventsOverflowing = false;
+    std::deque<FalconEvent> m_polledOverflow; // polling thread only, taken from m_eventOverflow
+    std::unordered_map<uint64_t, Client> m_polledClients; // polling thread view of clients
+    Client m_polledServerInfo{};
+
+
+
+    int SendToInternal(const Endpoint& to, std::span<const char> message);
+    int ReceiveFromInternal(Endpoint& from, std::span<char, 65535> message);
+    // Receives up to out.size() datagrams in as few syscalls as the backend allows, returns the count
+    int ReceiveBatchInternal(std::span<Datagram> out);
+    // Sends every queued datagram, returns the number handed to the kernel
+    int SendBatchInternal(std::span<const QueuedDatagram> datagrams, const char* data);
+    int SendDatagram(const Endpoint& to, std::span<const char> message);
+    // Sends past the network simulator
+    int TransmitDatagram(const Endpoint& to, std::span<const char> message);
+    void ReleaseSimulated(std::chrono::steady_clock::time_point now);
+    int QueueDatagram(const Endpoint& to, std::span<const char> message);
+    int AppendToBundle(const Endpoint& to, std::span<const char> message);
+    // m_bundleMutex must be held
+    void SendBundle(const Endpoint& to, Bundle& bundle);
+    void FlushBundles();
+    void FlushSendQueue();
+    int ReceiveBatch();
+    void RecordBatch(std::atomic<uint32_t>& maxBatch, uint32_t count);
+    [[nodiscard]] static std::unique_ptr<Falcon> ListenInternal(const std::string& endpoint, uint16_t port, const FalconConfig& config);
+
+    bool InitReactor();
+    // Blocks until the socket is readable, WakeReactor() is called or the deadline is reached.
+    // Returns true if the socket has data to read.
+    bool WaitForEvents(std::chrono::steady_clock::time_point deadline);
+    void WakeReactor();
+
+    void handleConnectionMessage(const MsgConn &msg_conn, const Endpoint& from);
 
     void handleConnectionAckMessage(const MsgConnAck& msg_conn_ack);
+    void handleConnectionChallengeMessage(const MsgConn& challenge, const Endpoint& from);
+    static std::array<uint64_t, 2> NewCookieKey();
+    [[nodiscard]] uint64_t ConnectionCookie(const Endpoint& client, uint32_t timestamp) const;
+    // the handshake has no retry, keep it out of the network simulator
+    int SendHandshake(const Endpoint& to, std::span<const char> message);
+
+    // Connection a datagram from `from` belongs to, 0 unless it is a client that completed the handshake or the
+    // server we are connected to. The client ID on the wire is never trusted, a spoofed source could claim any.
+    [[nodiscard]] uint64_t PeerID(const Endpoint& from);
+    void handleStandardMessage(const MsgStandardView& msg_standard, const Endpoint& from, const PacketHandle& packet);
 
-    void handleStandardMessage(const MsgStandard& msg_standard);
+    // Runs the handlers of event now, or queues it for Poll in poll mode
+    void Emit(FalconEvent&& event);
+    void PushEvent(FalconEvent&& event);
+    void DispatchEvent(FalconEvent& event);
 
-    void handleAckMessage(const MsgAck & msg_ack);
+    void handleAckMessage(const MsgAck & msg_ack, const Endpoint& from);
 
-    void handlePingMessage(const Ping & ping);
+    void handlePingMessage(const Ping & ping, const Endpoint& from);
 
     void handleMessage(const Msg& msg);
 
-    uint64_t GetTrace(uint32_t streamID, uint8_t messageID);
+    void handleBundleMessage(const Msg& msg);
+
+    void RunNetworkLoop();
+    [[nodiscard]] bool OnNetworkThread() const { return std::this_thread::get_id() == m_networkThreadID.load(std::memory_order_relaxed); }
+
+    void ScheduleClientKeepAlive(Client& client, std::chrono::steady_clock::time_point deadline);
+    void handleClientKeepAlive(uint64_t clientID);
+    void ScheduleServerKeepAlive(std::chrono::steady_clock::time_point deadline);
+    void handleServerKeepAlive();
+    void ScheduleStatsDump();
+    void handleStatsDump();
+
+    friend class Stream;
+    void RegisterStream(Stream& stream);
+    void UnregisterStream(const Stream& stream);
+    // Drops the streams the client opened, run when its disconnection is dispatched
+    void CloseRemoteStreams(uint64_t clientID);
+    void ReleaseStreams();
+    void DispatchData(FalconEvent& event);
+    int SendStreamData(uint32_t streamID, uint64_t clientID, const Endpoint& to, std::span<const char> data, bool compressed = false);
+    // Sends now, or queues for the next tick when the scheduler has a budget
+    int ScheduleStreamData(uint32_t streamID, uint64_t clientID, const Endpoint& to, std::span<const char> data, bool compressed, const StreamPriority& priority);
+    void RunScheduler();
+
+    // Compressed payload: dictionary ID (varint) | original size (varint) | LZ block.
+    // False, leaving out unspecified, when the result wouldn't be smaller than data or the dictionary is unknown.
+    bool CompressPayload(std::span<const char> data, uint32_t dictionaryID, std::vector<char>& out);
+    bool DecompressPayload(std::span<const char> payload, std::vector<char>& out);
+    [[nodiscard]] std::shared_ptr<const std::vector<char>> FindDictionary(uint32_t id) const;
+
+    [[nodiscard]] size_t FragmentPayloadSize() const;
+    static void WriteStreamPacket(PacketHandle& packet, const StandardHeader& header, std::span<const char> payload);
+
+    // m_streamsMutex must be held
+    RttEstimator& ConnectionRtt(uint64_t clientID);
+    // Finds or creates the state of a stream, m_streamsMutex must be held
+    StreamState& GetStreamState(uint64_t streamKey);
+    // Builds the next packet of the stream with a new sequence, reliable ones are kept in the send window
+    PacketHandle BuildStreamPacket(uint64_t streamKey, StreamState& state, StandardHeader header, std::span<const char> payload, bool& wakeNetworkThread);
+    // Moves backlogged fragments into the send window while it has room
+    void PumpBacklog(uint64_t streamKey, StreamState& state, std::vector<PacketHandle>& out, bool& wakeNetworkThread);
+    // m_streamsMutex must be held
+    ConnectionCongestion& Congestion(uint64_t clientID);
+    // Whether the connection's controller lets a new reliable datagram of the stream leave now. If not the
+    // stream is pumped again once an ack or the pacing timer opens the budget.
+    bool AdmitReliable(uint64_t streamKey, bool& wakeNetworkThread);
+    // Pumps the streams the controller held back, they all go to peer
+    void PumpBlockedStreams(uint64_t clientID, std::vector<PacketHandle>& out, Endpoint& peer, bool& wakeNetworkThread);
+    void handlePacingTimer(uint64_t clientID);
+    enum class FragmentResult { Rejected, Incomplete, Complete };
+    FragmentResult AddFragment(uint64_t streamKey, StreamState& state, const MsgStandardView& fragment, std::vector<char>& message);
+    void handleReassemblyTimeout(uint64_t streamKey, uint16_t firstSequence);
+
+    TimerQueue::TimerID ScheduleRetransmit(uint64_t streamKey, uint16_t messageID, std::chrono::steady_clock::time_point deadline);
+    void handleRetransmitTimeout(uint64_t streamKey, uint16_t messageID);
+    // Drops the stream windows and RTT of a connection that went away
+    void ForgetConnection(uint64_t clientID);
 
 };
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Open addressing map from 64-bit keys to V, entries live in one array probed linearly.
+// Erasing shifts the following entries back instead of leaving tombstones, so lookups stay short under churn.
+// The table doubles when it gets half full, pointers returned by Find/TryEmplace are invalidated by inserts.
+template<typename V>
+class FlatHashMap {
+public:
+    [[nodiscard]] V* Find(uint64_t key) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        for (size_t i = Home(key);; i = (i + 1) & mask) {
+            Slot& slot = slots[i];
+            if (!slot.used) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot.value;
+            }
+        }
+    }
+
+    // Returns the value of key and whether it was just inserted (default constructed)
+    std::pair<V*, bool> TryEmplace(uint64_t key) {
+        if ((count + 1) * 2 > slots.size()) {
+            Rehash(slots.empty() ? 16 : slots.size() * 2);
+        }
+        size_t i = Home(key);
+        for (; slots[i].used; i = (i + 1) & mask) {
+            if (slots[i].key == key) {
+                return {&slots[i].value, false};
+            }
+        }
+        slots[i].used = true;
+        slots[i].key = key;
+        slots[i].value = V{};
+        ++count;
+        return {&slots[i].value, true};
+    }
+
+    bool Erase(uint64_t key) {
+        if (slots.empty()) {
+            return false;
+        }
+        size_t hole = Home(key);
+        for (;; hole = (hole + 1) & mask) {
+            if (!slots[hole].used) {
+                return false;
+            }
+            if (slots[hole].key == key) {
+                break;
+            }
+        }
+
+        // pull back every following entry of the cluster that may live in the hole
+        for (size_t i = (hole + 1) & mask; slots[i].used; i = (i + 1) & mask) {
+            const size_t home = Home(slots[i].key);
+            const bool homeAfterHole = hole <= i ? home > hole && home <= i : home > hole || home <= i;
+            if (!homeAfterHole) {
+                slots[hole].key = slots[i].key;
+                slots[hole].value = std::move(slots[i].value);
+                hole = i;
+            }
+        }
+        slots[hole].used = false;
+        slots[hole].value = V{};
+        --count;
+        return true;
+    }
+
+    template<typename F>
+    void ForEach(F&& callback) {
+        for (Slot& slot : slots) {
+            if (slot.used) {
+                callback(slot.key, slot.value);
+            }
+        }
+    }
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+private:
+    struct Slot {
+        uint64_t key = 0;
+        V value{};
+        bool used = false;
+    };
+
+    [[nodiscard]] size_t Home(uint64_t key) const {
+        // murmur3 finalizer, consecutive IDs spread over the whole table
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return static_cast<size_t>(key) & mask;
+    }
+
+    void Rehash(size_t capacity) {
+        std::vector<Slot> old = std::exchange(slots, std::vector<Slot>(capacity));
+        mask = capacity - 1;
+        count = 0;
+        for (Slot& slot : old) {
+            if (slot.used) {
+                *TryEmplace(slot.key).first = std::move(slot.value);
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "spdlog/spdlog.h"
+
+// Library logging goes through these macros. Levels under SPDLOG_ACTIVE_LEVEL (set by FALCON_LOG_LEVEL in CMake)
+// compile to nothing, so per packet trace/debug logs cost nothing in a release build.
+// Enabled levels are checked against the logger level before the category rate limit and before formatting.
+
+enum class LogCategory : uint8_t {
+    Socket,
+    Connection,
+    Stream,
+    Reliability,
+    Fragmentation,
+    Metrics,
+    Count
+};
+
+struct LogConfig {
+    spdlog::level::level_enum level = spdlog::level::info;
+    // log from a background thread so the network thread never waits on the sink
+    bool async = false;
+    size_t asyncQueueSize = 8192;
+    // per category, extra messages in the same second are counted and reported once the second is over
+    uint32_t maxMessagesPerSecond = 20;
+};
+
+// Replaces the "falcon" logger, call it before creating Falcon instances
+void ConfigureFalconLogging(const LogConfig& config);
+spdlog::logger& FalconLogger();
+bool FalconLogAllowed(LogCategory category);
+
+#define FALCON_LOG_CALL(category, level, ...)                                                   \
+    do {                                                                                        \
+        spdlog::logger& falconLogger = FalconLogger();                                          \
+        if (falconLogger.should_log(level) && FalconLogAllowed(category)) {                     \
+            falconLogger.log(spdlog::source_loc{__FILE__, __LINE__, SPDLOG_FUNCTION}, level, __VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define FALCON_LOG_TRACE(category, ...) FALCON_LOG_CALL(category, spdlog::level::trace, __VA_ARGS__)
+#else
+#define FALCON_LOG_TRACE(category, ...) (void)0
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define FALCON_LOG_DEBUG(category, ...) FALCON_LOG_CALL(category, spdlog::level::debug, __VA_ARGS__)
+#else
+#define FALCON_LOG_DEBUG(category, ...) (void)0
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_INFO
+#define FALCON_LOG_INFO(category, ...) FALCON_LOG_CALL(category, spdlog::level::info, __VA_ARGS__)
+#else
+#define FALCON_LOG_INFO(category, ...) (void)0
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_WARN
+#define FALCON_LOG_WARN(category, ...) FALCON_LOG_CALL(category, spdlog::level::warn, __VA_ARGS__)
+#else
+#define FALCON_LOG_WARN(category, ...) (void)0
+#endif
+
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_ERROR
+#define FALCON_LOG_ERROR(category, ...) FALCON_LOG_CALL(category, spdlog::level::err, __VA_ARGS__)
+#else
+#define FALCON_LOG_ERROR(category, ...) (void)0
+#endif
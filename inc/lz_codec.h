@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Byte-oriented LZ77 in the spirit of LZ4, fast enough to run on every message.
+// A block is a list of sequences:
+//   token (literal length << 4 | match length - 4) | [literal length - 15, 255 per byte] | literals
+//   | match offset (u16 LE) | [match length - 19, 255 per byte]
+// A length nibble of 15 means more length bytes follow. The last sequence stops after its literals,
+// the decoder knows it reached the end from the original size.
+// A dictionary acts as data that came right before the input: matches may point into it, so short messages
+// resembling the dictionary compress well. Both ends must use the same dictionary bytes.
+
+static constexpr size_t LZ_MIN_MATCH = 4;
+static constexpr size_t LZ_MAX_OFFSET = 65535;
+
+// Appends the compressed block to out
+void LzCompress(std::span<const char> input, std::span<const char> dictionary, std::vector<char>& out);
+// Replaces out with the originalSize bytes of block, false if the block is malformed or doesn't decode to that size
+bool LzDecompress(std::span<const char> block, std::span<const char> dictionary, size_t originalSize, std::vector<char>& out);
+
+// Builds a dictionary of at most maxSize bytes from the substrings that repeat the most across samples,
+// to train offline on typical messages of a stream
+std::vector<char> TrainLzDictionary(std::span<const std::vector<char>> samples, size_t maxSize);
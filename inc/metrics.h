@@ -0,0 +1,119 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// HDR-style histogram: values under 32 are counted exactly, above that every power of two is split in 16
+// buckets, so a percentile is within 1/16 of the true value whatever its magnitude. Recording is one relaxed
+// atomic increment, readers take a snapshot. Values are meant to be microseconds and are clamped at 2^32 - 1.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BUCKET_BITS = 4;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 32;
+    static constexpr size_t BUCKET_COUNT = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    struct Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> counts{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t max = 0;
+
+        // Highest value of the bucket holding the p quantile (0 to 1), 0 when empty
+        [[nodiscard]] uint64_t Percentile(double p) const;
+        [[nodiscard]] double Mean() const { return count == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(count); }
+        void Merge(const Snapshot& other);
+    };
+
+    void Record(uint64_t value);
+    [[nodiscard]] Snapshot Read() const;
+
+    [[nodiscard]] static size_t BucketOf(uint64_t value);
+    [[nodiscard]] static uint64_t BucketUpperBound(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> counts{};
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+};
+
+// Counters of one stream. Shared with the send and receive paths, which bump them without taking a lock.
+struct StreamCounters {
+    // stream datagrams (one per fragment, resends included) and the payload bytes of each one's first send
+    std::atomic<uint64_t> packetsSent = 0;
+    std::atomic<uint64_t> bytesSent = 0;
+    std::atomic<uint64_t> packetsReceived = 0;
+    std::atomic<uint64_t> bytesReceived = 0;
+    std::atomic<uint64_t> retransmissions = 0; // timer and fast retransmissions
+    std::atomic<uint64_t> duplicates = 0; // reliable messages received again, usually after a lost ack
+    std::atomic<uint64_t> outOfWindow = 0; // reliable messages too old for the receive window, dropped
+    std::atomic<uint64_t> staleDropped = 0; // unreliable messages the scheduler dropped past their deadline
+    std::atomic<uint64_t> reordered = 0; // ordered stream messages that waited in the reorder buffer
+    std::atomic<uint64_t> reorderRejected = 0; // left unacked, the reorder buffer was full
+};
+
+// Per connection instruments that don't fit a counter
+struct ClientCounters {
+    LatencyHistogram ackLatency; // first send to ack of reliable messages, in microseconds
+};
+
+struct StreamStats {
+    uint32_t streamID = 0;
+    uint64_t packetsSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t packetsReceived = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t retransmissions = 0;
+    uint64_t duplicates = 0;
+    uint64_t outOfWindow = 0;
+    uint64_t staleDropped = 0;
+    uint64_t reordered = 0;
+    uint64_t reorderRejected = 0;
+    // queue depths when the snapshot was taken
+    size_t unacked = 0; // reliable messages sent and waiting for their ack
+    size_t backlogMessages = 0; // reliable messages waiting for room in the send window
+    size_t backlogBytes = 0;
+    size_t reorderMessages = 0; // ordered streams: received messages waiting for an earlier one
+    size_t reorderBytes = 0;
+
+    void Read(const StreamCounters& counters);
+};
+
+// One connection: its streams' counters summed, its RTT and its ack latency distribution
+struct ClientStats {
+    uint64_t clientID = 0;
+    uint64_t packetsSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t packetsReceived = 0;
+    uint64_t bytesReceived = 0;
+    uint64_t retransmissions = 0;
+    uint64_t duplicates = 0;
+    uint64_t outOfWindow = 0;
+    uint64_t staleDropped = 0;
+    uint64_t reordered = 0;
+    uint64_t reorderRejected = 0;
+    size_t unacked = 0;
+    size_t backlogMessages = 0;
+    size_t backlogBytes = 0;
+    size_t scheduledBytes = 0; // waiting in the send scheduler for a tick
+    size_t reorderMessages = 0;
+    size_t reorderBytes = 0;
+    // set once the connection has an RTT sample
+    std::optional<std::chrono::microseconds> smoothedRtt;
+    std::optional<std::chrono::microseconds> rttVariance;
+    LatencyHistogram::Snapshot ackLatency;
+    // congestion controller of the connection, see CongestionController
+    size_t congestionWindow = 0;
+    size_t bytesInFlight = 0;
+    double pacingRate = 0; // bytes per second, 0 while unpaced
+    bool slowStart = true;
+    uint64_t congestionEvents = 0; // window reductions after a loss, a timeout or a queuing delay
+    std::vector<StreamStats> streams;
+
+    void Add(const StreamStats& stream);
+};
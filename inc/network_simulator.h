@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <queue>
+#include <random>
+#include <span>
+#include <vector>
+
+#include "endpoint.h"
+
+enum class LatencyDistribution : uint8_t {
+    Uniform, // latency +- jitter
+    Normal   // latency with a standard deviation of jitter, clamped at 0
+};
+
+// Impairments applied to outgoing datagrams, all driven by one RNG seeded with seed so a run can be replayed
+struct NetworkConditions {
+    bool enabled = false;
+    uint64_t seed = 1;
+
+    double lossRate = 0;      // chance a datagram is dropped
+    double duplicateRate = 0; // chance a datagram is delivered twice
+    double reorderRate = 0;   // chance a datagram is held back by reorderDelay, letting the next ones overtake it
+
+    std::chrono::microseconds latency{0};
+    std::chrono::microseconds jitter{0};
+    LatencyDistribution distribution = LatencyDistribution::Uniform;
+    std::chrono::microseconds reorderDelay{10000};
+
+    // Bytes per second leaving the link, 0 for no cap. Datagrams queue behind each other and are
+    // dropped once the queue would hold them longer than maxQueueDelay, like a router buffer.
+    uint64_t bandwidth = 0;
+    std::chrono::microseconds maxQueueDelay{100000};
+};
+
+// Holds outgoing datagrams until their simulated arrival, not thread-safe
+class NetworkSimulator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Datagram {
+        Clock::time_point release;
+        uint64_t order = 0; // keeps submission order between datagrams released at the same time
+        Endpoint to;
+        std::vector<char> data;
+    };
+
+    explicit NetworkSimulator(const NetworkConditions& conditions);
+
+    // Returns true when the datagram became the next one to release
+    bool Submit(const Endpoint& to, std::span<const char> data, Clock::time_point now);
+    // Moves the datagrams due at now to out, in release order
+    void TakeDue(Clock::time_point now, std::vector<Datagram>& out);
+    [[nodiscard]] std::optional<Clock::time_point> NextRelease() const;
+
+    [[nodiscard]] uint64_t Lost() const { return lost; }
+    [[nodiscard]] uint64_t Duplicated() const { return duplicated; }
+    [[nodiscard]] uint64_t Reordered() const { return reordered; }
+
+private:
+    struct Later {
+        bool operator()(const Datagram& a, const Datagram& b) const {
+            return a.release != b.release ? a.release > b.release : a.order > b.order;
+        }
+    };
+
+    Clock::duration SampleLatency();
+    bool Chance(double rate);
+
+    NetworkConditions conditions;
+    std::mt19937_64 rng;
+    std::priority_queue<Datagram, std::vector<Datagram>, Later> inFlight;
+    uint64_t nextOrder = 0;
+    Clock::time_point linkFreeAt{};
+
+    uint64_t lost = 0;
+    uint64_t duplicated = 0;
+    uint64_t reordered = 0;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+class PacketPool;
+
+// Ref-counted handle to a buffer of a PacketPool, the buffer goes back to the pool when the last handle dies.
+// The pool must outlive every handle it gave out.
+class PacketHandle {
+public:
+    PacketHandle() = default;
+    PacketHandle(const PacketHandle& other);
+    PacketHandle(PacketHandle&& other) noexcept;
+    PacketHandle& operator=(PacketHandle other) noexcept;
+    ~PacketHandle();
+
+    explicit operator bool() const { return pool != nullptr; }
+
+    [[nodiscard]] char* data() const;
+    [[nodiscard]] size_t capacity() const;
+
+    // number of valid bytes in the buffer
+    [[nodiscard]] size_t size() const { return length; }
+    void SetSize(size_t size) { length = size; }
+
+    [[nodiscard]] std::span<const char> view() const { return {data(), length}; }
+
+private:
+    friend class PacketPool;
+    PacketHandle(PacketPool* pool, uint32_t index) : pool(pool), index(index) {}
+
+    PacketPool* pool = nullptr;
+    uint32_t index = 0;
+    size_t length = 0;
+};
+
+// Fixed number of fixed-size buffers allocated once, acquiring and releasing never touches the heap.
+// The free list is a lock-free stack so buffers can be released from any thread.
+class PacketPool {
+public:
+    PacketPool(size_t bufferSize, size_t count);
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Returns an empty handle when every buffer is in use
+    [[nodiscard]] PacketHandle Acquire();
+
+    [[nodiscard]] size_t BufferSize() const { return bufferSize; }
+    [[nodiscard]] size_t Capacity() const { return count; }
+    [[nodiscard]] size_t Available() const { return available.load(std::memory_order_relaxed); }
+
+private:
+    friend class PacketHandle;
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    void AddRef(uint32_t index);
+    void Release(uint32_t index);
+
+    size_t bufferSize;
+    size_t count;
+    std::vector<char> storage;
+    std::unique_ptr<std::atomic<uint32_t>[]> refCounts;
+    std::unique_ptr<std::atomic<uint32_t>[]> next; // free list links
+    std::atomic<uint64_t> head; // (ABA tag << 32) | index of the first free buffer
+    std::atomic<size_t> available;
+};
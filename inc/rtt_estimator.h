@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+
+// Round-trip time estimation and retransmission timeout of one connection, following RFC 6298.
+// Samples must only come from messages sent once (Karn's rule), the caller keeps track of that.
+class RttEstimator {
+public:
+    using Duration = std::chrono::microseconds;
+
+    RttEstimator(Duration initialTimeout, Duration minTimeout, Duration maxTimeout);
+
+    void AddSample(Duration rtt);
+    // A retransmission timer expired, double the timeout until the next valid sample
+    void Backoff();
+
+    [[nodiscard]] bool HasSample() const { return hasSample; }
+    [[nodiscard]] Duration SmoothedRtt() const { return srtt; }
+    [[nodiscard]] Duration RttVariance() const { return rttvar; }
+    [[nodiscard]] Duration Timeout() const { return rto; }
+
+private:
+    void UpdateTimeout();
+
+    Duration srtt{0};
+    Duration rttvar{0};
+    Duration rto;
+    Duration minTimeout;
+    Duration maxTimeout;
+    bool hasSample = false;
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "endpoint.h"
+
+// How a stream competes for its client's budget, see Stream::SetPriority
+struct StreamPriority {
+    uint8_t level = 0; // higher levels go first
+    uint32_t weight = 1; // share of the budget among streams of the same level
+    // Unreliable messages still waiting this long after SendData are dropped, 0 keeps them until sent
+    std::chrono::milliseconds deadline{0};
+};
+
+struct SendSchedulerConfig {
+    // Bytes of stream messages sent per client each tick (Falcon::Flush), 0 sends them immediately
+    size_t bytesPerTick = 0;
+    // A waiting message gains one priority level per interval, low levels can't starve forever
+    std::chrono::milliseconds agingInterval{100};
+    // Messages waiting for one client, SendData fails past it
+    size_t maxQueuedBytes = 16 * 1024 * 1024;
+};
+
+// Queues of one client's streams, drained once per tick. Strict priority between levels, weighted fair
+// queuing between streams of the same level: each message gets a virtual finish time of its stream's
+// previous one (or the current virtual time if later) + size / weight, and the smallest goes first.
+// A message may overdraw the budget, the next tick starts in debt. Not thread-safe.
+class SendScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Message {
+        uint32_t streamID = 0;
+        Endpoint to;
+        std::vector<char> data;
+        bool compressed = false;
+        Clock::time_point queued;
+        Clock::time_point expiry = Clock::time_point::max();
+    };
+
+    explicit SendScheduler(const SendSchedulerConfig& config);
+
+    // False if the client already has maxQueuedBytes waiting
+    bool Enqueue(const StreamPriority& priority, Message&& message);
+    // Appends the messages this tick's budget allows to out in sending order, and the unreliable ones past
+    // their deadline to stale
+    void RunTick(Clock::time_point now, std::vector<Message>& out, std::vector<Message>& stale);
+
+    [[nodiscard]] size_t QueuedBytes() const { return queuedBytes; }
+    [[nodiscard]] bool Empty() const { return streams.empty(); }
+
+private:
+    struct Entry {
+        Message message;
+        double finish;
+    };
+    struct StreamQueue {
+        StreamPriority priority;
+        double lastFinish = 0;
+        std::deque<Entry> entries;
+    };
+
+    [[nodiscard]] uint64_t EffectiveLevel(const StreamQueue& stream, Clock::time_point now) const;
+
+    SendSchedulerConfig config;
+    std::unordered_map<uint32_t, StreamQueue> streams; // only the ones with messages waiting
+    double virtualTime = 0;
+    int64_t credit = 0;
+    size_t queuedBytes = 0;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity window of entries indexed by sequence % N, no allocation and O(1) access.
+// An entry is only returned for the exact sequence it was inserted with, so a slot reused by a newer
+// sequence never aliases an old one. N must divide the sequence space (a power of two does).
+template<typename T, size_t N>
+class SequenceBuffer {
+public:
+    static_assert((N & (N - 1)) == 0, "SequenceBuffer size must be a power of two");
+
+    // Claims the slot of sequence, dropping whatever it held
+    T& Insert(uint32_t sequence) {
+        const size_t index = sequence % N;
+        sequences[index] = sequence;
+        entries[index] = T{};
+        return entries[index];
+    }
+
+    [[nodiscard]] T* Find(uint32_t sequence) {
+        const size_t index = sequence % N;
+        return sequences[index] == sequence ? &entries[index] : nullptr;
+    }
+
+    void Remove(uint32_t sequence) {
+        const size_t index = sequence % N;
+        if (sequences[index] == sequence) {
+            sequences[index] = EMPTY;
+            entries[index] = T{};
+        }
+    }
+
+    // True when inserting sequence would not evict a live entry
+    [[nodiscard]] bool IsFree(uint32_t sequence) const {
+        const uint32_t current = sequences[sequence % N];
+        return current == EMPTY || current == sequence;
+    }
+
+    template<typename F>
+    void ForEach(F&& callback) {
+        for (size_t i = 0; i < N; ++i) {
+            if (sequences[i] != EMPTY) {
+                callback(sequences[i], entries[i]);
+            }
+        }
+    }
+
+    template<typename F>
+    void ForEach(F&& callback) const {
+        for (size_t i = 0; i < N; ++i) {
+            if (sequences[i] != EMPTY) {
+                callback(sequences[i], entries[i]);
+            }
+        }
+    }
+
+    static constexpr size_t Capacity() { return N; }
+
+private:
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+
+    std::array<T, N> entries{};
+    std::array<uint32_t, N> sequences = [] {
+        std::array<uint32_t, N> empty;
+        empty.fill(EMPTY);
+        return empty;
+    }();
+};
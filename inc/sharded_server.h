@@ -0,0 +1,47 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "falcon.h"
+
+// Server spread over several Falcon instances bound to the same port with SO_REUSEPORT, each with its own
+// socket, network thread and slice of the clients. The kernel hashes the client address to pick a socket,
+// so a client stays on its shard for as long as the set of shards doesn't change.
+// Client IDs encode their shard, calls taking a client ID are routed without any lookup.
+class ShardedServer {
+public:
+    // Returns nullptr if any shard fails to bind, or on backends without SO_REUSEPORT
+    [[nodiscard]] static std::unique_ptr<ShardedServer> Listen(const std::string& endpoint, uint16_t port, size_t shardCount, const FalconConfig& config = {});
+
+    // Registered on every shard, handlers may run concurrently from the shards' network threads
+    void OnClientConnected(const std::function<void(uint64_t)>& handler);
+    void OnClientDisconnected(const std::function<void(uint64_t)>& handler);
+    void OnStreamCreated(const std::function<void(uint32_t)>& handler);
+    void OnStreamOpened(const std::function<void(Stream&)>& handler);
+
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(uint64_t client, StreamDelivery delivery, const CompressionOptions& compression = {});
+    [[nodiscard]] std::unique_ptr<Stream> CreateStream(uint64_t client, bool reliable, const CompressionOptions& compression = {});
+    // Registered on every shard
+    void RegisterDictionary(uint32_t id, std::span<const char> dictionary);
+    void CloseStream(const Stream& stream);
+
+    Client GetClient(uint64_t id);
+    [[nodiscard]] std::optional<RttEstimator> GetRtt(uint64_t clientID);
+    void Flush();
+    // Poll mode: drains the shards in turn, up to maxEvents in total
+    size_t Poll(size_t maxEvents = SIZE_MAX);
+
+    // Counters summed over the shards, batch maxima are the largest of any shard
+    [[nodiscard]] FalconStats GetStats() const;
+
+    [[nodiscard]] size_t ShardCount() const { return shards.size(); }
+    [[nodiscard]] Falcon& Shard(size_t index) { return *shards[index]; }
+    [[nodiscard]] Falcon& ShardOf(uint64_t clientID) { return *shards[(clientID - 1) % shards.size()]; }
+
+private:
+    std::vector<std::unique_ptr<Falcon>> shards;
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// SipHash-2-4 keyed with k0, k1: a fast MAC for short inputs, used to sign connection cookies
+uint64_t SipHash24(uint64_t k0, uint64_t k1, std::span<const uint8_t> data);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "falcon.h"
+#include "sequence_buffer.h"
+
+// Delta compression of state snapshots sent every tick over an unreliable stream.
+//
+// The replicator numbers its snapshots and keeps the last SNAPSHOT_HISTORY of them. The receiver answers each
+// snapshot with an ack carrying the same latest id + 64 bit trace as MsgAck, on the same stream. Once a snapshot
+// is acked, the following ones are sent as deltas against it: the XOR of the two states, where every run of
+// unchanged bytes collapses to a varint. A world where little changes between ticks costs a few bytes per tick,
+// and a lost snapshot or ack only means the next delta is taken against an older baseline.
+//
+// Snapshot: SNAPSHOT_FULL or SNAPSHOT_DELTA (1) | sequence (u16 LE) | [baseline (u16 LE)] | state size (varint) | runs
+// Runs, until the state size is reached: unchanged bytes (varint) | changed bytes (varint) | XOR of the changed bytes
+// Ack:      SNAPSHOT_ACK (1) | latest sequence (u16 LE) | trace (u64 LE, bit 63 - n acks latest - n)
+
+static constexpr size_t SNAPSHOT_HISTORY = 64;
+// Bigger states are rejected by the receiver, a corrupt size can't make it allocate more
+static constexpr size_t MAX_SNAPSHOT_SIZE = 16 * 1024 * 1024;
+
+// out gets the runs turning baseline into current, bytes past the end of baseline are XORed with 0
+void EncodeSnapshotDelta(std::span<const char> baseline, std::span<const char> current, std::vector<char>& out);
+// Applies the runs of delta to baseline, false if they are malformed or don't add up to stateSize
+bool DecodeSnapshotDelta(std::span<const char> baseline, std::span<const char> delta, size_t stateSize, std::vector<char>& out);
+
+// Sending side, one per client stream. Send may be called from any thread.
+class SnapshotReplicator {
+public:
+    explicit SnapshotReplicator(Stream& stream);
+
+    // Sends state as a delta against the newest snapshot the peer acknowledged, in full if there is none
+    void Send(std::span<const char> state);
+
+    struct Stats {
+        uint64_t fullSnapshots = 0;
+        uint64_t deltaSnapshots = 0;
+        uint64_t stateBytes = 0; // what sending every state in full would have cost
+        uint64_t bytesSent = 0;
+    };
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    struct Shared {
+        std::mutex mutex;
+        SequenceBuffer<std::vector<char>, SNAPSHOT_HISTORY> history;
+        std::optional<uint16_t> baseline; // newest acked snapshot still in history
+        uint16_t nextSequence = 0;
+        Stats stats;
+
+        void HandleAck(std::span<const char> message);
+    };
+
+    Stream& stream;
+    // shared with the stream's handler, which may outlive the replicator
+    std::shared_ptr<Shared> shared = std::make_shared<Shared>();
+    std::vector<char> message;
+};
+
+// Receiving side, built on the stream the replicator opened. The handler runs on the thread dispatching
+// Falcon's events with each snapshot newer than the previous one, rebuilt in full.
+class SnapshotReceiver {
+public:
+    using Handler = std::function<void(uint16_t sequence, std::span<const char> state)>;
+
+    SnapshotReceiver(Stream& stream, Handler handler);
+
+    struct Stats {
+        uint64_t received = 0;
+        uint64_t applied = 0;
+        uint64_t stale = 0; // older than the last applied one, arrived out of order
+        uint64_t undecodable = 0; // baseline already forgotten, or malformed
+    };
+    [[nodiscard]] Stats GetStats() const;
+
+private:
+    struct Shared {
+        explicit Shared(Stream& stream, Handler handler) : stream(stream), handler(std::move(handler)) {}
+
+        std::mutex mutex;
+        Stream& stream;
+        Handler handler;
+        SequenceBuffer<std::vector<char>, SNAPSHOT_HISTORY> history;
+        ReceiveWindow window;
+        std::optional<uint16_t> lastApplied;
+        std::vector<char> decoded;
+        Stats stats;
+
+        void HandleSnapshot(std::span<const char> message);
+    };
+
+    std::shared_ptr<Shared> shared;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+// Bounded single-producer single-consumer ring, push and pop never lock or allocate.
+// The capacity is rounded up to a power of two. Each side caches the other's index and only reloads it
+// when the ring looks full (or empty), and the two indices live on separate cache lines.
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+        : mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1), slots(std::make_unique<T[]>(mask + 1)) {}
+
+    // Producer side, value is left untouched when the ring is full
+    bool TryPush(T&& value) {
+        const size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - cachedHead > mask) {
+            cachedHead = headIndex.load(std::memory_order_acquire);
+            if (tail - cachedHead > mask) {
+                return false;
+            }
+        }
+        slots[tail & mask] = std::move(value);
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side
+    bool TryPop(T& out) {
+        const size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == cachedTail) {
+            cachedTail = tailIndex.load(std::memory_order_acquire);
+            if (head == cachedTail) {
+                return false;
+            }
+        }
+        out = std::move(slots[head & mask]);
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    [[nodiscard]] size_t Capacity() const { return mask + 1; }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    const size_t mask;
+    std::unique_ptr<T[]> slots;
+
+    alignas(CACHE_LINE) std::atomic<size_t> headIndex = 0;
+    size_t cachedTail = 0; // consumer only
+    alignas(CACHE_LINE) std::atomic<size_t> tailIndex = 0;
+    size_t cachedHead = 0; // producer only
+};
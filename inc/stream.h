@@ -4,7 +4,9 @@
 #include <span>
 #include <cstdint>
 #include <functional>
+#include <memory>
 
+#include "endpoint.h"
 #include "falcon.h"
 
 class Falcon;
@@ -12,7 +14,7 @@ struct Client;
 
 class Stream {
 public:
-    Stream(uint32_t ID, std::string ip, int port, Falcon& falcon);
+    Stream(uint32_t ID, uint64_t clientID, const Endpoint& target, Falcon& falcon, const CompressionOptions& compression = {});
     // Stream(Falcon& falcon, bool reliable); // Client API
     // Stream(Falcon& falcon, bool reliable, uint64_t clientID); // Server API
     // Stream(Falcon& falcon, uint32_t StreamID); // Client API
@@ -20,23 +22,35 @@ public:
     ~Stream();
 
     void SendData(std::span<const char> data);
-    static void OnDataReceived(std::span<const char> data); // Called when data is received by the Falcon object, Really want to rename this HandleDataReceived but the tech plan says otherwise
+    // Compression of what this end sends, for streams the peer opened. Not thread safe against SendData.
+    void SetCompression(const CompressionOptions& options) { compression = options; }
+    // Share of the client's send budget when FalconConfig::scheduler has one. Not thread safe against SendData.
+    void SetPriority(const StreamPriority& options) { priority = options; }
+    // Handlers run with every message received on this stream, on the thread dispatching Falcon's events
+    void OnDataReceived(const std::function<void(std::span<const char>)>& handler);
+    void HandleDataReceived(std::span<const char> data); // Called by the Falcon object when data is received
 
     static bool IsReliable(uint32_t ID) {
         // check if bit at position 30 is set
         return ID & RELIABLESTREAMMASK;
     }
+    static bool IsOrdered(uint32_t ID) {
+        return (ID & ORDEREDSTREAMMASK) && IsReliable(ID);
+    }
     static bool IsServerStream(uint32_t ID) {
         // check if bit at position 31 is set
         return ID & SERVERSTREAMMASK;
     }
     uint32_t streamID;
+    uint64_t clientID; // client at the other end on the server, our own ID on the client
 
 private:
-    const std::string targetIP;
-    const int targetPort;
+    const Endpoint target;
 
     Falcon& falcon;
+    std::shared_ptr<FalconLifetime> lifetime;
+    CompressionOptions compression;
+    StreamPriority priority;
 
     std::vector<std::function<void(std::span<const char>)>> onDataReceivedHandlers;
 
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+// Min-heap of deadlines shared by keep-alives, retransmissions and any other timeout.
+// Running it only touches the timers that expired, cancelled timers are dropped lazily when they reach the top.
+// Scheduling and cancelling are thread safe, callbacks run on the thread calling RunExpired without the lock held.
+class TimerQueue {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerID = uint64_t;
+    static constexpr TimerID INVALID_TIMER = 0;
+
+    TimerID Schedule(Clock::time_point deadline, std::function<void()> callback);
+    bool Cancel(TimerID id);
+
+    // Fires every timer due at now, returns how many fired
+    size_t RunExpired(Clock::time_point now);
+
+    [[nodiscard]] std::optional<Clock::time_point> NextDeadline();
+    [[nodiscard]] size_t size() const;
+
+private:
+    struct Entry {
+        Clock::time_point deadline;
+        TimerID id;
+
+        bool operator>(const Entry& other) const { return deadline > other.deadline; }
+    };
+
+    void DropCancelled();
+
+    mutable std::mutex mutex;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<>> heap;
+    std::unordered_map<TimerID, std::function<void()>> callbacks; // live timers only
+    TimerID nextID = 1;
+};
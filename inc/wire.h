@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Compact encoding of stream messages, independent of host padding and endianness:
+//   type (1) | version << 4 | flags (1) | clientID (varint) | streamID (varint) | sequence (u16 LE)
+//   [fragment index (varint) | fragment count (varint) | fragment size (varint)] | payload size (varint) | payload
+// The reliable/server bits of the streamID travel in the flags nibble and the ordered bit as the lowest bit of
+// the streamID varint, so small stream IDs fit in one varint byte.
+// the fragment fields are only present when the fragment flag is set. The compressed flag marks a message whose
+// payload (reassembled, for a fragmented one) is an LZ block, see Falcon::CompressPayload.
+static constexpr uint8_t WIRE_VERSION = 2;
+static constexpr size_t MAX_VARINT_SIZE = 10;
+static constexpr size_t MAX_STANDARD_HEADER_SIZE = 2 + MAX_VARINT_SIZE + 5 + 2 + 3 * 5 + 5;
+
+struct StandardHeader {
+    uint64_t clientID;
+    uint32_t streamID;
+    uint16_t sequence;
+    uint32_t payloadSize;
+    // fragmentCount is 0 for a message sent whole. Fragments of a message have consecutive sequences,
+    // all of them carry fragmentSize bytes except the last one which may be shorter.
+    uint32_t fragmentIndex = 0;
+    uint32_t fragmentCount = 0;
+    uint32_t fragmentSize = 0;
+    bool compressed = false;
+
+    [[nodiscard]] bool IsFragment() const { return fragmentCount != 0; }
+};
+
+// LEB128, 7 bits per byte starting with the lowest, returns the number of bytes written
+size_t WriteVarint(uint64_t value, char* out);
+// Advances in past the varint, false if it is truncated or longer than MAX_VARINT_SIZE
+bool ReadVarint(std::span<const char>& in, uint64_t& value);
+
+void WriteU16LE(uint16_t value, char* out);
+uint16_t ReadU16LE(const char* in);
+
+// out must have room for MAX_STANDARD_HEADER_SIZE bytes, returns the header size
+size_t EncodeStandardHeader(const StandardHeader& header, char* out);
+// Returns the header size, 0 if in is not a well formed standard message of this version or if its fragment
+// fields are inconsistent. The payload follows the header and is not checked against the size of in.
+size_t DecodeStandardHeader(std::span<const char> in, StandardHeader& header);
@@ -0,0 +1,147 @@
+#include "bit_stream.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+BitWriter::BitWriter(std::span<char> buffer)
+    : buffer(buffer)
+{
+}
+
+void BitWriter::WriteBits(uint64_t value, unsigned bits)
+{
+    while (bits > 0 && !failed) {
+        const unsigned take = std::min(bits, 8 - pendingBits);
+        pending |= static_cast<uint32_t>(value & ((1u << take) - 1)) << pendingBits;
+        pendingBits += take;
+        value >>= take;
+        bits -= take;
+        if (pendingBits == 8) {
+            if (bytes == buffer.size()) {
+                failed = true;
+                return;
+            }
+            buffer[bytes++] = static_cast<char>(pending);
+            pending = 0;
+            pendingBits = 0;
+        }
+    }
+}
+
+void BitWriter::WriteVarint(uint64_t value)
+{
+    while (value >= 0x80) {
+        WriteBits((value & 0x7F) | 0x80, 8);
+        value >>= 7;
+    }
+    WriteBits(value, 8);
+}
+
+void BitWriter::WriteRanged(int64_t value, int64_t min, int64_t max)
+{
+    if (value < min || value > max) {
+        failed = true;
+        return;
+    }
+    const uint64_t range = static_cast<uint64_t>(max) - static_cast<uint64_t>(min);
+    WriteBits(static_cast<uint64_t>(value) - static_cast<uint64_t>(min), BitsRequired(range));
+}
+
+void BitWriter::WriteQuantized(float value, float min, float max, float resolution)
+{
+    const uint64_t steps = QuantizedSteps(min, max, resolution);
+    // NaN goes to min rather than failing the whole message
+    const double clamped = std::isnan(value) ? min : std::clamp<double>(value, min, max);
+    const auto step = std::min(static_cast<uint64_t>(std::llround((clamped - min) / resolution)), steps);
+    WriteBits(step, BitsRequired(steps));
+}
+
+size_t BitWriter::Flush()
+{
+    if (pendingBits > 0 && !failed) {
+        WriteBits(0, 8 - pendingBits);
+    }
+    return failed ? 0 : bytes;
+}
+
+BitReader::BitReader(std::span<const char> data)
+    : data(data)
+{
+}
+
+bool BitReader::ReadBits(unsigned bits, uint64_t& value)
+{
+    value = 0;
+    if (failed || bits > data.size() * 8 - position) {
+        failed = true;
+        return false;
+    }
+    unsigned done = 0;
+    while (done < bits) {
+        const unsigned offset = position % 8;
+        const unsigned take = std::min(bits - done, 8 - offset);
+        const auto byte = static_cast<uint8_t>(data[position / 8]);
+        value |= static_cast<uint64_t>(byte >> offset & ((1u << take) - 1)) << done;
+        position += take;
+        done += take;
+    }
+    return true;
+}
+
+bool BitReader::ReadBool(bool& value)
+{
+    uint64_t bit = 0;
+    if (!ReadBits(1, bit)) {
+        return false;
+    }
+    value = bit != 0;
+    return true;
+}
+
+bool BitReader::ReadVarint(uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 70; shift += 7) {
+        uint64_t group = 0;
+        if (!ReadBits(8, group)) {
+            return false;
+        }
+        value |= (group & 0x7F) << shift;
+        if (!(group & 0x80)) {
+            return true;
+        }
+    }
+    failed = true; // longer than any 64 bit value
+    return false;
+}
+
+bool BitReader::ReadRanged(int64_t min, int64_t max, int64_t& value)
+{
+    const uint64_t range = static_cast<uint64_t>(max) - static_cast<uint64_t>(min);
+    uint64_t offset = 0;
+    if (!ReadBits(BitsRequired(range), offset)) {
+        return false;
+    }
+    if (offset > range) {
+        failed = true;
+        return false;
+    }
+    value = static_cast<int64_t>(static_cast<uint64_t>(min) + offset);
+    return true;
+}
+
+bool BitReader::ReadQuantized(float min, float max, float resolution, float& value)
+{
+    const uint64_t steps = QuantizedSteps(min, max, resolution);
+    uint64_t step = 0;
+    if (!ReadBits(BitsRequired(steps), step)) {
+        return false;
+    }
+    if (step > steps) {
+        failed = true;
+        return false;
+    }
+    value = std::min(static_cast<float>(min + static_cast<double>(step) * resolution), max);
+    return true;
+}
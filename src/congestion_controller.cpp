@@ -0,0 +1,147 @@
+#include "congestion_controller.h"
+
+#include <algorithm>
+
+
+CongestionController::CongestionController(const CongestionConfig& config, size_t datagramSize)
+    : config(config), datagramSize(datagramSize), window(std::clamp(config.initialWindow, config.minWindow, config.maxWindow)),
+      tokens(static_cast<double>(config.maxBurst))
+{
+    minRttBuckets.fill(Duration::max());
+}
+
+bool CongestionController::CanSend(Clock::time_point now)
+{
+    if (!config.enabled) {
+        return true;
+    }
+    Refill(now);
+    return inFlight < window && tokens > 0;
+}
+
+std::optional<CongestionController::Clock::time_point> CongestionController::NextSendTime(Clock::time_point now)
+{
+    if (!config.enabled) {
+        return now;
+    }
+    if (inFlight >= window) {
+        return std::nullopt;
+    }
+    Refill(now);
+    if (tokens > 0) {
+        return now;
+    }
+    const double seconds = -tokens / PacingRate();
+    return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)) + std::chrono::microseconds(1);
+}
+
+void CongestionController::OnReliableSent(size_t bytes, Clock::time_point now)
+{
+    inFlight += bytes;
+    Spend(bytes, now);
+}
+
+void CongestionController::OnUnreliableSent(size_t bytes, Clock::time_point now)
+{
+    Spend(bytes, now);
+}
+
+void CongestionController::OnRetransmit(size_t bytes, Clock::time_point now)
+{
+    Spend(bytes, now);
+}
+
+void CongestionController::OnAcked(size_t bytes, Clock::time_point sentTime)
+{
+    inFlight -= std::min(bytes, inFlight);
+    if (sentTime <= recoveryStart) {
+        return; // sent before the window was reduced, it says nothing about the new one
+    }
+    if (InSlowStart()) {
+        window = std::min(window + bytes, config.maxWindow);
+        return;
+    }
+    ackedSinceGrowth += bytes;
+    if (ackedSinceGrowth >= window) {
+        ackedSinceGrowth -= window;
+        window = std::min(window + datagramSize, config.maxWindow);
+    }
+}
+
+void CongestionController::OnLoss(Clock::time_point sentTime, Clock::time_point now)
+{
+    if (sentTime > recoveryStart) {
+        Reduce(window / 2, now);
+    }
+}
+
+void CongestionController::OnTimeout(Clock::time_point sentTime, Clock::time_point now)
+{
+    if (sentTime > recoveryStart) {
+        Reduce(window / 2, now);
+        window = config.minWindow;
+    }
+}
+
+void CongestionController::OnRttSample(Duration rtt, Duration smoothed, Clock::time_point now)
+{
+    smoothedRtt = smoothed;
+    UpdateMinRtt(rtt, now);
+    // at most one reduction per round trip, the queue needs that long to drain
+    if (config.delayThreshold > Duration::zero() && rtt - minRtt > config.delayThreshold && now - recoveryStart > smoothedRtt) {
+        Reduce(window * 85 / 100, now);
+    }
+}
+
+double CongestionController::PacingRate() const
+{
+    if (!config.enabled || smoothedRtt <= Duration::zero()) {
+        return 0;
+    }
+    return config.pacingGain * static_cast<double>(window) / std::chrono::duration<double>(smoothedRtt).count();
+}
+
+void CongestionController::Refill(Clock::time_point now)
+{
+    const double rate = PacingRate();
+    if (rate == 0) {
+        tokens = static_cast<double>(config.maxBurst);
+    } else if (now > lastRefill) {
+        tokens = std::min(tokens + rate * std::chrono::duration<double>(now - lastRefill).count(), static_cast<double>(config.maxBurst));
+    }
+    lastRefill = std::max(lastRefill, now);
+}
+
+void CongestionController::Spend(size_t bytes, Clock::time_point now)
+{
+    if (!config.enabled) {
+        return;
+    }
+    Refill(now);
+    tokens = std::max(tokens - static_cast<double>(bytes), -static_cast<double>(config.maxBurst));
+}
+
+void CongestionController::UpdateMinRtt(Duration rtt, Clock::time_point now)
+{
+    const Duration bucketLength = std::max<Duration>(Duration(config.minRttWindow) / MIN_RTT_BUCKETS, Duration(1));
+    if (now - minRttBucketStart >= bucketLength) {
+        // start a new bucket, forgetting the ones that went by without a sample too
+        const auto elapsed = std::min<int64_t>((now - minRttBucketStart) / bucketLength, MIN_RTT_BUCKETS);
+        for (int64_t i = 0; i < elapsed; ++i) {
+            minRttBucket = (minRttBucket + 1) % MIN_RTT_BUCKETS;
+            minRttBuckets[minRttBucket] = Duration::max();
+        }
+        minRttBucketStart = now;
+    }
+    minRttBuckets[minRttBucket] = std::min(minRttBuckets[minRttBucket], rtt);
+    minRtt = *std::min_element(minRttBuckets.begin(), minRttBuckets.end());
+}
+
+void CongestionController::Reduce(size_t newWindow, Clock::time_point now)
+{
+    window = std::max(newWindow, config.minWindow);
+    slowStartThreshold = window;
+    ackedSinceGrowth = 0;
+    recoveryStart = now;
+    congestionEvents++;
+}
@@ -0,0 +1,58 @@
+#include "connection_limiter.h"
+
+#include <algorithm>
+
+
+ConnectionLimiter::ConnectionLimiter(double rate, uint32_t burst, size_t maxPrefixes)
+    : rate(rate), burst(std::max<double>(burst, 1)), maxPrefixes(maxPrefixes)
+{
+}
+
+bool ConnectionLimiter::Allow(const Endpoint& from, Clock::time_point now)
+{
+    if (rate <= 0) {
+        return true;
+    }
+    const uint64_t prefix = Prefix(from);
+    auto it = buckets.find(prefix);
+    if (it == buckets.end()) {
+        // a bucket that had time to refill holds nothing worth keeping, forget those once a second
+        if (buckets.size() >= maxPrefixes && now - lastSweep >= std::chrono::seconds(1)) {
+            lastSweep = now;
+            const auto refill = std::chrono::duration<double>(burst / rate);
+            std::erase_if(buckets, [&](const auto& entry) { return now - entry.second.updated >= refill; });
+        }
+        if (buckets.size() >= maxPrefixes) {
+            if (!overflowStarted) {
+                overflowStarted = true;
+                overflow = {burst, now};
+            }
+            return Take(overflow, now);
+        }
+        it = buckets.emplace(prefix, Bucket{burst, now}).first;
+    }
+    return Take(it->second, now);
+}
+
+bool ConnectionLimiter::Take(Bucket& bucket, Clock::time_point now) const
+{
+    if (now > bucket.updated) {
+        bucket.tokens = std::min(bucket.tokens + rate * std::chrono::duration<double>(now - bucket.updated).count(), burst);
+        bucket.updated = now;
+    }
+    if (bucket.tokens < 1) {
+        return false;
+    }
+    bucket.tokens -= 1;
+    return true;
+}
+
+uint64_t ConnectionLimiter::Prefix(const Endpoint& endpoint)
+{
+    const size_t bytes = endpoint.GetFamily() == Endpoint::Family::IPv6 ? 6 : 3;
+    uint64_t prefix = uint64_t(endpoint.GetFamily()) << 56;
+    for (size_t i = 0; i < bytes; ++i) {
+        prefix |= uint64_t(endpoint.Address()[i]) << (8 * i);
+    }
+    return prefix;
+}
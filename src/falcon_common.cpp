@@ -1,152 +1,970 @@
 #include <thread>
 #include <cstring>
+#include <cstddef>
 #include "falcon.h"
-#include <iostream>
+#include "log.h"
+#include "lz_codec.h"
+#include "siphash.h"
 #include <mutex>
 #include <chrono>
+#include <algorithm>
+#include <optional>
+#include <array>
+#include <bit>
+#include <iterator>
+#include <random>
 
 
-std::pair<std::string, int> Falcon::portFromIp(const std::string& ip) {
-    int colonPos = ip.rfind(':');
-    if (colonPos != std::string::npos && ip.find(']') == std::string::npos) {
-        int port = std::stoi(ip.substr(colonPos + 1, ip.size()));
-        std::string ipAddress = ip.substr(0, colonPos);
-        return {ipAddress, port};
-    } else if (ip.find('[') != std::string::npos && ip.find(']') != std::string::npos) {
-        int portPos = ip.rfind(':');
-        int bracketPos = ip.rfind(']');
-        if (portPos != std::string::npos && portPos > bracketPos) {
-            int port = std::stoi(ip.substr(portPos + 1, ip.size()));
-            std::string ipAddress = ip.substr(1, bracketPos - 1);
-            return {ipAddress, port};
-        }
-    }
-    std::cerr << "Error: Invalid client IP : " << ip << "\n";
-    return {"", -1};
-}
-
-std::unique_ptr<Stream> Falcon::CreateStream(uint64_t client, bool reliable) {
+std::unique_ptr<Stream> Falcon::CreateStream(uint64_t client, StreamDelivery delivery, const CompressionOptions& compression) {
     uint32_t streamID = nextStreamID++;
     streamID |= SERVERSTREAMMASK;
-    if (reliable)
+    if (delivery != StreamDelivery::Unreliable)
         streamID |= RELIABLESTREAMMASK;
-    else
-        streamID &= ~RELIABLESTREAMMASK;
+    if (delivery == StreamDelivery::ReliableOrdered)
+        streamID |= ORDEREDSTREAMMASK;
 
-    auto stream = std::make_unique<Stream>(streamID, clients[client].IP, clients[client].Port, *this);
-    streams.push_back(stream->streamID);
+    const Client target = GetClient(client);
+    auto stream = std::make_unique<Stream>(streamID, client, target.endpoint, *this, compression);
+    RegisterStream(*stream);
     return stream;
 }
 
-std::unique_ptr<Stream> Falcon::CreateStream(bool reliable) {
+std::unique_ptr<Stream> Falcon::CreateStream(StreamDelivery delivery, const CompressionOptions& compression) {
     uint32_t streamID = nextStreamID++;
-    streamID &= ~SERVERSTREAMMASK;
-    if (reliable)
+    if (delivery != StreamDelivery::Unreliable)
         streamID |= RELIABLESTREAMMASK;
-    else
-        streamID &= ~RELIABLESTREAMMASK;
+    if (delivery == StreamDelivery::ReliableOrdered)
+        streamID |= ORDEREDSTREAMMASK;
 
-    auto stream = std::make_unique<Stream>(streamID, clientInfoFromServer.IP, clientInfoFromServer.Port, *this);
-    streams.push_back(stream->streamID);
+    const Client server = GetClientInfoFromServer();
+    auto stream = std::make_unique<Stream>(streamID, server.ID, server.endpoint, *this, compression);
+    RegisterStream(*stream);
     return stream;
 }
 
+std::unique_ptr<Stream> Falcon::CreateStream(uint64_t client, bool reliable, const CompressionOptions& compression) {
+    return CreateStream(client, reliable ? StreamDelivery::ReliableUnordered : StreamDelivery::Unreliable, compression);
+}
+
+std::unique_ptr<Stream> Falcon::CreateStream(bool reliable, const CompressionOptions& compression) {
+    return CreateStream(reliable ? StreamDelivery::ReliableUnordered : StreamDelivery::Unreliable, compression);
+}
+
 void Falcon::CloseStream(const Stream& stream) {
     // spdlog::debug("Closing Stream {}", stream.GetStreamID());
-    streams.erase(std::remove_if(streams.begin(), streams.end(), [&](const auto& id) {
-        return id == stream.streamID;
-    }), streams.end());
+    std::unique_ptr<Stream> owned;
+    {
+        std::lock_guard lock(m_streamRegistryMutex);
+        StreamEntry* entry = m_streamRegistry.Find(StreamKey(stream.clientID, stream.streamID));
+        if (!entry || entry->stream != &stream) {
+            return;
+        }
+        owned = std::move(entry->owned);
+        m_streamRegistry.Erase(StreamKey(stream.clientID, stream.streamID));
+    }
+    // a stream the peer opened is destroyed here, outside the lock
+}
+
+void Falcon::RegisterStream(Stream &stream) {
+    std::lock_guard lock(m_streamRegistryMutex);
+    m_streamRegistry.TryEmplace(StreamKey(stream.clientID, stream.streamID)).first->stream = &stream;
+}
+
+void Falcon::UnregisterStream(const Stream &stream) {
+    std::lock_guard lock(m_streamRegistryMutex);
+    const StreamEntry* entry = m_streamRegistry.Find(StreamKey(stream.clientID, stream.streamID));
+    // owned streams are erased before being destroyed, this only drops the application's own streams
+    if (entry && entry->stream == &stream && !entry->owned) {
+        m_streamRegistry.Erase(StreamKey(stream.clientID, stream.streamID));
+    }
+}
+
+void Falcon::CloseRemoteStreams(uint64_t clientID) {
+    std::vector<std::unique_ptr<Stream>> closed;
+    std::lock_guard lock(m_streamRegistryMutex);
+    m_streamRegistry.ForEach([&](uint64_t key, StreamEntry& entry) {
+        if (key >> 32 == clientID && entry.owned) {
+            closed.push_back(std::move(entry.owned));
+        }
+    });
+    for (const auto& stream : closed) {
+        m_streamRegistry.Erase(StreamKey(stream->clientID, stream->streamID));
+    }
+}
+
+void Falcon::ReleaseStreams() {
+    std::vector<std::unique_ptr<Stream>> owned;
+    std::lock_guard lock(m_streamRegistryMutex);
+    m_streamRegistry.ForEach([&](uint64_t, StreamEntry& entry) {
+        if (entry.owned) {
+            owned.push_back(std::move(entry.owned));
+        }
+    });
+    m_streamRegistry = {};
 }
 
 int Falcon::SendTo(const std::string &to, uint16_t port, const std::span<const char> message)
 {
-    int sent = SendToInternal(to, port, message);
-    if (sent > 0) {
-        Msg msg;
-        msg.IP = to;
-        msg.Port = port;
-        msg.data = std::vector<char>(message.begin(), message.end());
-
-        if (MsgStandard msg_standard{}; DeserializeMessage(msg, MSG_STANDARD, msg_standard)) {
-            // add to the front of the queue
-            reliableMessagesSent[msg_standard.streamID].insert(reliableMessagesSent[msg_standard.streamID].begin(), msg_standard);
-            if (reliableMessagesSent[msg_standard.streamID].size() > 64) {
-                reliableMessagesSent[msg_standard.streamID].pop_back();
-            }
+    const Endpoint endpoint = Endpoint::Parse(to, port);
+    if (!endpoint.IsValid()) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Invalid IP {}", to);
+        return -1;
+    }
+    return SendTo(endpoint, message);
+}
+
+int Falcon::SendTo(const Endpoint &to, const std::span<const char> message)
+{
+    if (m_config.coalesceMessages && m_reactor) {
+        return AppendToBundle(to, message);
+    }
+    return SendDatagram(to, message);
+}
+
+int Falcon::SendDatagram(const Endpoint &to, const std::span<const char> message)
+{
+    if (m_config.simulation.enabled && m_reactor) {
+        bool earliest;
+        {
+            std::lock_guard lock(m_simulatorMutex);
+            earliest = m_simulator.Submit(to, message, std::chrono::steady_clock::now());
+        }
+        if (earliest && !OnNetworkThread()) {
+            // the network thread may sleep past the new release time
+            WakeReactor();
+        }
+        // a simulated loss looks like a successful send, as on a real network
+        return static_cast<int>(message.size());
+    }
+    return TransmitDatagram(to, message);
+}
+
+int Falcon::TransmitDatagram(const Endpoint &to, const std::span<const char> message)
+{
+    int sent;
+    if (m_config.ioBatchSize > 1 && m_reactor) {
+        sent = QueueDatagram(to, message);
+    } else {
+        sent = SendToInternal(to, message);
+        if (sent >= 0) {
+            m_sendCalls++;
+            m_datagramsSent++;
+            RecordBatch(m_maxSendBatch, 1);
         }
     }
+
     return sent;
 }
 
-int Falcon::ReceiveFrom(std::string& from, const std::span<char, 65535> message)
+int Falcon::SendStreamData(uint32_t streamID, uint64_t clientID, const Endpoint& to, std::span<const char> data, bool compressed)
 {
-    return ReceiveFromInternal(from, message);
+    if (data.size() > m_config.maxMessageSize) {
+        FALCON_LOG_ERROR(LogCategory::Stream, "Payload of {} bytes is too large for stream {}", data.size(), streamID);
+        return -1;
+    }
+    const size_t fragmentSize = FragmentPayloadSize();
+    const size_t fragmentCount = data.size() > fragmentSize ? (data.size() + fragmentSize - 1) / fragmentSize : 0;
+    if (fragmentCount > MAX_FRAGMENTS) {
+        FALCON_LOG_ERROR(LogCategory::Stream, "Payload of {} bytes needs too many fragments for stream {}", data.size(), streamID);
+        return -1;
+    }
+    if (fragmentCount > 0) {
+        m_messagesFragmented++;
+    }
+
+    const uint64_t streamKey = StreamKey(clientID, streamID);
+    bool wakeNetworkThread = false;
+    PacketHandle packet;
+    StandardHeader whole{};
+    whole.compressed = compressed;
+    std::vector<PacketHandle> outgoing;
+
+    if (!Stream::IsReliable(streamID)) {
+        uint16_t firstSequence;
+        std::shared_ptr<StreamCounters> counters;
+        {
+            std::lock_guard lock(m_streamsMutex);
+            StreamState& state = GetStreamState(streamKey);
+            counters = state.counters;
+            if (fragmentCount == 0) {
+                packet = BuildStreamPacket(streamKey, state, whole, data, wakeNetworkThread);
+            }
+            // fragments must have consecutive sequences, reserve them all at once
+            firstSequence = state.nextMessageID;
+            state.nextMessageID += static_cast<uint16_t>(fragmentCount);
+            if (fragmentCount > 0) {
+                Congestion(clientID).controller.OnUnreliableSent(data.size(), std::chrono::steady_clock::now());
+            }
+        }
+        if (fragmentCount == 0) {
+            if (!packet) {
+                FALCON_LOG_WARN(LogCategory::Stream, "No send buffer left for stream {}", streamID);
+                return -1;
+            }
+            return SendTo(to, packet.view());
+        }
+
+        // nothing is kept for resends, each fragment goes out as soon as it is built
+        for (size_t i = 0; i < fragmentCount; ++i) {
+            PacketHandle fragment = m_sendPool.Acquire();
+            if (!fragment) {
+                FALCON_LOG_WARN(LogCategory::Stream, "No send buffer left for stream {}", streamID);
+                return -1;
+            }
+            const auto payload = data.subspan(i * fragmentSize, std::min(fragmentSize, data.size() - i * fragmentSize));
+            StandardHeader header{clientID, streamID, static_cast<uint16_t>(firstSequence + i), 0,
+                static_cast<uint32_t>(i), static_cast<uint32_t>(fragmentCount), static_cast<uint32_t>(fragmentSize), compressed};
+            WriteStreamPacket(fragment, header, payload);
+            if (SendTo(to, fragment.view()) < 0) {
+                return -1;
+            }
+            counters->packetsSent.fetch_add(1, std::memory_order_relaxed);
+            counters->bytesSent.fetch_add(payload.size(), std::memory_order_relaxed);
+        }
+        return static_cast<int>(data.size());
+    }
+
+    {
+        std::lock_guard lock(m_streamsMutex);
+        StreamState& state = GetStreamState(streamKey);
+        state.peer = to;
+
+        if (fragmentCount == 0 && state.backlog.empty() && state.sent.IsFree(state.nextMessageID) &&
+            AdmitReliable(streamKey, wakeNetworkThread)) {
+            packet = BuildStreamPacket(streamKey, state, whole, data, wakeNetworkThread);
+            if (!packet) {
+                FALCON_LOG_WARN(LogCategory::Stream, "No send buffer left for stream {}", streamID);
+                return -1;
+            }
+        } else {
+            // the window or the congestion budget is full or the message is fragmented, queue it behind the
+            // messages already waiting
+            if (state.backlogBytes + data.size() > m_config.maxSendBacklog) {
+                FALCON_LOG_WARN(LogCategory::Stream, "Send backlog of stream {} is full", streamID);
+                return -1;
+            }
+            state.backlog.push_back({std::make_shared<const std::vector<char>>(data.begin(), data.end()),
+                static_cast<uint32_t>(fragmentSize), static_cast<uint32_t>(fragmentCount), 0, compressed});
+            state.backlogBytes += data.size();
+            PumpBacklog(streamKey, state, outgoing, wakeNetworkThread);
+        }
+    }
+    if (wakeNetworkThread) {
+        WakeReactor();
+    }
+
+    if (packet) {
+        return SendTo(to, packet.view());
+    }
+    for (const PacketHandle& fragment : outgoing) {
+        if (SendTo(to, fragment.view()) < 0) {
+            return -1;
+        }
+    }
+    return static_cast<int>(data.size());
+}
+
+void Falcon::RegisterDictionary(uint32_t id, std::span<const char> dictionary)
+{
+    if (id == 0) {
+        FALCON_LOG_WARN(LogCategory::Stream, "Dictionary ID 0 is reserved for no dictionary");
+        return;
+    }
+    auto bytes = std::make_shared<const std::vector<char>>(dictionary.begin(), dictionary.end());
+    std::lock_guard lock(m_dictionariesMutex);
+    m_dictionaries[id] = std::move(bytes);
 }
 
-std::unique_ptr<Falcon> Falcon::Listen(const std::string &endpoint, const uint16_t port)
+std::shared_ptr<const std::vector<char>> Falcon::FindDictionary(uint32_t id) const
 {
-    auto falcon = ListenInternal("127.0.0.1", port);
+    std::lock_guard lock(m_dictionariesMutex);
+    const auto it = m_dictionaries.find(id);
+    return it != m_dictionaries.end() ? it->second : nullptr;
+}
 
-    // server thread to handle messages
-    falcon->m_thread = std::thread([&falcon]() {
-        while (falcon->m_running) {
-            std::string fullClientIP;
-            std::vector<char> buffer(65535);
+bool Falcon::CompressPayload(std::span<const char> data, uint32_t dictionaryID, std::vector<char> &out)
+{
+    if (data.size() > m_config.maxMessageSize) {
+        return false; // rejected by SendStreamData
+    }
+    std::shared_ptr<const std::vector<char>> dictionary;
+    if (dictionaryID != 0 && !(dictionary = FindDictionary(dictionaryID))) {
+        FALCON_LOG_WARN(LogCategory::Stream, "Dictionary {} is not registered, sending uncompressed", dictionaryID);
+        m_compressionSkipped++;
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    out.resize(2 * MAX_VARINT_SIZE);
+    size_t prefix = WriteVarint(dictionaryID, out.data());
+    prefix += WriteVarint(data.size(), out.data() + prefix);
+    out.resize(prefix);
+    LzCompress(data, dictionary ? std::span<const char>(*dictionary) : std::span<const char>(), out);
+    m_compressionNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    if (out.size() >= data.size()) {
+        m_compressionSkipped++;
+        return false;
+    }
+    m_messagesCompressed++;
+    m_compressionInputBytes += data.size();
+    m_compressionOutputBytes += out.size();
+    return true;
+}
+
+bool Falcon::DecompressPayload(std::span<const char> payload, std::vector<char> &out)
+{
+    uint64_t dictionaryID, originalSize;
+    if (!ReadVarint(payload, dictionaryID) || !ReadVarint(payload, originalSize) || originalSize > m_config.maxMessageSize) {
+        return false;
+    }
+    std::shared_ptr<const std::vector<char>> dictionary;
+    if (dictionaryID != 0 && (dictionaryID > UINT32_MAX || !(dictionary = FindDictionary(static_cast<uint32_t>(dictionaryID))))) {
+        FALCON_LOG_WARN(LogCategory::Stream, "Compressed message uses unknown dictionary {}", dictionaryID);
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool decoded = LzDecompress(payload, dictionary ? std::span<const char>(*dictionary) : std::span<const char>(), originalSize, out);
+    m_decompressionNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return decoded;
+}
+
+int Falcon::ScheduleStreamData(uint32_t streamID, uint64_t clientID, const Endpoint &to, std::span<const char> data, bool compressed, const StreamPriority &priority)
+{
+    if (m_config.scheduler.bytesPerTick == 0) {
+        return SendStreamData(streamID, clientID, to, data, compressed);
+    }
 
-            int received = falcon->ReceiveFrom(fullClientIP, std::span<char, 65535>(buffer.data(), buffer.size()));
+    SendScheduler::Message message{streamID, to, std::vector<char>(data.begin(), data.end()), compressed, std::chrono::steady_clock::now()};
+    std::lock_guard lock(m_schedulerMutex);
+    SendScheduler& scheduler = m_schedulers.try_emplace(clientID, m_config.scheduler).first->second;
+    if (!scheduler.Enqueue(priority, std::move(message))) {
+        FALCON_LOG_WARN(LogCategory::Stream, "Send queue of client {} is full", clientID);
+        return -1;
+    }
+    return static_cast<int>(data.size());
+}
 
-            if (received < 0) {
-                // std::cerr << "Failed to receive message\n";
+void Falcon::RunScheduler()
+{
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<uint64_t, SendScheduler::Message>> due;
+    std::vector<std::pair<uint64_t, SendScheduler::Message>> stale;
+    {
+        std::vector<SendScheduler::Message> out, dropped;
+        std::lock_guard lock(m_schedulerMutex);
+        for (auto it = m_schedulers.begin(); it != m_schedulers.end();) {
+            it->second.RunTick(now, out, dropped);
+            for (SendScheduler::Message& message : out) {
+                due.emplace_back(it->first, std::move(message));
             }
-            if (received > 0) {
-                auto [IP, port] = falcon->portFromIp(fullClientIP);
-
-                Msg msg;
-                msg.IP = IP;
-                msg.Port = port;
-                msg.data = std::vector<char>(buffer.begin(), buffer.end());
-
-                for (auto& [id,c]: falcon->clients) {
-                    if (c.IP == IP && c.Port == port) {
-                        c.lastPing = std::chrono::steady_clock::now();
-                        c.pinged = false;
-                        break;
-                    }
-                }
+            for (SendScheduler::Message& message : dropped) {
+                stale.emplace_back(it->first, std::move(message));
+            }
+            out.clear();
+            dropped.clear();
+            it = it->second.Empty() ? m_schedulers.erase(it) : std::next(it);
+        }
+    }
+
+    if (!stale.empty()) {
+        std::lock_guard lock(m_streamsMutex);
+        for (const auto& [clientID, message] : stale) {
+            GetStreamState(StreamKey(clientID, message.streamID)).counters->staleDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    for (const auto& [clientID, message] : due) {
+        if (SendStreamData(message.streamID, clientID, message.to, message.data, message.compressed) < 0) {
+            FALCON_LOG_ERROR(LogCategory::Stream, "Failed to send scheduled data to {}", message.to.ToString());
+        }
+    }
+}
 
-                falcon->handleMessage(msg);
+size_t Falcon::FragmentPayloadSize() const
+{
+    return std::min(m_config.maxDatagramSize, m_config.packetBufferSize) - MAX_STANDARD_HEADER_SIZE;
+}
+
+void Falcon::WriteStreamPacket(PacketHandle &packet, const StandardHeader &header, std::span<const char> payload)
+{
+    StandardHeader withSize = header;
+    withSize.payloadSize = static_cast<uint32_t>(payload.size());
+    const size_t headerSize = EncodeStandardHeader(withSize, packet.data());
+    std::memcpy(packet.data() + headerSize, payload.data(), payload.size());
+    packet.SetSize(headerSize + payload.size());
+}
+
+PacketHandle Falcon::BuildStreamPacket(uint64_t streamKey, StreamState &state, StandardHeader header, std::span<const char> payload, bool &wakeNetworkThread)
+{
+    PacketHandle packet = m_sendPool.Acquire();
+    if (!packet) {
+        return packet;
+    }
+    header.clientID = streamKey >> 32;
+    header.streamID = static_cast<uint32_t>(streamKey);
+    header.sequence = state.nextMessageID++;
+    WriteStreamPacket(packet, header, payload);
+    state.counters->packetsSent.fetch_add(1, std::memory_order_relaxed);
+    state.counters->bytesSent.fetch_add(payload.size(), std::memory_order_relaxed);
+
+    const auto now = std::chrono::steady_clock::now();
+    CongestionController& congestion = Congestion(header.clientID).controller;
+    if (!Stream::IsReliable(header.streamID)) {
+        congestion.OnUnreliableSent(packet.size(), now);
+    } else {
+        congestion.OnReliableSent(packet.size(), now);
+        SentMessage& sent = state.sent.Insert(header.sequence);
+        sent.packet = packet;
+        sent.to = state.peer;
+        sent.sentTime = now;
+        sent.size = static_cast<uint32_t>(packet.size());
+        sent.transmissions = 1;
+        const auto deadline = sent.sentTime + ConnectionRtt(header.clientID).Timeout();
+        sent.retransmitTimer = ScheduleRetransmit(streamKey, header.sequence, deadline);
+        // the network thread may be sleeping past this deadline
+        if (m_timers.NextDeadline() == deadline && !OnNetworkThread()) {
+            wakeNetworkThread = true;
+        }
+    }
+    return packet;
+}
+
+void Falcon::PumpBacklog(uint64_t streamKey, StreamState &state, std::vector<PacketHandle> &out, bool &wakeNetworkThread)
+{
+    while (!state.backlog.empty() && state.sent.IsFree(state.nextMessageID) && AdmitReliable(streamKey, wakeNetworkThread)) {
+        PendingMessage& pending = state.backlog.front();
+        std::span<const char> payload(*pending.data);
+        StandardHeader header{};
+        header.compressed = pending.compressed;
+        if (pending.fragmentCount > 0) {
+            const size_t offset = size_t(pending.nextFragment) * pending.fragmentSize;
+            payload = payload.subspan(offset, std::min<size_t>(pending.fragmentSize, payload.size() - offset));
+            header.fragmentIndex = pending.nextFragment;
+            header.fragmentCount = pending.fragmentCount;
+            header.fragmentSize = pending.fragmentSize;
+        }
+
+        PacketHandle packet = BuildStreamPacket(streamKey, state, header, payload, wakeNetworkThread);
+        if (!packet) {
+            FALCON_LOG_DEBUG(LogCategory::Stream, "No send buffer left for stream {}, backlog waits for the next ack", static_cast<uint32_t>(streamKey));
+            return;
+        }
+        out.push_back(std::move(packet));
+
+        if (++pending.nextFragment >= std::max<uint32_t>(pending.fragmentCount, 1)) {
+            state.backlogBytes -= pending.data->size();
+            state.backlog.pop_front();
+        }
+    }
+}
+
+ConnectionCongestion& Falcon::Congestion(uint64_t clientID)
+{
+    return connectionCongestion.try_emplace(clientID, m_config.congestion, m_config.maxDatagramSize).first->second;
+}
+
+bool Falcon::AdmitReliable(uint64_t streamKey, bool &wakeNetworkThread)
+{
+    const uint64_t clientID = streamKey >> 32;
+    ConnectionCongestion& congestion = Congestion(clientID);
+    const auto now = std::chrono::steady_clock::now();
+    if (congestion.controller.CanSend(now)) {
+        return true;
+    }
+    if (std::find(congestion.blockedStreams.begin(), congestion.blockedStreams.end(), streamKey) == congestion.blockedStreams.end()) {
+        congestion.blockedStreams.push_back(streamKey);
+    }
+    // out of pacing budget, a full window waits for acks instead
+    const auto next = congestion.controller.NextSendTime(now);
+    if (next && congestion.pacingTimer == TimerQueue::INVALID_TIMER) {
+        congestion.pacingTimer = m_timers.Schedule(*next, [this, clientID]() {
+            handlePacingTimer(clientID);
+        });
+        if (m_timers.NextDeadline() == *next && !OnNetworkThread()) {
+            wakeNetworkThread = true;
+        }
+    }
+    return false;
+}
+
+void Falcon::PumpBlockedStreams(uint64_t clientID, std::vector<PacketHandle> &out, Endpoint &peer, bool &wakeNetworkThread)
+{
+    // streams still held back put themselves back in the list, in the same order
+    std::vector<uint64_t> blocked;
+    blocked.swap(Congestion(clientID).blockedStreams);
+    for (const uint64_t streamKey : blocked) {
+        const auto state = streamStates.find(streamKey);
+        if (state == streamStates.end() || state->second.backlog.empty()) {
+            continue;
+        }
+        peer = state->second.peer;
+        PumpBacklog(streamKey, state->second, out, wakeNetworkThread);
+    }
+}
+
+void Falcon::handlePacingTimer(uint64_t clientID)
+{
+    std::vector<PacketHandle> packets;
+    Endpoint peer;
+    {
+        std::lock_guard lock(m_streamsMutex);
+        const auto congestion = connectionCongestion.find(clientID);
+        if (congestion == connectionCongestion.end()) {
+            return;
+        }
+        congestion->second.pacingTimer = TimerQueue::INVALID_TIMER;
+        bool wakeNetworkThread = false;
+        PumpBlockedStreams(clientID, packets, peer, wakeNetworkThread);
+    }
+    for (const PacketHandle& packet : packets) {
+        if (SendTo(peer, packet.view()) < 0) {
+            FALCON_LOG_ERROR(LogCategory::Reliability, "Failed to send paced packet");
+        }
+    }
+}
+
+int Falcon::ReceiveFrom(Endpoint& from, const std::span<char, 65535> message)
+{
+    return ReceiveFromInternal(from, message);
+}
+
+int Falcon::ReceiveFrom(std::string& from, const std::span<char, 65535> message)
+{
+    Endpoint endpoint;
+    const int received = ReceiveFromInternal(endpoint, message);
+    from = endpoint.ToString();
+    return received;
+}
+
+int Falcon::QueueDatagram(const Endpoint &to, std::span<const char> message)
+{
+    std::lock_guard lock(m_sendQueueMutex);
+    const bool wasEmpty = m_sendQueue.empty();
+
+    m_sendQueue.push_back({to, m_sendQueueData.size(), message.size()});
+    m_sendQueueData.insert(m_sendQueueData.end(), message.begin(), message.end());
+
+    if (m_sendQueue.size() >= m_config.ioBatchSize) {
+        // a full batch goes out right away, whichever thread filled it
+        SendBatchInternal(m_sendQueue, m_sendQueueData.data());
+        m_sendQueue.clear();
+        m_sendQueueData.clear();
+    } else if (wasEmpty && !OnNetworkThread()) {
+        // the network thread may be asleep, make sure it flushes this iteration
+        WakeReactor();
+    }
+    return static_cast<int>(message.size());
+}
+
+int Falcon::AppendToBundle(const Endpoint &to, std::span<const char> message)
+{
+    char prefix[MAX_VARINT_SIZE];
+    const size_t prefixSize = WriteVarint(message.size(), prefix);
+    if (1 + prefixSize + message.size() > m_config.maxDatagramSize) {
+        // too big to share a datagram
+        return SendDatagram(to, message);
+    }
+
+    bool wakeNetworkThread = false;
+    {
+        std::lock_guard lock(m_bundleMutex);
+        Bundle& bundle = m_bundles[to];
+        if (bundle.data.size() + prefixSize + message.size() > m_config.maxDatagramSize) {
+            SendBundle(to, bundle);
+        }
+        if (bundle.data.empty()) {
+            bundle.data.push_back(static_cast<char>(MSG_BUNDLE));
+        }
+        bundle.data.insert(bundle.data.end(), prefix, prefix + prefixSize);
+        bundle.data.insert(bundle.data.end(), message.begin(), message.end());
+        bundle.messages++;
+
+        // the network thread flushes its own messages at the end of the iteration, others get a deadline
+        if (OnNetworkThread()) {
+            m_networkThreadBundled = true;
+        } else if (m_bundleFlushTimer == TimerQueue::INVALID_TIMER) {
+            const auto deadline = std::chrono::steady_clock::now() + m_config.coalesceDelay;
+            m_bundleFlushTimer = m_timers.Schedule(deadline, [this]() {
+                FlushBundles();
+            });
+            wakeNetworkThread = m_timers.NextDeadline() == deadline;
+        }
+    }
+    if (wakeNetworkThread) {
+        WakeReactor();
+    }
+    return static_cast<int>(message.size());
+}
+
+void Falcon::SendBundle(const Endpoint &to, Bundle &bundle)
+{
+    if (bundle.messages == 0) {
+        return;
+    }
+
+    int sent;
+    if (bundle.messages == 1) {
+        // nothing to share the datagram with, send the message as is
+        std::span<const char> message(bundle.data);
+        uint64_t size;
+        message = message.subspan(1);
+        ReadVarint(message, size);
+        sent = SendDatagram(to, message);
+    } else {
+        m_messagesCoalesced += bundle.messages;
+        sent = SendDatagram(to, bundle.data);
+    }
+    if (sent < 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to send bundle to {}", to.ToString());
+    }
+    bundle.data.clear();
+    bundle.messages = 0;
+}
+
+void Falcon::FlushBundles()
+{
+    std::lock_guard lock(m_bundleMutex);
+    for (auto& [to, bundle] : m_bundles) {
+        SendBundle(to, bundle);
+    }
+    if (m_bundleFlushTimer != TimerQueue::INVALID_TIMER) {
+        m_timers.Cancel(m_bundleFlushTimer);
+        m_bundleFlushTimer = TimerQueue::INVALID_TIMER;
+    }
+}
+
+void Falcon::Flush()
+{
+    if (m_config.scheduler.bytesPerTick > 0) {
+        RunScheduler();
+    }
+    FlushBundles();
+    FlushSendQueue();
+}
+
+void Falcon::ReleaseSimulated(std::chrono::steady_clock::time_point now)
+{
+    {
+        std::lock_guard lock(m_simulatorMutex);
+        m_simulator.TakeDue(now, m_simulatorDue);
+    }
+    for (const NetworkSimulator::Datagram& datagram : m_simulatorDue) {
+        TransmitDatagram(datagram.to, datagram.data);
+    }
+    m_simulatorDue.clear();
+}
+
+void Falcon::FlushSendQueue()
+{
+    std::lock_guard lock(m_sendQueueMutex);
+    if (m_sendQueue.empty()) {
+        return;
+    }
+    SendBatchInternal(m_sendQueue, m_sendQueueData.data());
+    m_sendQueue.clear();
+    m_sendQueueData.clear();
+}
+
+void Falcon::RecordBatch(std::atomic<uint32_t>& maxBatch, uint32_t count)
+{
+    uint32_t current = maxBatch.load(std::memory_order_relaxed);
+    while (count > current && !maxBatch.compare_exchange_weak(current, count, std::memory_order_relaxed)) {}
+}
+
+int Falcon::ReceiveBatch()
+{
+    const int received = ReceiveBatchInternal(m_receiveBatch);
+    if (received > 0) {
+        m_receiveCalls++;
+        m_datagramsReceived += received;
+        RecordBatch(m_maxReceiveBatch, received);
+    }
+    return received;
+}
+
+FalconStats Falcon::GetStats() const
+{
+    FalconStats stats;
+    stats.datagramsReceived = m_datagramsReceived;
+    stats.datagramsSent = m_datagramsSent;
+    stats.receiveCalls = m_receiveCalls;
+    stats.sendCalls = m_sendCalls;
+    stats.maxReceiveBatch = m_maxReceiveBatch;
+    stats.maxSendBatch = m_maxSendBatch;
+    stats.datagramsDropped = m_datagramsDropped;
+    stats.retransmissions = m_retransmissions;
+    stats.fastRetransmissions = m_fastRetransmissions;
+    stats.messagesCoalesced = m_messagesCoalesced;
+    stats.messagesFragmented = m_messagesFragmented;
+    stats.messagesReassembled = m_messagesReassembled;
+    stats.reassembliesDropped = m_reassembliesDropped;
+    stats.messagesCompressed = m_messagesCompressed;
+    stats.compressionSkipped = m_compressionSkipped;
+    stats.compressionInputBytes = m_compressionInputBytes;
+    stats.compressionOutputBytes = m_compressionOutputBytes;
+    stats.compressionTime = std::chrono::nanoseconds(m_compressionNanoseconds.load());
+    stats.decompressionTime = std::chrono::nanoseconds(m_decompressionNanoseconds.load());
+    stats.connectionChallenges = m_connectionChallenges;
+    stats.connectionCookiesRejected = m_connectionCookiesRejected;
+    stats.connectionsRateLimited = m_connectionsRateLimited;
+    {
+        std::lock_guard lock(m_simulatorMutex);
+        stats.simulatedLost = m_simulator.Lost();
+        stats.simulatedDuplicated = m_simulator.Duplicated();
+        stats.simulatedReordered = m_simulator.Reordered();
+    }
+
+    std::lock_guard lock(m_streamsMutex);
+    std::unordered_map<uint64_t, size_t> clientIndex;
+    const auto clientStats = [&](uint64_t clientID) -> ClientStats& {
+        const auto [index, added] = clientIndex.try_emplace(clientID, stats.clients.size());
+        if (added) {
+            ClientStats& client = stats.clients.emplace_back();
+            client.clientID = clientID;
+            if (const auto counters = clientCounters.find(clientID); counters != clientCounters.end()) {
+                client.ackLatency = counters->second->ackLatency.Read();
+            }
+            if (const auto rtt = connectionRtt.find(clientID); rtt != connectionRtt.end() && rtt->second.HasSample()) {
+                client.smoothedRtt = rtt->second.SmoothedRtt();
+                client.rttVariance = rtt->second.RttVariance();
+            }
+            if (const auto congestion = connectionCongestion.find(clientID); congestion != connectionCongestion.end()) {
+                const CongestionController& controller = congestion->second.controller;
+                client.congestionWindow = controller.Window();
+                client.bytesInFlight = controller.BytesInFlight();
+                client.pacingRate = controller.PacingRate();
+                client.slowStart = controller.InSlowStart();
+                client.congestionEvents = controller.CongestionEvents();
+            }
+            std::lock_guard schedulerLock(m_schedulerMutex);
+            if (const auto scheduler = m_schedulers.find(clientID); scheduler != m_schedulers.end()) {
+                client.scheduledBytes = scheduler->second.QueuedBytes();
             }
+        }
+        return stats.clients[index->second];
+    };
+    for (const auto& [streamKey, state] : streamStates) {
+        StreamStats stream;
+        stream.streamID = static_cast<uint32_t>(streamKey);
+        stream.Read(*state.counters);
+        state.sent.ForEach([&](uint32_t, const SentMessage&) { stream.unacked++; });
+        stream.backlogMessages = state.backlog.size();
+        stream.backlogBytes = state.backlogBytes;
+        stream.reorderMessages = state.reorderMessages;
+        stream.reorderBytes = state.reorderBytes;
+        clientStats(streamKey >> 32).Add(stream);
+    }
+    // connections measured by keep-alives only
+    for (const auto& [clientID, rtt] : connectionRtt) {
+        clientStats(clientID);
+    }
+    return stats;
+}
 
-            for (auto& [id,c]: falcon->clients) {
-                std::chrono::steady_clock::duration delta_time = std::chrono::steady_clock::now() - c.lastPing;
+std::unique_ptr<Falcon> Falcon::Listen(const std::string &endpoint, const uint16_t port, const FalconConfig& config)
+{
+    auto falcon = ListenInternal(endpoint, port, config);
+    if (!falcon || !falcon->InitReactor()) {
+        return nullptr;
+    }
 
-                // std::cout << "Client " << c.ID << " last pinged " << std::chrono::duration_cast<std::chrono::seconds>(delta_time).count() << " seconds ago\n";
-                // std::cout << "Client " << c.ID << " pinged " << c.pinged << "\n";
+    falcon->ScheduleStatsDump();
 
-                if (delta_time > std::chrono::seconds(1) && !c.pinged) {
-                    c.pinged = true;
-                    int sent = falcon->SendTo(c.IP, c.Port, Falcon::SerializeMessage(Ping{PING}));
-                    if (sent < 0) {
-                        std::cerr << "Failed to ping client " << c.ID << "\n";
-                    }
-                    else {
-                        std::cout << "Pinging client " << c.ID << "\n";
+    // server thread to handle messages
+    falcon->m_thread = std::thread([server = falcon.get()]() {
+        server->RunNetworkLoop();
+    });
+
+    return falcon;
+}
+
+void Falcon::RunNetworkLoop()
+{
+    m_networkThreadID = std::this_thread::get_id();
+    while (m_running) {
+        // acks, pongs and resends of the previous iteration
+        if (m_networkThreadBundled) {
+            m_networkThreadBundled = false;
+            FlushBundles();
+        }
+        auto now = std::chrono::steady_clock::now();
+        std::optional<std::chrono::steady_clock::time_point> nextRelease;
+        if (m_config.simulation.enabled) {
+            ReleaseSimulated(now);
+            std::lock_guard lock(m_simulatorMutex);
+            nextRelease = m_simulator.NextRelease();
+        }
+        FlushSendQueue();
+
+        // sleep until a datagram arrives, the next timer is due or the simulator releases a datagram
+        now = std::chrono::steady_clock::now();
+        auto deadline = m_timers.NextDeadline().value_or(now + std::chrono::hours(1));
+        if (nextRelease) {
+            deadline = std::min(deadline, *nextRelease);
+        }
+
+        if (WaitForEvents(deadline)) {
+            // drain everything the socket has queued before running timers
+            while (m_running) {
+                const int received = ReceiveBatch();
+                for (int i = 0; i < received; ++i) {
+                    Datagram& datagram = m_receiveBatch[i];
+                    if (!datagram.packet) {
+                        continue;
                     }
-                }
-                else if (delta_time > std::chrono::seconds(2) && c.pinged) {
-                    falcon->clients.erase(id);
-                    std::cerr << "Client " << c.ID << " disconnected\n";
 
-                    for (const auto& handler: falcon->onClientDisconnectedHandlers) {
-                        handler(c.ID);
+                    Msg msg;
+                    msg.from = datagram.from;
+                    msg.packet = std::move(datagram.packet);
+                    msg.data = msg.packet.view();
+
+                    // any traffic counts as a sign of life, the keep-alive timers check it when they fire
+                    if (Client* sender = clients.FindByEndpoint(msg.from)) {
+                        sender->lastPing = std::chrono::steady_clock::now();
+                        sender->pinged = false;
+                    } else if (msg.from == clientInfoFromServer.endpoint) {
+                        clientInfoFromServer.lastPing = std::chrono::steady_clock::now();
+                        clientInfoFromServer.pinged = false;
                     }
+
+                    handleMessage(msg);
+                }
+                if (received < static_cast<int>(m_receiveBatch.size())) {
                     break;
                 }
             }
         }
+
+        m_timers.RunExpired(std::chrono::steady_clock::now());
+    }
+}
+
+void Falcon::ScheduleClientKeepAlive(Client& client, std::chrono::steady_clock::time_point deadline)
+{
+    const uint64_t clientID = client.ID;
+    client.keepAliveTimer = m_timers.Schedule(deadline, [this, clientID]() {
+        handleClientKeepAlive(clientID);
     });
+}
 
-    return falcon;
+void Falcon::handleClientKeepAlive(uint64_t clientID)
+{
+    Client* client = clients.Find(clientID);
+    if (!client) {
+        return;
+    }
+
+    const auto idle = std::chrono::steady_clock::now() - client->lastPing;
+    if (idle >= m_config.timeout) {
+        {
+            std::lock_guard lock(m_bundleMutex);
+            m_bundles.erase(client->endpoint);
+        }
+        FalconEvent event;
+        event.type = FalconEvent::Type::ClientDisconnected;
+        event.client = *client;
+        clients.Erase(clientID);
+        ForgetConnection(clientID);
+        FALCON_LOG_INFO(LogCategory::Connection, "Client {} disconnected", clientID);
+
+        Emit(std::move(event));
+        return;
+    }
+
+    if (idle >= m_config.pingInterval && !client->pinged) {
+        client->pinged = true;
+        MessageBuffer<Ping> ping;
+        const size_t size = SerializeMessage(Ping{PING, 0, 0, std::chrono::steady_clock::now()}, ping);
+        int sent = SendTo(client->endpoint, {ping.data(), size});
+        if (sent < 0) {
+            FALCON_LOG_ERROR(LogCategory::Connection, "Failed to ping client {}", clientID);
+        }
+    }
+    ScheduleClientKeepAlive(*client, client->lastPing + (client->pinged ? m_config.timeout : m_config.pingInterval));
+}
+
+void Falcon::ScheduleStatsDump()
+{
+    if (m_config.statsDumpInterval.count() > 0) {
+        m_timers.Schedule(std::chrono::steady_clock::now() + m_config.statsDumpInterval, [this]() {
+            handleStatsDump();
+        });
+    }
+}
+
+void Falcon::handleStatsDump()
+{
+    const FalconStats stats = GetStats();
+    FALCON_LOG_INFO(LogCategory::Metrics, "{} datagrams sent, {} received, {} dropped, {} retransmissions, {} fast, {} connections",
+        stats.datagramsSent, stats.datagramsReceived, stats.datagramsDropped, stats.retransmissions,
+        stats.fastRetransmissions, stats.clients.size());
+    if (stats.messagesCompressed + stats.compressionSkipped > 0) {
+        FALCON_LOG_INFO(LogCategory::Metrics, "{} messages compressed, ratio {:.2f}, {} skipped, {} us compressing, {} us decompressing",
+            stats.messagesCompressed, stats.CompressionRatio(), stats.compressionSkipped,
+            std::chrono::duration_cast<std::chrono::microseconds>(stats.compressionTime).count(),
+            std::chrono::duration_cast<std::chrono::microseconds>(stats.decompressionTime).count());
+    }
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+    // per-client lines only exist in debug builds, skip the loop entirely otherwise
+    for (const ClientStats& client : stats.clients) {
+        FALCON_LOG_DEBUG(LogCategory::Metrics, "client {}: {} packets sent, {} received, {} retransmitted, {} duplicates, "
+            "{} out of window, srtt {} us, ack latency p50 {} p99 {} p999 {} us, {} unacked, {} backlogged, "
+            "cwnd {} bytes, {} in flight, pacing {:.0f} B/s",
+            client.clientID, client.packetsSent, client.packetsReceived, client.retransmissions, client.duplicates,
+            client.outOfWindow, client.smoothedRtt.value_or(std::chrono::microseconds(0)).count(),
+            client.ackLatency.Percentile(0.5), client.ackLatency.Percentile(0.99), client.ackLatency.Percentile(0.999),
+            client.unacked, client.backlogMessages, client.congestionWindow, client.bytesInFlight, client.pacingRate);
+    }
+#endif
+    ScheduleStatsDump();
+}
+
+void Falcon::ScheduleServerKeepAlive(std::chrono::steady_clock::time_point deadline)
+{
+    clientInfoFromServer.keepAliveTimer = m_timers.Schedule(deadline, [this]() {
+        handleServerKeepAlive();
+    });
+}
+
+void Falcon::handleServerKeepAlive()
+{
+    const auto idle = std::chrono::steady_clock::now() - clientInfoFromServer.lastPing;
+
+    if (clientInfoFromServer.ID == 0) {
+        if (idle < m_config.connectTimeout) {
+            ScheduleServerKeepAlive(clientInfoFromServer.lastPing + m_config.connectTimeout);
+            return;
+        }
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to connect to server");
+        m_running = false;
+        FalconEvent event;
+        event.type = FalconEvent::Type::ConnectionResult;
+        event.success = false;
+        Emit(std::move(event));
+        return;
+    }
+
+    if (idle >= m_config.timeout) {
+        FALCON_LOG_INFO(LogCategory::Connection, "Server disconnected");
+        m_running = false;
+        FalconEvent event;
+        event.type = FalconEvent::Type::Disconnected;
+        event.client = clientInfoFromServer;
+        Emit(std::move(event));
+        return;
+    }
+
+    if (idle >= m_config.pingInterval && !clientInfoFromServer.pinged) {
+        clientInfoFromServer.pinged = true;
+        MessageBuffer<Ping> ping;
+        const size_t size = SerializeMessage(Ping{PING, clientInfoFromServer.ID, 0, std::chrono::steady_clock::now()}, ping);
+        int sent = SendTo(clientInfoFromServer.endpoint, {ping.data(), size});
+        if (sent < 0) {
+            FALCON_LOG_ERROR(LogCategory::Connection, "Failed to ping server");
+        }
+    }
+    ScheduleServerKeepAlive(clientInfoFromServer.lastPing + (clientInfoFromServer.pinged ? m_config.timeout : m_config.pingInterval));
 }
 
 
@@ -170,142 +988,752 @@ void Falcon::OnStreamCreated(const std::function<void(uint32_t)> &handler) {
     onStreamCreatedHandlers.push_back(handler);
 }
 
+void Falcon::OnStreamOpened(const std::function<void(Stream&)> &handler) {
+    onStreamOpenedHandlers.push_back(handler);
+}
+
+
+bool Falcon::ParseStandardMessage(const Msg &msg, MsgStandardView &out) {
+    StandardHeader header;
+    const size_t headerSize = DecodeStandardHeader(msg.data, header);
+    if (headerSize == 0 || msg.data.size() - headerSize != header.payloadSize) {
+        return false;
+    }
+    out.clientID = header.clientID;
+    out.streamID = header.streamID;
+    out.messageID = header.sequence;
+    out.data = msg.data.subspan(headerSize);
+    out.fragmentIndex = header.fragmentIndex;
+    out.fragmentCount = header.fragmentCount;
+    out.fragmentSize = header.fragmentSize;
+    out.compressed = header.compressed;
+    return true;
+}
 
 void Falcon::handleMessage(const Msg &msg) {
-    if (MsgConn msg_conn; DeserializeMessage(msg, MSG_CONN, msg_conn)) {
-        handleConnectionMessage(msg_conn, msg.IP, msg.Port);
+    if (msg.data.empty()) {
+        FALCON_LOG_WARN(LogCategory::Socket, "Failed to deserialize message");
+        return;
+    }
+
+    switch (static_cast<uint8_t>(msg.data[0])) {
+    case MSG_CONN:
+        if (MsgConn msg_conn; DeserializeMessage(msg, MSG_CONN, msg_conn)) {
+            handleConnectionMessage(msg_conn, msg.from);
+            return;
+        }
+        break;
+    case MSG_CONN_ACK:
+        if (MsgConnAck msg_conn_ack; DeserializeMessage(msg, MSG_CONN_ACK, msg_conn_ack)) {
+            handleConnectionAckMessage(msg_conn_ack);
+            return;
+        }
+        break;
+    case MSG_STANDARD:
+        if (MsgStandardView msg_standard; ParseStandardMessage(msg, msg_standard)) {
+            handleStandardMessage(msg_standard, msg.from, msg.packet);
+            return;
+        }
+        break;
+    case MSG_ACK:
+        if (MsgAck msg_ack; DeserializeMessage(msg, MSG_ACK, msg_ack)) {
+            handleAckMessage(msg_ack, msg.from);
+            return;
+        }
+        break;
+    case MSG_CONN_CHALLENGE:
+        if (MsgConn challenge; DeserializeMessage(msg, MSG_CONN_CHALLENGE, challenge)) {
+            handleConnectionChallengeMessage(challenge, msg.from);
+            return;
+        }
+        break;
+    case MSG_BUNDLE:
+        handleBundleMessage(msg);
+        return;
+    case PING:
+    case PONG:
+        if (Ping ping; DeserializeMessage(msg, static_cast<uint8_t>(msg.data[0]), ping)) {
+            handlePingMessage(ping, msg.from);
+            return;
+        }
+        break;
+    default:
+        break;
     }
-    else if (MsgConnAck msg_conn_ack; DeserializeMessage(msg, MSG_CONN_ACK, msg_conn_ack)) {
-        handleConnectionAckMessage(msg_conn_ack);
+    FALCON_LOG_WARN(LogCategory::Socket, "Failed to deserialize message");
+}
+
+void Falcon::Emit(FalconEvent &&event) {
+    if (m_config.pollEvents) {
+        PushEvent(std::move(event));
+    } else {
+        DispatchEvent(event);
     }
-    else if (MsgStandard msg_standard; DeserializeMessage(msg, MSG_STANDARD, msg_standard)) {
-        handleStandardMessage(msg_standard);
+}
+
+void Falcon::PushEvent(FalconEvent &&event) {
+    if (!m_eventsOverflowing.load(std::memory_order_acquire) && m_events.TryPush(std::move(event))) {
+        return;
+    }
+    // the poller fell behind, never block the network thread on it
+    std::lock_guard lock(m_eventOverflowMutex);
+    m_eventOverflow.push_back(std::move(event));
+    m_eventsOverflowing.store(true, std::memory_order_release);
+}
+
+size_t Falcon::Poll(size_t maxEvents) {
+    size_t polled = 0;
+    FalconEvent event;
+    while (polled < maxEvents) {
+        if (!m_polledOverflow.empty()) {
+            event = std::move(m_polledOverflow.front());
+            m_polledOverflow.pop_front();
+        } else if (!m_events.TryPop(event)) {
+            // the ring is drained, whatever spilled over is newer than all of it
+            if (!m_eventsOverflowing.load(std::memory_order_acquire)) {
+                break;
+            }
+            std::lock_guard lock(m_eventOverflowMutex);
+            std::move(m_eventOverflow.begin(), m_eventOverflow.end(), std::back_inserter(m_polledOverflow));
+            m_eventOverflow.clear();
+            m_eventsOverflowing.store(false, std::memory_order_release);
+            continue;
+        }
+        DispatchEvent(event);
+        ++polled;
     }
-    else if (MsgAck msg_ack; DeserializeMessage(msg, MSG_ACK, msg_ack)) {
-        handleAckMessage(msg_ack);
+    // don't hold on to the last packet until the next poll
+    event = {};
+    return polled;
+}
+
+void Falcon::DispatchEvent(FalconEvent &event) {
+    switch (event.type) {
+    case FalconEvent::Type::ClientConnected:
+        if (m_config.pollEvents) {
+            m_polledClients[event.client.ID] = event.client;
+        }
+        for (const auto& handler: onClientConnectedHandlers) {
+            handler(event.client.ID);
+        }
+        break;
+    case FalconEvent::Type::ClientDisconnected:
+        if (m_config.pollEvents) {
+            m_polledClients.erase(event.client.ID);
+        }
+        for (const auto& handler: onClientDisconnectedHandlers) {
+            handler(event.client.ID);
+        }
+        CloseRemoteStreams(event.client.ID);
+        break;
+    case FalconEvent::Type::ConnectionResult:
+        if (m_config.pollEvents && event.success) {
+            m_polledServerInfo = event.client;
+        }
+        for (const auto& handler: onConnectionEventHandlers) {
+            handler(event.success, event.client.ID);
+        }
+        break;
+    case FalconEvent::Type::Disconnected:
+        for (const auto& handler: onDisconnectHandlers) {
+            handler();
+        }
+        break;
+    case FalconEvent::Type::Data:
+        DispatchData(event);
+        break;
     }
-    else if (Ping ping; DeserializeMessage(msg, PING, ping)) {
-        handlePingMessage(ping);
+}
+
+void Falcon::DispatchData(FalconEvent &event) {
+    const uint64_t streamKey = StreamKey(event.client.ID, event.streamID);
+    // held while the handlers run so the stream can't be destroyed under them
+    std::lock_guard lock(m_streamRegistryMutex);
+    auto [entry, opened] = m_streamRegistry.TryEmplace(streamKey);
+    if (opened) {
+        // first message of a stream the peer opened
+        entry->owned = std::make_unique<Stream>(event.streamID, event.client.ID, event.client.endpoint, *this);
+        entry->stream = entry->owned.get();
+        Stream& stream = *entry->stream;
+
+        for (const auto& handler: onStreamCreatedHandlers) {
+            handler(stream.streamID);
+        }
+        for (const auto& handler: onStreamOpenedHandlers) {
+            handler(stream);
+        }
+        // the handlers may have created or closed streams, the entry may have moved
+        entry = m_streamRegistry.Find(streamKey);
+        if (!entry) {
+            return;
+        }
     }
-    else {
-        std::cerr << "Error: Failed to deserialize message\n";
+    entry->stream->HandleDataReceived(event.message.empty() ? event.data : std::span<const char>(event.message));
+}
+
+void Falcon::handleBundleMessage(const Msg &msg) {
+    std::span<const char> remaining = msg.data.subspan(1);
+    while (!remaining.empty()) {
+        uint64_t size;
+        if (!ReadVarint(remaining, size) || size == 0 || size > remaining.size()) {
+            FALCON_LOG_WARN(LogCategory::Socket, "Malformed bundle from {}", msg.from.ToString());
+            return;
+        }
 
+        Msg inner;
+        inner.from = msg.from;
+        inner.packet = msg.packet;
+        inner.data = remaining.first(size);
+        remaining = remaining.subspan(size);
+
+        // bundles are never nested
+        if (static_cast<uint8_t>(inner.data[0]) != MSG_BUNDLE) {
+            handleMessage(inner);
+        }
     }
 }
 
-void Falcon::handleConnectionMessage(const MsgConn &msg_conn, const std::string& msgIp, int msgPort) {
+void Falcon::handleConnectionMessage(const MsgConn &msg_conn, const Endpoint& from) {
+    const auto now = std::chrono::steady_clock::now();
+
     // check if client exists
-    for (auto& [id,c] : clients) {
-        if (c.IP == msgIp && c.Port == msgPort) {
-            std::cerr << "Client already exists\n";
+    if (clients.FindByEndpoint(from)) {
+        // anyone can send these at line rate, not worth more than a debug line
+        FALCON_LOG_DEBUG(LogCategory::Connection, "Client {} already exists", from.ToString());
+        return;
+    }
+
+    if (m_config.connectionCookies) {
+        const auto timestamp = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count());
+        const bool echoed = msg_conn.cookie != 0 || msg_conn.timestamp != 0;
+        if (echoed && msg_conn.cookie != ConnectionCookie(from, msg_conn.timestamp)) {
+            // never signed for this address, a flood of forged cookies doesn't get a reply per datagram
+            m_connectionCookiesRejected++;
+            FALCON_LOG_DEBUG(LogCategory::Connection, "Invalid cookie from {}", from.ToString());
             return;
         }
+        // unsigned, a timestamp from the future looks older than any lifetime
+        const bool fresh = timestamp - msg_conn.timestamp <= static_cast<uint32_t>(m_config.cookieLifetime.count());
+        if (!echoed || !fresh) {
+            if (echoed) {
+                m_connectionCookiesRejected++;
+                FALCON_LOG_DEBUG(LogCategory::Connection, "Expired cookie from {}", from.ToString());
+            }
+            // nothing is kept, a client echoing a stale cookie gets a fresh one
+            const MsgConn challenge = {MSG_CONN_CHALLENGE, timestamp, ConnectionCookie(from, timestamp)};
+            MessageBuffer<MsgConn> buffer;
+            if (SendHandshake(from, {buffer.data(), SerializeMessage(challenge, buffer)}) < 0) {
+                FALCON_LOG_ERROR(LogCategory::Connection, "Failed to send connection challenge to {}", from.ToString());
+            } else {
+                m_connectionChallenges++;
+            }
+            return;
+        }
+    }
+
+    // charged past the cookie check, a spoofed address can't spend the budget of its prefix
+    if (!m_connectionLimiter.Allow(from, now)) {
+        m_connectionsRateLimited++;
+        FALCON_LOG_DEBUG(LogCategory::Connection, "Connection request from {} over the rate limit", from.ToString());
+        return;
     }
 
     // add client to list
-    uint64_t clientID = nextClientID++;
+    uint64_t clientID = nextClientID;
+    nextClientID += m_config.clientIDStride;
 
-    clients[clientID] = {clientID, msgIp, msgPort,false, std::chrono::steady_clock::now()};
+    Client& client = clients.Add({clientID, from, false, std::chrono::steady_clock::now()});
+    ScheduleClientKeepAlive(client, client.lastPing + m_config.pingInterval);
 
     // send clientID to client
     const MsgConnAck msgConnAck = {MSG_CONN_ACK, clientID};
 
-    int sent = SendTo(msgIp, msgPort, SerializeMessage(msgConnAck));
+    MessageBuffer<MsgConnAck> buffer;
+    int sent = SendHandshake(from, {buffer.data(), SerializeMessage(msgConnAck, buffer)});
 
     if (sent < 0) {
-        std::cerr << "Failed to send connection ack to " << msgIp << ":" << msgPort << "\n";
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to send connection ack to {}", from.ToString());
     } else {
-        std::cout << "Connection ack sent to " << msgIp << ":" << msgPort << "\n";
-        for (const auto& handler: onClientConnectedHandlers) {
-            handler(clientID);
-        }
+        FALCON_LOG_DEBUG(LogCategory::Connection, "Connection ack sent to {}", from.ToString());
+        FalconEvent event;
+        event.type = FalconEvent::Type::ClientConnected;
+        event.client = client;
+        Emit(std::move(event));
+    }
+}
+
+void Falcon::handleConnectionChallengeMessage(const MsgConn &challenge, const Endpoint& from) {
+    // only the server we are connecting to may challenge us, and only once
+    if (from != clientInfoFromServer.endpoint || clientInfoFromServer.ID != 0) {
+        return;
+    }
+    const MsgConn echo = {MSG_CONN, challenge.timestamp, challenge.cookie};
+    MessageBuffer<MsgConn> buffer;
+    if (SendHandshake(from, {buffer.data(), SerializeMessage(echo, buffer)}) < 0) {
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to answer the connection challenge of {}", from.ToString());
     }
 }
 
+std::array<uint64_t, 2> Falcon::NewCookieKey() {
+    std::random_device random;
+    std::array<uint64_t, 2> key{};
+    for (uint64_t& word : key) {
+        word = uint64_t(random()) << 32 | random();
+    }
+    return key;
+}
+
+uint64_t Falcon::ConnectionCookie(const Endpoint& client, uint32_t timestamp) const {
+    // address | port | family | timestamp
+    std::array<uint8_t, 16 + 2 + 1 + 4> input{};
+    std::memcpy(input.data(), client.Address().data(), 16);
+    input[16] = static_cast<uint8_t>(client.Port());
+    input[17] = static_cast<uint8_t>(client.Port() >> 8);
+    input[18] = static_cast<uint8_t>(client.GetFamily());
+    for (size_t i = 0; i < 4; ++i) {
+        input[19 + i] = static_cast<uint8_t>(timestamp >> (8 * i));
+    }
+    return SipHash24(m_cookieKey[0], m_cookieKey[1], input);
+}
+
+int Falcon::SendHandshake(const Endpoint& to, std::span<const char> message) {
+    return m_config.simulation.enabled ? TransmitDatagram(to, message) : SendTo(to, message);
+}
+
 void Falcon::handleConnectionAckMessage(const MsgConnAck &msg_conn_ack) {
     clientInfoFromServer.ID = msg_conn_ack.clientID;
-    for (const auto& handler: onConnectionEventHandlers) {
-        handler(true, msg_conn_ack.clientID);
+    FalconEvent event;
+    event.type = FalconEvent::Type::ConnectionResult;
+    event.success = true;
+    event.client = clientInfoFromServer;
+    Emit(std::move(event));
+}
+
+uint64_t Falcon::PeerID(const Endpoint& from) {
+    if (const Client* client = clients.FindByEndpoint(from)) {
+        return client->ID;
     }
+    return from == clientInfoFromServer.endpoint ? clientInfoFromServer.ID : 0;
 }
 
-void Falcon::handleStandardMessage(const MsgStandard &msg_standard) {
-    std::cout << "From " << msg_standard.clientID << " On Stream " << msg_standard.streamID << "\n";
-    // get the stream
-    auto stream = std::find_if(streams.begin(), streams.end(), [&](const auto& id) {
-        return id == msg_standard.streamID;
-    });
+void Falcon::handleStandardMessage(const MsgStandardView &msg_standard, const Endpoint& from, const PacketHandle& packet) {
+    const uint64_t clientID = PeerID(from);
+    if (clientID == 0) {
+        FALCON_LOG_DEBUG(LogCategory::Stream, "Dropped stream data from unknown endpoint {}", from.ToString());
+        return;
+    }
+    FALCON_LOG_TRACE(LogCategory::Stream, "From {} On Stream {}", clientID, msg_standard.streamID);
+    const uint64_t streamKey = StreamKey(clientID, msg_standard.streamID);
+    const bool reliable = Stream::IsReliable(msg_standard.streamID);
+    bool deliver = true;
+    std::vector<char> message; // the whole message once its last fragment arrived
+    std::vector<ReorderedMessage> released; // ordered stream: waiting messages this one was holding back
+    uint16_t ackID = 0;
+    uint64_t trace = 0;
+    {
+        std::lock_guard lock(m_streamsMutex);
+        StreamState& state = GetStreamState(streamKey);
+        state.counters->packetsReceived.fetch_add(1, std::memory_order_relaxed);
+        state.counters->bytesReceived.fetch_add(msg_standard.data.size(), std::memory_order_relaxed);
+        if (reliable && state.received.IsDuplicate(msg_standard.messageID)) {
+            // our ack was lost, acknowledge it again without delivering twice
+            deliver = false;
+            if (state.received.IsOutOfWindow(msg_standard.messageID)) {
+                state.counters->outOfWindow.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                state.counters->duplicates.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else if (msg_standard.fragmentCount > 0) {
+            const FragmentResult result = AddFragment(streamKey, state, msg_standard, message);
+            if (result == FragmentResult::Rejected) {
+                return; // not acked, a reliable sender will try again
+            }
+            deliver = result == FragmentResult::Complete;
+        }
+        if (deliver && Stream::IsOrdered(msg_standard.streamID)) {
+            const auto first = static_cast<uint16_t>(msg_standard.messageID - msg_standard.fragmentIndex);
+            const uint32_t sequenceCount = std::max<uint32_t>(msg_standard.fragmentCount, 1);
+            if (first != state.nextDelivery) {
+                // an earlier message is missing, only this stream waits for it
+                const std::span<const char> payload = msg_standard.fragmentCount > 0 ? std::span<const char>(message) : msg_standard.data;
+                if (msg_standard.fragmentCount == 0 && state.reorderBytes + payload.size() > m_config.maxReorderBytes) {
+                    state.counters->reorderRejected.fetch_add(1, std::memory_order_relaxed);
+                    return; // not acked, the sender retries once the gap is filled
+                }
+                ReorderedMessage& waiting = state.reorder.Insert(first);
+                waiting.data.assign(payload.begin(), payload.end());
+                waiting.sequenceCount = sequenceCount;
+                waiting.compressed = msg_standard.compressed;
+                state.reorderMessages++;
+                state.reorderBytes += payload.size();
+                state.counters->reordered.fetch_add(1, std::memory_order_relaxed);
+                deliver = false;
+            } else {
+                state.nextDelivery = static_cast<uint16_t>(first + sequenceCount);
+                while (ReorderedMessage* next = state.reorder.Find(state.nextDelivery)) {
+                    const uint16_t sequence = state.nextDelivery;
+                    state.nextDelivery = static_cast<uint16_t>(sequence + next->sequenceCount);
+                    state.reorderMessages--;
+                    state.reorderBytes -= next->data.size();
+                    released.push_back(std::move(*next));
+                    state.reorder.Remove(sequence);
+                }
+            }
+        }
+        if (reliable) {
+            state.received.Record(msg_standard.messageID);
+            ackID = state.received.latestID;
+            trace = state.received.received;
+        }
+    }
 
-    if (stream == streams.end()) {
-        std::cout << "Warning: Stream " << msg_standard.streamID << " does not exist, creating it on local!\n";
-        std::string ip = clients[msg_standard.clientID].IP;
-        int port = clients[msg_standard.clientID].Port;
-        auto newStream = std::make_unique<Stream>(msg_standard.streamID, ip, port, *this);
-        streams.push_back(newStream->streamID);
+    // a complete message, in owned or else still in the received packet
+    const auto emitData = [&](std::vector<char>* owned, bool compressed) {
+        FalconEvent event;
+        event.type = FalconEvent::Type::Data;
+        event.streamID = msg_standard.streamID;
+        event.client.ID = clientID;
+        event.client.endpoint = from;
+        if (compressed) {
+            // still acked below, resending it wouldn't make it readable
+            if (!DecompressPayload(owned ? std::span<const char>(*owned) : msg_standard.data, event.message)) {
+                FALCON_LOG_WARN(LogCategory::Stream, "Dropped undecodable compressed message on stream {}", msg_standard.streamID);
+                return;
+            }
+        } else if (owned) {
+            event.message = std::move(*owned);
+        } else {
+            event.packet = packet;
+            event.data = msg_standard.data;
+        }
+        Emit(std::move(event));
+    };
+    if (deliver) {
+        emitData(msg_standard.fragmentCount > 0 ? &message : nullptr, msg_standard.compressed);
+    }
+    for (ReorderedMessage& waiting : released) {
+        emitData(&waiting.data, waiting.compressed);
+    }
 
-        for (const auto& handler: onStreamCreatedHandlers) {
-            handler(newStream->streamID);
+    if (reliable) {
+        // send ack, the trace acknowledges the whole window in one message
+        const MsgAck msgAck = {MSG_ACK, clientID, msg_standard.streamID, ackID, trace};
+        MessageBuffer<MsgAck> buffer;
+        int sent = SendTo(from, {buffer.data(), SerializeMessage(msgAck, buffer)});
+        if (sent < 0) {
+            FALCON_LOG_ERROR(LogCategory::Reliability, "Failed to send ack");
         }
     }
-    Stream::OnDataReceived(msg_standard.data);
 
-    if (Stream::IsReliable(msg_standard.streamID)) {
-        reliableMessagesReceived[msg_standard.streamID].insert(reliableMessagesReceived[msg_standard.streamID].begin(), msg_standard);
-        if (reliableMessagesReceived[msg_standard.streamID].size() > 64) {
-            reliableMessagesReceived[msg_standard.streamID].pop_back();
+}
+
+void Falcon::handleAckMessage(const MsgAck &msg_ack, const Endpoint& from) {
+    const uint64_t clientID = PeerID(from);
+    if (clientID == 0) {
+        FALCON_LOG_DEBUG(LogCategory::Reliability, "Dropped ack from unknown endpoint {}", from.ToString());
+        return;
+    }
+    FALCON_LOG_TRACE(LogCategory::Reliability, "Ack received from {} on stream {}", clientID, msg_ack.streamID);
+
+    std::array<PacketHandle, RELIABLE_WINDOW> lost;
+    size_t lostCount = 0;
+    std::vector<PacketHandle> backlog;
+    Endpoint peer;
+    {
+        std::lock_guard lock(m_streamsMutex);
+        const auto state = streamStates.find(StreamKey(clientID, msg_ack.streamID));
+        if (state == streamStates.end()) {
+            return;
+        }
+        auto& sent = state->second.sent;
+
+        CongestionController& congestion = Congestion(clientID).controller;
+        const auto now = std::chrono::steady_clock::now();
+
+        // only the newest message gives a sample, older ones may have waited for a lost ack
+        const SentMessage* latest = sent.Find(msg_ack.messageID);
+        if (latest && latest->transmissions == 1 && (msg_ack.trace & RELIABLE_ACK_MASK)) {
+            RttEstimator& rtt = ConnectionRtt(clientID);
+            const auto sample = std::chrono::duration_cast<RttEstimator::Duration>(now - latest->sentTime);
+            rtt.AddSample(sample);
+            congestion.OnRttSample(sample, rtt.SmoothedRtt(), now);
+        }
+
+        // bit 63 - n of the trace acknowledges messageID - n
+        uint64_t bits = msg_ack.trace;
+        while (bits) {
+            const int delta = std::countl_zero(bits);
+            bits &= ~(RELIABLE_ACK_MASK >> delta);
+            const auto messageID = static_cast<uint16_t>(msg_ack.messageID - delta);
+            if (const SentMessage* message = sent.Find(messageID)) {
+                state->second.client->ackLatency.Record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - message->sentTime).count()));
+                m_timers.Cancel(message->retransmitTimer);
+                congestion.OnAcked(message->size, message->sentTime);
+                sent.Remove(messageID);
+            }
         }
 
-        uint64_t trace = GetTrace(msg_standard.streamID, msg_standard.messageID);
+        // a hole with enough newer messages acked past it is most likely lost, don't wait for its timer
+        sent.ForEach([&](uint32_t messageID, SentMessage& message) {
+            const auto delta = static_cast<uint16_t>(msg_ack.messageID - messageID);
+            if (delta == 0 || delta >= RELIABLE_WINDOW || message.fastRetransmitted) {
+                return;
+            }
+            const uint64_t newer = msg_ack.trace & ~(UINT64_MAX >> delta);
+            if (std::popcount(newer) >= FAST_RETRANSMIT_THRESHOLD) {
+                message.fastRetransmitted = true;
+                message.transmissions++;
+                congestion.OnLoss(message.sentTime, now);
+                congestion.OnRetransmit(message.size, now);
+                lost[lostCount++] = message.packet;
+                state->second.counters->retransmissions.fetch_add(1, std::memory_order_relaxed);
+                state->second.counters->packetsSent.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+
+        // acked messages made room in the window, and in the congestion window of the other streams
+        bool wakeNetworkThread = false;
+        PumpBacklog(state->first, state->second, backlog, wakeNetworkThread);
+        peer = state->second.peer;
+        PumpBlockedStreams(clientID, backlog, peer, wakeNetworkThread);
+    }
 
-        // send ack
-        const MsgAck msgAck = {MSG_ACK, msg_standard.clientID, msg_standard.streamID, msg_standard.messageID, trace};
-        int sent = SendTo(clients[msg_standard.clientID].IP, clients[msg_standard.clientID].Port, SerializeMessage(msgAck));
+    for (size_t i = 0; i < lostCount; ++i) {
+        m_fastRetransmissions++;
+        int sent = SendTo(from, lost[i].view());
+        if (sent < 0) {
+            FALCON_LOG_ERROR(LogCategory::Reliability, "Failed to resend lost packet");
+        }
+    }
+    for (const PacketHandle& packet : backlog) {
+        int sent = SendTo(peer, packet.view());
         if (sent < 0) {
-            std::cerr << "Failed to send ack\n";
+            FALCON_LOG_ERROR(LogCategory::Reliability, "Failed to send backlogged packet");
+        }
+    }
+}
+
+Falcon::FragmentResult Falcon::AddFragment(uint64_t streamKey, StreamState &state, const MsgStandardView &fragment, std::vector<char> &message) {
+    const auto firstSequence = static_cast<uint16_t>(fragment.messageID - fragment.fragmentIndex);
+    auto reassembly = std::find_if(state.reassemblies.begin(), state.reassemblies.end(), [&](const Reassembly& r) {
+        return r.firstSequence == firstSequence;
+    });
+
+    if (reassembly == state.reassemblies.end()) {
+        const auto now = std::chrono::steady_clock::now();
+        const bool completed = std::ranges::any_of(state.completedReassemblies, [&](const CompletedReassembly& c) {
+            return c.fragmentCount == fragment.fragmentCount && c.firstSequence == firstSequence && now - c.completed < m_config.reassemblyTimeout;
+        });
+        if (completed) {
+            state.counters->duplicates.fetch_add(1, std::memory_order_relaxed);
+            return FragmentResult::Incomplete;
         }
+
+        const size_t capacity = size_t(fragment.fragmentCount) * fragment.fragmentSize;
+        if (fragment.fragmentCount > MAX_FRAGMENTS || capacity - fragment.fragmentSize >= m_config.maxMessageSize) {
+            FALCON_LOG_WARN(LogCategory::Fragmentation, "Fragmented message of {} fragments is too large", fragment.fragmentCount);
+            return FragmentResult::Rejected;
+        }
+        if (m_reassemblyBytes + capacity > m_config.reassemblyMemoryLimit) {
+            m_reassembliesDropped++;
+            FALCON_LOG_WARN(LogCategory::Fragmentation, "Reassembly memory limit reached, dropping fragment");
+            return FragmentResult::Rejected;
+        }
+
+        Reassembly& added = state.reassemblies.emplace_back();
+        added.firstSequence = firstSequence;
+        added.fragmentCount = fragment.fragmentCount;
+        added.fragmentSize = fragment.fragmentSize;
+        added.data.resize(capacity);
+        added.received.resize(fragment.fragmentCount);
+        added.lastProgress = std::chrono::steady_clock::now();
+        m_reassemblyBytes += capacity;
+        m_timers.Schedule(added.lastProgress + m_config.reassemblyTimeout, [this, streamKey, firstSequence]() {
+            handleReassemblyTimeout(streamKey, firstSequence);
+        });
+        reassembly = std::prev(state.reassemblies.end());
+    } else if (reassembly->fragmentCount != fragment.fragmentCount || reassembly->fragmentSize != fragment.fragmentSize) {
+        return FragmentResult::Rejected;
+    }
+
+    if (reassembly->received[fragment.fragmentIndex]) {
+        return FragmentResult::Incomplete;
+    }
+    std::memcpy(reassembly->data.data() + size_t(fragment.fragmentIndex) * reassembly->fragmentSize, fragment.data.data(), fragment.data.size());
+    reassembly->received[fragment.fragmentIndex] = true;
+    reassembly->fragmentsReceived++;
+    reassembly->lastProgress = std::chrono::steady_clock::now();
+    if (fragment.fragmentIndex == fragment.fragmentCount - 1) {
+        reassembly->lastFragmentSize = fragment.data.size();
+    }
+    if (reassembly->fragmentsReceived < reassembly->fragmentCount) {
+        return FragmentResult::Incomplete;
+    }
+
+    m_reassemblyBytes -= reassembly->data.size();
+    message = std::move(reassembly->data);
+    message.resize(size_t(reassembly->fragmentCount - 1) * reassembly->fragmentSize + reassembly->lastFragmentSize);
+    const CompletedReassembly completed{firstSequence, reassembly->fragmentCount, reassembly->lastProgress};
+    if (state.completedReassemblies.size() < COMPLETED_REASSEMBLIES) {
+        state.completedReassemblies.push_back(completed);
+    } else {
+        state.completedReassemblies[state.nextCompletedReassembly] = completed;
+        state.nextCompletedReassembly = (state.nextCompletedReassembly + 1) % COMPLETED_REASSEMBLIES;
+    }
+    state.reassemblies.erase(reassembly);
+    m_messagesReassembled++;
+    return FragmentResult::Complete;
+}
+
+void Falcon::handleReassemblyTimeout(uint64_t streamKey, uint16_t firstSequence) {
+    std::lock_guard lock(m_streamsMutex);
+    const auto state = streamStates.find(streamKey);
+    if (state == streamStates.end()) {
+        return;
+    }
+    auto& reassemblies = state->second.reassemblies;
+    const auto reassembly = std::find_if(reassemblies.begin(), reassemblies.end(), [&](const Reassembly& r) {
+        return r.firstSequence == firstSequence;
+    });
+    if (reassembly == reassemblies.end()) {
+        return;
+    }
+
+    const auto deadline = reassembly->lastProgress + m_config.reassemblyTimeout;
+    if (std::chrono::steady_clock::now() < deadline) {
+        m_timers.Schedule(deadline, [this, streamKey, firstSequence]() {
+            handleReassemblyTimeout(streamKey, firstSequence);
+        });
+        return;
     }
 
+    FALCON_LOG_DEBUG(LogCategory::Fragmentation, "Dropping incomplete message, {} of {} fragments received", reassembly->fragmentsReceived, reassembly->fragmentCount);
+    m_reassemblyBytes -= reassembly->data.size();
+    reassemblies.erase(reassembly);
+    m_reassembliesDropped++;
 }
 
-void Falcon::handleAckMessage(const MsgAck &msg_ack) {
-    std::cout << "Ack received from " << msg_ack.clientID << " on stream " << msg_ack.streamID << "\n";
-    for (auto& m : reliableMessagesSent[msg_ack.streamID]) {
-        int delta = msg_ack.messageID - m.messageID;
+RttEstimator& Falcon::ConnectionRtt(uint64_t clientID) {
+    return connectionRtt.try_emplace(clientID, m_config.initialRetransmitTimeout, m_config.minRetransmitTimeout,
+        m_config.maxRetransmitTimeout).first->second;
+}
 
-        if (msg_ack.trace & (RELIABLE_ACK_MASK >> delta)) {
-            reliableMessagesSent[msg_ack.streamID].erase(std::remove_if(reliableMessagesSent[msg_ack.streamID].begin(), reliableMessagesSent[msg_ack.streamID].end(), [&](const auto& msg) {
-                return msg.messageID == m.messageID;
-            }), reliableMessagesSent[msg_ack.streamID].end());
+StreamState& Falcon::GetStreamState(uint64_t streamKey) {
+    auto [state, created] = streamStates.try_emplace(streamKey);
+    if (created) {
+        auto& client = clientCounters[streamKey >> 32];
+        if (!client) {
+            client = std::make_shared<ClientCounters>();
         }
+        state->second.client = client;
     }
+    return state->second;
+}
 
-    // resend lost packets
-    for (const auto& m : reliableMessagesSent[msg_ack.streamID]) {
-        int sent = SendTo(clients[msg_ack.clientID].IP, clients[msg_ack.clientID].Port, SerializeMessage(m));
-        if (sent < 0) {
-            std::cerr << "Failed to resend lost packet\n";
+TimerQueue::TimerID Falcon::ScheduleRetransmit(uint64_t streamKey, uint16_t messageID, std::chrono::steady_clock::time_point deadline) {
+    return m_timers.Schedule(deadline, [this, streamKey, messageID]() {
+        handleRetransmitTimeout(streamKey, messageID);
+    });
+}
+
+void Falcon::handleRetransmitTimeout(uint64_t streamKey, uint16_t messageID) {
+    PacketHandle packet;
+    Endpoint to;
+    {
+        std::lock_guard lock(m_streamsMutex);
+        const auto state = streamStates.find(streamKey);
+        if (state == streamStates.end()) {
+            return;
         }
+        SentMessage* message = state->second.sent.Find(messageID);
+        if (!message) {
+            return;
+        }
+
+        RttEstimator& rtt = ConnectionRtt(streamKey >> 32);
+        ConnectionCongestion& congestion = Congestion(streamKey >> 32);
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= congestion.nextBackoff) {
+            rtt.Backoff();
+            congestion.nextBackoff = now + rtt.Timeout();
+        }
+        congestion.controller.OnTimeout(message->sentTime, now);
+        congestion.controller.OnRetransmit(message->size, now);
+        message->transmissions++;
+        message->retransmitTimer = ScheduleRetransmit(streamKey, messageID, now + rtt.Timeout());
+        packet = message->packet;
+        state->second.counters->retransmissions.fetch_add(1, std::memory_order_relaxed);
+        state->second.counters->packetsSent.fetch_add(1, std::memory_order_relaxed);
+        to = message->to;
+    }
+
+    m_retransmissions++;
+    int sent = SendTo(to, packet.view());
+    if (sent < 0) {
+        FALCON_LOG_ERROR(LogCategory::Reliability, "Failed to resend lost packet");
     }
 }
 
-void Falcon::handlePingMessage(const Ping &ping) {
-    std::cout << "Ping " << ping.pingID << "received\n";
-    if (clientInfoFromServer.ID != 0) { // check if we are client
-        std::cout << "Ponging\n";
-        int sent = SendTo(clientInfoFromServer.IP, clientInfoFromServer.Port, SerializeMessage(Ping{PING, clientInfoFromServer.ID, ping.pingID, ping.time}));
-        if (sent < 0) {
-            std::cerr << "Failed to send pong\n";
+void Falcon::ForgetConnection(uint64_t clientID) {
+    std::lock_guard lock(m_streamsMutex);
+    connectionRtt.erase(clientID);
+    clientCounters.erase(clientID);
+    if (const auto congestion = connectionCongestion.find(clientID); congestion != connectionCongestion.end()) {
+        m_timers.Cancel(congestion->second.pacingTimer);
+        connectionCongestion.erase(congestion);
+    }
+    {
+        std::lock_guard schedulerLock(m_schedulerMutex);
+        m_schedulers.erase(clientID);
+    }
+    std::erase_if(streamStates, [&](auto& entry) {
+        if (entry.first >> 32 != clientID) {
+            return false;
+        }
+        entry.second.sent.ForEach([&](uint32_t, const SentMessage& message) {
+            m_timers.Cancel(message.retransmitTimer);
+        });
+        for (const Reassembly& reassembly : entry.second.reassemblies) {
+            m_reassemblyBytes -= reassembly.data.size();
         }
+        return true;
+    });
+}
+
+std::optional<RttEstimator> Falcon::GetRtt(uint64_t clientID) {
+    std::lock_guard lock(m_streamsMutex);
+    const auto it = connectionRtt.find(clientID);
+    if (it == connectionRtt.end() || !it->second.HasSample()) {
+        return std::nullopt;
     }
+    return it->second;
 }
 
-uint64_t Falcon::GetTrace(uint32_t streamID, uint8_t messageID) {
-    uint64_t trace = 0;
-    for (const MsgStandard& m : reliableMessagesReceived[streamID]) {
-        int delta = messageID - m.messageID;
-        if (delta >= 0 && delta < 64) {
-            trace |= RELIABLE_ACK_MASK >> delta;
+std::optional<RttEstimator> Falcon::GetRtt() {
+    return GetRtt(clientInfoFromServer.ID);
+}
+
+void Falcon::handlePingMessage(const Ping &ping, const Endpoint& from) {
+    if (ping.messageType == PONG) {
+        // receiving it already refreshed lastPing, the echoed timestamp gives an RTT sample
+        const uint64_t clientID = PeerID(from);
+        const auto now = std::chrono::steady_clock::now();
+        // the timestamp is whatever the peer sent back, one we can't have sent isn't a sample
+        if (clientID == 0 || ping.time > now || now - ping.time > m_config.timeout) {
+            FALCON_LOG_DEBUG(LogCategory::Connection, "Ignored pong from {}", from.ToString());
+            return;
         }
+        std::lock_guard lock(m_streamsMutex);
+        ConnectionRtt(clientID).AddSample(std::chrono::duration_cast<RttEstimator::Duration>(now - ping.time));
+        return;
     }
-    return trace;
-}
\ No newline at end of file
+    // answer with the same id and timestamp so the sender can measure the round trip
+    const uint64_t ownID = clientInfoFromServer.ID; // 0 on the server
+    MessageBuffer<Ping> pong;
+    const size_t size = SerializeMessage(Ping{PONG, ownID, ping.pingID, ping.time}, pong);
+    int sent = SendTo(from, {pong.data(), size});
+    if (sent < 0) {
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to send pong");
+    }
+}
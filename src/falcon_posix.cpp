@@ -3,204 +3,409 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
 
 #include <memory>
+#include <algorithm>
 #include <fmt/core.h>
 #include "falcon.h"
+#include "log.h"
 #include <thread>
-#include <iostream>
 
 
-std::string IpToString(const sockaddr* sa)
+static Endpoint FromIPv6Normalized(const std::array<uint8_t, 16>& address, uint16_t port, uint32_t scopeID)
 {
-    switch(sa->sa_family)
-    {
+    // dual-stack sockets report IPv4 peers as ::ffff:a.b.c.d, store them as plain IPv4
+    static constexpr uint8_t mappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (std::memcmp(address.data(), mappedPrefix, sizeof(mappedPrefix)) == 0) {
+        return Endpoint::FromIPv4({address[12], address[13], address[14], address[15]}, port);
+    }
+    return Endpoint::FromIPv6(address, port, scopeID);
+}
+
+static Endpoint FromSockaddr(const sockaddr_storage& storage)
+{
+    switch (storage.ss_family) {
     case AF_INET: {
-        char ip[INET_ADDRSTRLEN + 6];
-        const char* ret = inet_ntop(AF_INET,
-            &reinterpret_cast<const sockaddr_in*>(sa)->sin_addr,
-            ip,
-            INET_ADDRSTRLEN);
-        return fmt::format("{}:{}", ret, ntohs(reinterpret_cast<const sockaddr_in*>(sa)->sin_port));
+        const auto& sin = reinterpret_cast<const sockaddr_in&>(storage);
+        std::array<uint8_t, 4> address;
+        std::memcpy(address.data(), &sin.sin_addr, address.size());
+        return Endpoint::FromIPv4(address, ntohs(sin.sin_port));
     }
     case AF_INET6: {
-        char ip[INET6_ADDRSTRLEN + 8];
-        const char* ret = inet_ntop(AF_INET6,
-            &reinterpret_cast<const sockaddr_in6*>(sa)->sin6_addr,
-            ip+ 1,
-            INET6_ADDRSTRLEN);
-        return fmt::format("[{}]:{}", ret, ntohs(reinterpret_cast<const sockaddr_in6*>(sa)->sin6_port));
+        const auto& sin6 = reinterpret_cast<const sockaddr_in6&>(storage);
+        std::array<uint8_t, 16> address;
+        std::memcpy(address.data(), &sin6.sin6_addr, address.size());
+        return FromIPv6Normalized(address, ntohs(sin6.sin6_port), sin6.sin6_scope_id);
     }
+    default:
+        return {};
     }
-
-    return "";
 }
 
-sockaddr StringToIp(const std::string& ip, uint16_t port)
+// Fills storage for a socket of the given family, IPv4 endpoints are mapped when the socket is IPv6
+static socklen_t ToSockaddr(const Endpoint& endpoint, Endpoint::Family socketFamily, sockaddr_storage& storage)
 {
-    sockaddr result {};
-    int error = inet_pton(AF_INET, ip.c_str(), &result);
-    if (error == 1) {
-        result.sa_family = AF_INET;
+    std::memset(&storage, 0, sizeof(storage));
+    if (endpoint.GetFamily() == Endpoint::Family::IPv4 && socketFamily != Endpoint::Family::IPv6) {
+        auto& sin = reinterpret_cast<sockaddr_in&>(storage);
+        sin.sin_family = AF_INET;
 #ifndef __linux__
-        result.sa_len = sizeof(sockaddr_in);
+        sin.sin_len = sizeof(sockaddr_in);
 #endif
-        reinterpret_cast<sockaddr_in*>(&result)->sin_port = htons(port);
-        return result;
+        sin.sin_port = htons(endpoint.Port());
+        std::memcpy(&sin.sin_addr, endpoint.Address().data(), 4);
+        return sizeof(sockaddr_in);
     }
 
-    memset(&result, 0, sizeof(result));
-    error = inet_pton(AF_INET6, ip.c_str(), &result);
-    if (error == 1) {
-        result.sa_family = AF_INET6;
+    auto& sin6 = reinterpret_cast<sockaddr_in6&>(storage);
+    sin6.sin6_family = AF_INET6;
 #ifndef __linux__
-        result.sa_len = sizeof(sockaddr_in6);
+    sin6.sin6_len = sizeof(sockaddr_in6);
 #endif
-        reinterpret_cast<sockaddr_in6*>(&result)->sin6_port = htons(port);
-        return result;
+    sin6.sin6_port = htons(endpoint.Port());
+    if (endpoint.GetFamily() == Endpoint::Family::IPv4) {
+        uint8_t* bytes = reinterpret_cast<uint8_t*>(&sin6.sin6_addr);
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        std::memcpy(bytes + 12, endpoint.Address().data(), 4);
+    } else {
+        std::memcpy(&sin6.sin6_addr, endpoint.Address().data(), 16);
+        sin6.sin6_scope_id = endpoint.ScopeID();
+    }
+    return sizeof(sockaddr_in6);
+}
+
+Endpoint Endpoint::Parse(const std::string& ip, uint16_t port)
+{
+    std::array<uint8_t, 4> v4;
+    if (inet_pton(AF_INET, ip.c_str(), v4.data()) == 1) {
+        return FromIPv4(v4, port);
+    }
+    std::array<uint8_t, 16> v6;
+    if (inet_pton(AF_INET6, ip.c_str(), v6.data()) == 1) {
+        return FromIPv6Normalized(v6, port, 0);
+    }
+    return {};
+}
+
+std::string Endpoint::Ip() const
+{
+    char ip[INET6_ADDRSTRLEN] = {};
+    switch (family) {
+    case Family::IPv4:
+        inet_ntop(AF_INET, address.data(), ip, sizeof(ip));
+        break;
+    case Family::IPv6:
+        inet_ntop(AF_INET6, address.data(), ip, sizeof(ip));
+        break;
+    default:
+        break;
+    }
+    return ip;
+}
+
+std::string Endpoint::ToString() const
+{
+    if (family == Family::IPv6) {
+        return fmt::format("[{}]:{}", Ip(), port);
     }
-    memset(&result, 0, sizeof(result));
-    return result;
+    return fmt::format("{}:{}", Ip(), port);
 }
 
+#ifdef __linux__
+struct Falcon::Reactor {
+    int epollFd = -1;
+    int wakeFd = -1; // eventfd used to interrupt epoll_wait on shutdown
+
+    // pooled buffers armed for the next recvmmsg, a slot is re-armed once its packet is handed out
+    std::vector<PacketHandle> armed;
+    std::vector<sockaddr_storage> peers;
+    std::vector<iovec> receiveIovecs;
+    std::vector<mmsghdr> receiveHeaders;
+
+    std::vector<sockaddr_storage> destinations;
+    std::vector<iovec> sendIovecs;
+    std::vector<mmsghdr> sendHeaders;
+
+    ~Reactor() {
+        if (wakeFd >= 0) close(wakeFd);
+        if (epollFd >= 0) close(epollFd);
+    }
+};
+#else
+struct Falcon::Reactor {
+    int wakePipe[2] = {-1, -1}; // self-pipe used to interrupt poll on shutdown
+
+
+    ~Reactor() {
+        if (wakePipe[0] >= 0) close(wakePipe[0]);
+        if (wakePipe[1] >= 0) close(wakePipe[1]);
+    }
+};
+#endif
+
 Falcon::Falcon() {
 
 }
 
+Falcon::Falcon(const FalconConfig& config) : m_config(config) {
+
+}
+
 Falcon::~Falcon() {
     m_running = false;
+    WakeReactor();
     if (m_thread.joinable()) {
         m_thread.join();
     }
+    {
+        // the application's streams may outlive us, they must no longer unregister and those doing it must be done
+        std::unique_lock lock(m_lifetime->mutex);
+        m_lifetime->falcon = nullptr;
+        m_lifetime->unpinned.wait(lock, [this]() { return m_lifetime->pins == 0; });
+    }
+    // destroy the streams peers opened before the members their handlers may use
+    ReleaseStreams();
     if(m_socket > 0)
     {
         close(m_socket);
     }
 }
 
-std::unique_ptr<Falcon> Falcon::ListenInternal(const std::string& endpoint, uint16_t port)
+bool Falcon::InitReactor()
+{
+    auto reactor = std::make_unique<Reactor>();
+
+    const size_t batch = std::max<uint32_t>(m_config.ioBatchSize, 1);
+    m_receiveBatch.resize(batch);
+#ifdef __linux__
+    reactor->armed.resize(batch);
+    reactor->peers.resize(batch);
+    reactor->receiveIovecs.resize(batch);
+    reactor->receiveHeaders.resize(batch);
+    for (size_t i = 0; i < batch; ++i) {
+        reactor->receiveHeaders[i] = {};
+        reactor->receiveHeaders[i].msg_hdr.msg_name = &reactor->peers[i];
+        reactor->receiveHeaders[i].msg_hdr.msg_iov = &reactor->receiveIovecs[i];
+        reactor->receiveHeaders[i].msg_hdr.msg_iovlen = 1;
+    }
+    reactor->destinations.resize(batch);
+    reactor->sendIovecs.resize(batch);
+    reactor->sendHeaders.resize(batch);
+
+    reactor->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    reactor->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->epollFd < 0 || reactor->wakeFd < 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to create epoll instance");
+        return false;
+    }
+
+    epoll_event socketEvent{};
+    socketEvent.events = EPOLLIN;
+    socketEvent.data.fd = m_socket;
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = reactor->wakeFd;
+    if (epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, m_socket, &socketEvent) != 0 ||
+        epoll_ctl(reactor->epollFd, EPOLL_CTL_ADD, reactor->wakeFd, &wakeEvent) != 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to register socket with epoll");
+        return false;
+    }
+#else
+    if (pipe(reactor->wakePipe) != 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to create wake pipe");
+        return false;
+    }
+    fcntl(reactor->wakePipe[0], F_SETFL, fcntl(reactor->wakePipe[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(reactor->wakePipe[1], F_SETFL, fcntl(reactor->wakePipe[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+    m_reactor = std::move(reactor);
+    return true;
+}
+
+bool Falcon::WaitForEvents(std::chrono::steady_clock::time_point deadline)
+{
+    // round up so we never wake a fraction of a millisecond early and spin until the deadline
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    const int timeout = static_cast<int>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+
+#ifdef __linux__
+    epoll_event events[2];
+    const int count = epoll_wait(m_reactor->epollFd, events, 2, timeout);
+
+    bool readable = false;
+    for (int i = 0; i < count; ++i) {
+        if (events[i].data.fd == m_reactor->wakeFd) {
+            uint64_t value;
+            while (read(m_reactor->wakeFd, &value, sizeof(value)) > 0) {}
+        } else {
+            readable = true;
+        }
+    }
+    return readable;
+#else
+    pollfd fds[2] = {{m_socket, POLLIN, 0}, {m_reactor->wakePipe[0], POLLIN, 0}};
+    if (poll(fds, 2, timeout) <= 0) {
+        return false;
+    }
+    if (fds[1].revents & POLLIN) {
+        char drain[64];
+        while (read(m_reactor->wakePipe[0], drain, sizeof(drain)) > 0) {}
+    }
+    return fds[0].revents & POLLIN;
+#endif
+}
+
+void Falcon::WakeReactor()
+{
+    if (!m_reactor) {
+        return;
+    }
+#ifdef __linux__
+    const uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(m_reactor->wakeFd, &one, sizeof(one));
+#else
+    const char one = 1;
+    [[maybe_unused]] ssize_t written = write(m_reactor->wakePipe[1], &one, sizeof(one));
+#endif
+}
+
+std::unique_ptr<Falcon> Falcon::ListenInternal(const std::string& endpoint, uint16_t port, const FalconConfig& config)
 {
-    sockaddr local_endpoint = StringToIp(endpoint, port);
-    auto falcon = std::make_unique<Falcon>();
-    falcon->m_socket = socket(local_endpoint.sa_family,
+    const Endpoint localEndpoint = Endpoint::Parse(endpoint, port);
+    if (!localEndpoint.IsValid()) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Invalid listen address {}", endpoint);
+        return nullptr;
+    }
+    sockaddr_storage local_endpoint;
+    const socklen_t local_endpoint_len = ToSockaddr(localEndpoint, localEndpoint.GetFamily(), local_endpoint);
+
+    auto falcon = std::make_unique<Falcon>(config);
+    falcon->m_socketFamily = localEndpoint.GetFamily();
+    falcon->m_socket = socket(local_endpoint.ss_family,
         SOCK_DGRAM,
         IPPROTO_UDP);
+    if (falcon->m_socket < 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Socket creation failed");
+        return nullptr;
+    }
+
+    if (falcon->m_socketFamily == Endpoint::Family::IPv6) {
+        // accept IPv4 clients too, they show up as IPv4-mapped addresses
+        int v6only = 0;
+        setsockopt(falcon->m_socket, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+    }
+
+    if (config.reusePort) {
+        // every shard binds the same port, the kernel spreads clients over them by hashing their address
+        int reuse = 1;
+        if (setsockopt(falcon->m_socket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) != 0) {
+            FALCON_LOG_ERROR(LogCategory::Socket, "Failed to enable SO_REUSEPORT");
+            close(falcon->m_socket);
+            return nullptr;
+        }
+    }
 
     int flags = fcntl(falcon->m_socket, F_GETFL, 0);
     if (flags == -1) {
-        std::cerr << "Failed to get socket flags" << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to get socket flags");
         close(falcon->m_socket);
         return nullptr;
     }
     if (fcntl(falcon->m_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
-        std::cerr << "Failed to set non-blocking mode" << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to set non-blocking mode");
         close(falcon->m_socket);
         return nullptr;
     }
 
-    if (int error = bind(falcon->m_socket, &local_endpoint, sizeof(local_endpoint)); error != 0)
+    if (int error = bind(falcon->m_socket, reinterpret_cast<const sockaddr*>(&local_endpoint), local_endpoint_len); error != 0)
     {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Socket bind failed: {}", strerror(errno));
         close(falcon->m_socket);
         return nullptr;
     }
 
+    FALCON_LOG_INFO(LogCategory::Socket, "Server is listening on {}:{}", endpoint, port);
     return falcon;
 }
 
 void Falcon::ConnectTo(const std::string& serverIp, uint16_t port)
 {
+    const Endpoint server = Endpoint::Parse(serverIp, port);
+    if (!server.IsValid()) {
+        throw std::runtime_error("Invalid server address");
+    }
+
     // Create the socket
-    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    m_socketFamily = server.GetFamily();
+    m_socket = socket(m_socketFamily == Endpoint::Family::IPv6 ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (m_socket < 0) {
         throw std::runtime_error("Socket creation failed");
     }
 
     int flags = fcntl(m_socket, F_GETFL, 0);
     if (flags == -1) {
-        std::cerr << "Failed to get socket flags" << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to get socket flags");
         close(m_socket);
         return;
     }
     if (fcntl(m_socket, F_SETFL, flags | O_NONBLOCK) == -1) {
-        std::cerr << "Failed to set non-blocking mode" << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to set non-blocking mode");
         close(m_socket);
         return;
     }
 
-    // Configure the server address
-    sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    inet_pton(AF_INET, serverIp.c_str(), &serverAddr.sin_addr);
-
-    int sent = SendToInternal(serverIp, port, SerializeMessage(MsgConn{MSG_CONN}));
+    MessageBuffer<MsgConn> conn;
+    int sent = SendToInternal(server, {conn.data(), SerializeMessage(MsgConn{MSG_CONN, 0, 0}, conn)});
 
     if (sent < 0) {
-        std::cout << "Failed to send connection request to " << serverIp << ":" << port << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to send connection request to {}:{}", serverIp, port);
     }
     else {
-        // std::cout << "Connection request sent to " << serverIp << ":" << port << std::endl;
+        FALCON_LOG_DEBUG(LogCategory::Connection, "Connection request sent to {}:{}", serverIp, port);
 
-        clientInfoFromServer.IP = serverIp;
-        clientInfoFromServer.Port = port;
+        clientInfoFromServer.endpoint = server;
         clientInfoFromServer.lastPing = std::chrono::steady_clock::now();
     }
 
-    // client thread to handle messages
-    m_thread = std::thread([this]() {
-        while (m_running) {
-            std::string serverIp;
-            std::vector<char> buffer(65535);
-
-            int received = ReceiveFrom(serverIp, std::span<char, 65535>(buffer.data(), buffer.size()));
-
-            if (received < 0) {
-                // std::cerr << "Failed to receive message\n";
-            }
-            if (received > 0) {
-                auto [IP, port] = portFromIp(serverIp);
-
-                Msg msg;
-                msg.IP = IP;
-                msg.Port = port;
-                msg.data = std::vector<char>(buffer.begin(), buffer.end());
+    if (!InitReactor()) {
+        close(m_socket);
+        throw std::runtime_error("Reactor creation failed");
+    }
 
-                clientInfoFromServer.lastPing = std::chrono::steady_clock::now();
-                handleMessage(msg);
-            }
+    // the keep-alive timer reports the connection failure if the server never answers
+    ScheduleServerKeepAlive(clientInfoFromServer.lastPing + m_config.connectTimeout);
+    ScheduleStatsDump();
 
-            if (clientInfoFromServer.lastPing + std::chrono::seconds(1) < std::chrono::steady_clock::now()) {
-                if (clientInfoFromServer.ID == 0) {
-                    std::cerr << "Failed to connect to server\n";
-                    for (const auto& handler: onConnectionEventHandlers) {
-                        handler(false, 0);
-                    }
-                    break;
-                } else {
-                    std::cerr << "Server disconnected\n";
-                    for (const auto& handler: onDisconnectHandlers) {
-                        handler();
-                    }
-                    break;
-                }
-            }
-        }
+    // client thread to handle messages
+    m_thread = std::thread([this]() {
+        RunNetworkLoop();
     });
 }
 
-int Falcon::SendToInternal(const std::string &to, uint16_t port, std::span<const char> message)
+int Falcon::SendToInternal(const Endpoint &to, std::span<const char> message)
 {
-    const sockaddr destination = StringToIp(to, port);
+    sockaddr_storage destination;
+    const socklen_t destination_len = ToSockaddr(to, m_socketFamily, destination);
     int error = sendto(m_socket,
         message.data(),
         message.size(),
         0,
-        &destination,
-        sizeof(destination));
+        reinterpret_cast<const sockaddr*>(&destination),
+        destination_len);
     return error;
 }
 
-int Falcon::ReceiveFromInternal(std::string &from, std::span<char, 65535> message)
+int Falcon::ReceiveFromInternal(Endpoint &from, std::span<char, 65535> message)
 {
     sockaddr_storage peer_addr{};
     socklen_t peer_addr_len = sizeof( sockaddr_storage);
@@ -211,7 +416,7 @@ int Falcon::ReceiveFromInternal(std::string &from, std::span<char, 65535> messag
         reinterpret_cast<sockaddr*>(&peer_addr),
         &peer_addr_len);
 
-    from = IpToString(reinterpret_cast<const sockaddr*>(&peer_addr));
+    from = FromSockaddr(peer_addr);
 
     if (read_bytes < 0) {
         // std::cerr << "Failed to receive data. Error: " << WSAGetLastError() << std::endl;
@@ -219,3 +424,128 @@ int Falcon::ReceiveFromInternal(std::string &from, std::span<char, 65535> messag
 
     return read_bytes;
 }
+
+int Falcon::ReceiveBatchInternal(std::span<Datagram> out)
+{
+    const unsigned int count = static_cast<unsigned int>(out.size());
+#ifdef __linux__
+    unsigned int armed = 0;
+    for (; armed < count; ++armed) {
+        PacketHandle& slot = m_reactor->armed[armed];
+        if (!slot) {
+            slot = m_packetPool.Acquire();
+            if (!slot) {
+                break;
+            }
+        }
+        m_reactor->receiveIovecs[armed] = {slot.data(), slot.capacity()};
+        m_reactor->receiveHeaders[armed].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+    }
+    if (armed == 0) {
+        // every buffer is held by the application, discard the datagram rather than spin on it
+        if (recv(m_socket, nullptr, 0, MSG_DONTWAIT) >= 0) {
+            m_datagramsDropped++;
+        }
+        return 0;
+    }
+
+    const int received = recvmmsg(m_socket, m_reactor->receiveHeaders.data(), armed, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+        // nothing pending is not an error, same as the other backends
+        return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+    }
+    for (int i = 0; i < received; ++i) {
+        if (m_reactor->receiveHeaders[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            // leave the slot armed, the caller skips entries without a packet
+            m_datagramsDropped++;
+            out[i].packet = {};
+            continue;
+        }
+        out[i].from = FromSockaddr(m_reactor->peers[i]);
+        out[i].packet = std::move(m_reactor->armed[i]);
+        out[i].packet.SetSize(m_reactor->receiveHeaders[i].msg_len);
+    }
+    return received;
+#else
+    int received = 0;
+    bool failed = false;
+    while (received < static_cast<int>(count)) {
+        PacketHandle packet = m_packetPool.Acquire();
+        if (!packet) {
+            if (recv(m_socket, nullptr, 0, MSG_DONTWAIT) >= 0) {
+                m_datagramsDropped++;
+            }
+            break;
+        }
+
+        sockaddr_storage peer_addr{};
+        iovec iov{packet.data(), packet.capacity()};
+        msghdr header{};
+        header.msg_name = &peer_addr;
+        header.msg_namelen = sizeof(sockaddr_storage);
+        header.msg_iov = &iov;
+        header.msg_iovlen = 1;
+        const ssize_t read_bytes = recvmsg(m_socket, &header, MSG_DONTWAIT);
+        if (read_bytes < 0) {
+            // nothing pending is not an error, same as the other backends
+            failed = errno != EAGAIN && errno != EWOULDBLOCK;
+            break;
+        }
+        if (header.msg_flags & MSG_TRUNC) {
+            m_datagramsDropped++;
+            continue;
+        }
+        packet.SetSize(static_cast<size_t>(read_bytes));
+        out[received].from = FromSockaddr(peer_addr);
+        out[received].packet = std::move(packet);
+        ++received;
+    }
+    return received == 0 && failed ? -1 : received;
+#endif
+}
+
+int Falcon::SendBatchInternal(std::span<const QueuedDatagram> datagrams, const char* data)
+{
+    int sentTotal = 0;
+#ifdef __linux__
+    const size_t batch = m_reactor->sendHeaders.size();
+    for (size_t start = 0; start < datagrams.size(); start += batch) {
+        const size_t count = std::min(batch, datagrams.size() - start);
+        for (size_t i = 0; i < count; ++i) {
+            const QueuedDatagram& datagram = datagrams[start + i];
+            const socklen_t destination_len = ToSockaddr(datagram.to, m_socketFamily, m_reactor->destinations[i]);
+            m_reactor->sendIovecs[i] = {const_cast<char*>(data + datagram.offset), datagram.size};
+            m_reactor->sendHeaders[i] = {};
+            m_reactor->sendHeaders[i].msg_hdr.msg_name = &m_reactor->destinations[i];
+            m_reactor->sendHeaders[i].msg_hdr.msg_namelen = destination_len;
+            m_reactor->sendHeaders[i].msg_hdr.msg_iov = &m_reactor->sendIovecs[i];
+            m_reactor->sendHeaders[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        size_t done = 0;
+        while (done < count) {
+            const int sent = sendmmsg(m_socket, m_reactor->sendHeaders.data() + done, count - done, 0);
+            if (sent <= 0) {
+                // drop the datagram the kernel refused, like a failed sendto would
+                ++done;
+                continue;
+            }
+            m_sendCalls++;
+            m_datagramsSent += sent;
+            RecordBatch(m_maxSendBatch, sent);
+            done += sent;
+            sentTotal += sent;
+        }
+    }
+#else
+    for (const QueuedDatagram& datagram : datagrams) {
+        if (SendToInternal(datagram.to, {data + datagram.offset, datagram.size}) >= 0) {
+            m_sendCalls++;
+            m_datagramsSent++;
+            RecordBatch(m_maxSendBatch, 1);
+            ++sentTotal;
+        }
+    }
+#endif
+    return sentTotal;
+}
@@ -12,10 +12,13 @@
 
 #pragma comment(lib, "Ws2_32.lib")
 
-#include <iostream>
 #include <thread>
+#include <algorithm>
+#include <array>
+#include <cstring>
 
 #include "falcon.h"
+#include "log.h"
 
 struct WinSockInitializer
 {
@@ -34,192 +37,299 @@ struct WinSockInitializer
     }
 };
 
-std::string IpToString(const sockaddr* sa)
+static Endpoint FromIPv6Normalized(const std::array<uint8_t, 16>& address, uint16_t port, uint32_t scopeID)
 {
-    switch(sa->sa_family)
-    {
+    // dual-stack sockets report IPv4 peers as ::ffff:a.b.c.d, store them as plain IPv4
+    static constexpr uint8_t mappedPrefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    if (std::memcmp(address.data(), mappedPrefix, sizeof(mappedPrefix)) == 0) {
+        return Endpoint::FromIPv4({address[12], address[13], address[14], address[15]}, port);
+    }
+    return Endpoint::FromIPv6(address, port, scopeID);
+}
+
+static Endpoint FromSockaddr(const sockaddr_storage& storage)
+{
+    switch (storage.ss_family) {
         case AF_INET: {
-            char ip[INET_ADDRSTRLEN + 6];
-            const char* ret = inet_ntop(AF_INET,
-                &reinterpret_cast<const sockaddr_in*>(sa)->sin_addr,
-                ip,
-                INET_ADDRSTRLEN);
-            return fmt::format("{}:{}", ret, ntohs(reinterpret_cast<const sockaddr_in*>(sa)->sin_port));
+            const auto& sin = reinterpret_cast<const sockaddr_in&>(storage);
+            std::array<uint8_t, 4> address;
+            std::memcpy(address.data(), &sin.sin_addr, address.size());
+            return Endpoint::FromIPv4(address, ntohs(sin.sin_port));
         }
         case AF_INET6: {
-            char ip[INET6_ADDRSTRLEN + 8];
-            const char* ret = inet_ntop(AF_INET6,
-                &reinterpret_cast<const sockaddr_in6*>(sa)->sin6_addr,
-                ip+ 1,
-                INET6_ADDRSTRLEN);
-            return fmt::format("[{}]:{}", ret, ntohs(reinterpret_cast<const sockaddr_in6*>(sa)->sin6_port));
+            const auto& sin6 = reinterpret_cast<const sockaddr_in6&>(storage);
+            std::array<uint8_t, 16> address;
+            std::memcpy(address.data(), &sin6.sin6_addr, address.size());
+            return FromIPv6Normalized(address, ntohs(sin6.sin6_port), sin6.sin6_scope_id);
         }
+        default:
+            return {};
     }
+}
 
-    return "";
+// Fills storage for a socket of the given family, IPv4 endpoints are mapped when the socket is IPv6
+static int ToSockaddr(const Endpoint& endpoint, Endpoint::Family socketFamily, sockaddr_storage& storage)
+{
+    memset(&storage, 0, sizeof(storage));
+    if (endpoint.GetFamily() == Endpoint::Family::IPv4 && socketFamily != Endpoint::Family::IPv6) {
+        auto& sin = reinterpret_cast<sockaddr_in&>(storage);
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons(endpoint.Port());
+        std::memcpy(&sin.sin_addr, endpoint.Address().data(), 4);
+        return sizeof(sockaddr_in);
+    }
+
+    auto& sin6 = reinterpret_cast<sockaddr_in6&>(storage);
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(endpoint.Port());
+    if (endpoint.GetFamily() == Endpoint::Family::IPv4) {
+        auto* bytes = reinterpret_cast<uint8_t*>(&sin6.sin6_addr);
+        bytes[10] = 0xff;
+        bytes[11] = 0xff;
+        std::memcpy(bytes + 12, endpoint.Address().data(), 4);
+    } else {
+        std::memcpy(&sin6.sin6_addr, endpoint.Address().data(), 16);
+        sin6.sin6_scope_id = endpoint.ScopeID();
+    }
+    return sizeof(sockaddr_in6);
 }
 
-sockaddr StringToIp(const std::string& ip, uint16_t port)
+Endpoint Endpoint::Parse(const std::string& ip, uint16_t port)
 {
-    sockaddr result {};
-    int error = inet_pton(AF_INET, ip.c_str(), &reinterpret_cast<sockaddr_in*>(&result)->sin_addr);
-    if (error == 1) {
-        result.sa_family = AF_INET;
-        reinterpret_cast<sockaddr_in*>(&result)->sin_port = htons(port);
-        return result;
+    std::array<uint8_t, 4> v4;
+    if (inet_pton(AF_INET, ip.c_str(), v4.data()) == 1) {
+        return FromIPv4(v4, port);
+    }
+    std::array<uint8_t, 16> v6;
+    if (inet_pton(AF_INET6, ip.c_str(), v6.data()) == 1) {
+        return FromIPv6Normalized(v6, port, 0);
     }
+    return {};
+}
+
+std::string Endpoint::Ip() const
+{
+    char ip[INET6_ADDRSTRLEN] = {};
+    switch (family) {
+        case Family::IPv4:
+            inet_ntop(AF_INET, address.data(), ip, sizeof(ip));
+            break;
+        case Family::IPv6:
+            inet_ntop(AF_INET6, address.data(), ip, sizeof(ip));
+            break;
+        default:
+            break;
+    }
+    return ip;
+}
 
-    memset(&result, 0, sizeof(result));
-    error = inet_pton(AF_INET6, ip.c_str(), &reinterpret_cast<sockaddr_in6*>(&result)->sin6_addr);
-    if (error == 1) {
-        result.sa_family = AF_INET6;
-        reinterpret_cast<sockaddr_in6*>(&result)->sin6_port = htons(port);
-        return result;
+std::string Endpoint::ToString() const
+{
+    if (family == Family::IPv6) {
+        return fmt::format("[{}]:{}", Ip(), port);
     }
-    memset(&result, 0, sizeof(result));
-    return result;
+    return fmt::format("{}:{}", Ip(), port);
 }
 
+struct Falcon::Reactor {
+    WSAEVENT socketEvent = WSA_INVALID_EVENT;
+    WSAEVENT wakeEvent = WSA_INVALID_EVENT; // signaled to interrupt the wait on shutdown
+
+    ~Reactor() {
+        if (socketEvent != WSA_INVALID_EVENT) WSACloseEvent(socketEvent);
+        if (wakeEvent != WSA_INVALID_EVENT) WSACloseEvent(wakeEvent);
+    }
+};
+
 Falcon::Falcon()
 {
     static WinSockInitializer winsockInitializer{};
 }
 
+Falcon::Falcon(const FalconConfig& config) : m_config(config)
+{
+    static WinSockInitializer winsockInitializer{};
+}
+
 Falcon::~Falcon() {
     m_running = false;
+    WakeReactor();
     if (m_thread.joinable()) {
         m_thread.join();
     }
+    {
+        // the application's streams may outlive us, they must no longer unregister and those doing it must be done
+        std::unique_lock lock(m_lifetime->mutex);
+        m_lifetime->falcon = nullptr;
+        m_lifetime->unpinned.wait(lock, [this]() { return m_lifetime->pins == 0; });
+    }
+    // destroy the streams peers opened before the members their handlers may use
+    ReleaseStreams();
 
     if(m_socket != INVALID_SOCKET)
     {
         closesocket(m_socket);
-        std::cout << "Socket closed" << std::endl;
+        FALCON_LOG_DEBUG(LogCategory::Socket, "Socket closed");
+    }
+}
+
+bool Falcon::InitReactor()
+{
+    auto reactor = std::make_unique<Reactor>();
+
+    const size_t batch = std::max<uint32_t>(m_config.ioBatchSize, 1);
+    m_receiveBatch.resize(batch);
+
+    reactor->socketEvent = WSACreateEvent();
+    reactor->wakeEvent = WSACreateEvent();
+    if (reactor->socketEvent == WSA_INVALID_EVENT || reactor->wakeEvent == WSA_INVALID_EVENT) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to create reactor events with error: {}", WSAGetLastError());
+        return false;
+    }
+    if (WSAEventSelect(m_socket, reactor->socketEvent, FD_READ) != 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to select socket events with error: {}", WSAGetLastError());
+        return false;
+    }
+    m_reactor = std::move(reactor);
+    return true;
+}
+
+bool Falcon::WaitForEvents(std::chrono::steady_clock::time_point deadline)
+{
+    // round up so we never wake a fraction of a millisecond early and spin until the deadline
+    const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    const DWORD timeout = static_cast<DWORD>(std::max<std::chrono::milliseconds::rep>(remaining.count(), 0));
+
+    WSAEVENT events[2] = {m_reactor->socketEvent, m_reactor->wakeEvent};
+    const DWORD result = WSAWaitForMultipleEvents(2, events, FALSE, timeout, FALSE);
+
+    if (result == WSA_WAIT_EVENT_0) {
+        WSANETWORKEVENTS networkEvents;
+        WSAEnumNetworkEvents(m_socket, m_reactor->socketEvent, &networkEvents); // also resets the event
+        return true;
+    }
+    if (result == WSA_WAIT_EVENT_0 + 1) {
+        WSAResetEvent(m_reactor->wakeEvent);
+    }
+    return false;
+}
+
+void Falcon::WakeReactor()
+{
+    if (m_reactor) {
+        WSASetEvent(m_reactor->wakeEvent);
     }
 }
 
-std::unique_ptr<Falcon> Falcon::ListenInternal(const std::string& endpoint, uint16_t port) {
-    sockaddr local_endpoint = StringToIp(endpoint, port);
+std::unique_ptr<Falcon> Falcon::ListenInternal(const std::string& endpoint, uint16_t port, const FalconConfig& config) {
+    if (config.reusePort) {
+        // Windows has no SO_REUSEPORT load balancing, several sockets on one port would not share the clients
+        FALCON_LOG_ERROR(LogCategory::Socket, "Sharded listening is not supported on Windows");
+        return nullptr;
+    }
+    const Endpoint localEndpoint = Endpoint::Parse(endpoint, port);
+    if (!localEndpoint.IsValid()) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Invalid listen address {}", endpoint);
+        return nullptr;
+    }
+    sockaddr_storage local_endpoint;
+    const int local_endpoint_len = ToSockaddr(localEndpoint, localEndpoint.GetFamily(), local_endpoint);
 
-    auto falcon = std::make_unique<Falcon>();
-    falcon->m_socket = socket(local_endpoint.sa_family, SOCK_DGRAM, IPPROTO_UDP);
+    auto falcon = std::make_unique<Falcon>(config);
+    falcon->m_socketFamily = localEndpoint.GetFamily();
+    falcon->m_socket = socket(local_endpoint.ss_family, SOCK_DGRAM, IPPROTO_UDP);
     if (falcon->m_socket == INVALID_SOCKET) {
-        std::cerr << "Socket creation failed with error: " << WSAGetLastError() << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Socket creation failed with error: {}", WSAGetLastError());
         return nullptr;
     }
 
+    if (falcon->m_socketFamily == Endpoint::Family::IPv6) {
+        // accept IPv4 clients too, they show up as IPv4-mapped addresses
+        DWORD v6only = 0;
+        setsockopt(falcon->m_socket, IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char*>(&v6only), sizeof(v6only));
+    }
+
     u_long mode = 1;
     if (ioctlsocket(falcon->m_socket, FIONBIO, &mode) != NO_ERROR) {
-        std::cerr << "Failed to set non-blocking mode with error: " << WSAGetLastError() << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to set non-blocking mode with error: {}", WSAGetLastError());
         closesocket(falcon->m_socket);
         return nullptr;
     }
 
-    if (int error = bind(falcon->m_socket, &local_endpoint, sizeof(local_endpoint)); error != 0) {
-        std::cerr << "Socket bind failed with error: " << WSAGetLastError() << std::endl;
+    if (int error = bind(falcon->m_socket, reinterpret_cast<const sockaddr*>(&local_endpoint), local_endpoint_len); error != 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "Socket bind failed with error: {}", WSAGetLastError());
         closesocket(falcon->m_socket);
         return nullptr;
     }
 
-    // std::cout << "Server is listening on " << endpoint << ":" << port << std::endl;
+    FALCON_LOG_INFO(LogCategory::Socket, "Server is listening on {}:{}", endpoint, port);
     return falcon;
 }
 
 void Falcon::ConnectTo(const std::string& serverIp, uint16_t port)
 {
+    const Endpoint server = Endpoint::Parse(serverIp, port);
+    if (!server.IsValid()) {
+        throw std::runtime_error("Invalid server address");
+    }
+
     // Create the socket
-    m_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    m_socketFamily = server.GetFamily();
+    m_socket = socket(m_socketFamily == Endpoint::Family::IPv6 ? AF_INET6 : AF_INET, SOCK_DGRAM, IPPROTO_UDP);
     if (m_socket < 0) {
         throw std::runtime_error("Socket creation failed");
     }
 
     u_long mode = 1;
     if (ioctlsocket(m_socket, FIONBIO, &mode) != NO_ERROR) {
-        std::cerr << "Failed to set non-blocking mode with error: " << WSAGetLastError() << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to set non-blocking mode with error: {}", WSAGetLastError());
         closesocket(m_socket);
         return;
     }
 
-    // Configure the server address
-    sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    inet_pton(AF_INET, serverIp.c_str(), &serverAddr.sin_addr);
-
-
-    int sent = SendTo(serverIp, port, SerializeMessage(MsgConn{MSG_CONN}));
+    MessageBuffer<MsgConn> conn;
+    int sent = SendTo(server, {conn.data(), SerializeMessage(MsgConn{MSG_CONN, 0, 0}, conn)});
 
     if (sent < 0) {
-        std::cout << "Failed to send connection request to " << serverIp << ":" << port << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Connection, "Failed to send connection request to {}:{}", serverIp, port);
     }
     else {
-        std::cout << "Connection request sent to " << serverIp << ":" << port << std::endl;
-        clientInfoFromServer.IP = serverIp;
-        clientInfoFromServer.Port = port;
+        FALCON_LOG_DEBUG(LogCategory::Connection, "Connection request sent to {}:{}", serverIp, port);
+        clientInfoFromServer.endpoint = server;
         clientInfoFromServer.lastPing = std::chrono::steady_clock::now();
     }
 
 
 
-    // client thread to handle messages
-    m_thread = std::thread([this]() {
-        while (m_running) {
-            std::string serverIp;
-            std::vector<char> buffer(65535);
-
-            int received = ReceiveFrom(serverIp, std::span<char, 65535>(buffer.data(), buffer.size()));
-
-            if (received < 0) {
-                // std::cerr << "Failed to receive message\n";
-            }
-            if (received > 0) {
-                auto [IP, port] = portFromIp(serverIp);
-
-                Msg msg;
-                msg.IP = IP;
-                msg.Port = port;
-                msg.data = std::vector<char>(buffer.begin(), buffer.end());
-
-                clientInfoFromServer.lastPing = std::chrono::steady_clock::now();
-                handleMessage(msg);
-            }
+    if (!InitReactor()) {
+        closesocket(m_socket);
+        throw std::runtime_error("Reactor creation failed");
+    }
 
-            std::chrono::steady_clock::duration delta_time = std::chrono::steady_clock::now() - clientInfoFromServer.lastPing;
-
-            // std::cout << "Last pinged " << std::chrono::duration_cast<std::chrono::seconds>(delta_time).count() << " seconds ago\n";
-
-            if (clientInfoFromServer.ID == 0 && delta_time > std::chrono::seconds(1)) {
-                std::cerr << "Failed to connect to server\n";
-                for (const auto& handler: onConnectionEventHandlers) {
-                    handler(false, 0);
-                }
-                break;
-            } else if (delta_time > std::chrono::seconds(2)) {
-                std::cerr << "Server disconnected\n";
-                for (const auto& handler: onDisconnectHandlers) {
-                    handler();
-                }
-                break;
-            }
+    // the keep-alive timer reports the connection failure if the server never answers
+    ScheduleServerKeepAlive(clientInfoFromServer.lastPing + m_config.connectTimeout);
+    ScheduleStatsDump();
 
-        }
+    // client thread to handle messages
+    m_thread = std::thread([this]() {
+        RunNetworkLoop();
     });
 }
 
-
-int Falcon::SendToInternal(const std::string &to, uint16_t port, std::span<const char> message)
+int Falcon::SendToInternal(const Endpoint &to, std::span<const char> message)
 {
-    const sockaddr destination = StringToIp(to, port);
+    sockaddr_storage destination;
+    const int destination_len = ToSockaddr(to, m_socketFamily, destination);
     int error = sendto(m_socket,
         message.data(),
-        message.size(),
+        static_cast<int>(message.size()),
         0,
-        &destination,
-        sizeof(destination));
+        reinterpret_cast<const sockaddr*>(&destination),
+        destination_len);
     return error;
 }
 
-int Falcon::ReceiveFromInternal(std::string &from, std::span<char, 65535> message)
+int Falcon::ReceiveFromInternal(Endpoint &from, std::span<char, 65535> message)
 {
     sockaddr_storage peer_addr{};
     socklen_t peer_addr_len = sizeof( sockaddr_storage);
@@ -230,15 +340,63 @@ int Falcon::ReceiveFromInternal(std::string &from, std::span<char, 65535> messag
         reinterpret_cast<sockaddr*>(&peer_addr),
         &peer_addr_len);
 
-    from = IpToString(reinterpret_cast<const sockaddr*>(&peer_addr));
+    from = FromSockaddr(peer_addr);
 
     if (read_bytes < 0) {
         int error = WSAGetLastError();
         if (error == WSAEWOULDBLOCK) {
             return 0;
         }
-        std::cerr << "Failed to receive data. Error: " << error << std::endl;
+        FALCON_LOG_ERROR(LogCategory::Socket, "Failed to receive data. Error: {}", error);
     }
 
     return read_bytes;
 }
+
+int Falcon::ReceiveBatchInternal(std::span<Datagram> out)
+{
+    // no recvmmsg on Windows, drain the socket with a plain loop into pooled buffers
+    int received = 0;
+    while (received < static_cast<int>(out.size())) {
+        PacketHandle packet = m_packetPool.Acquire();
+        if (!packet) {
+            // every buffer is held by the application, discard the datagram rather than spin on it
+            char discard;
+            if (recv(m_socket, &discard, 1, 0) != SOCKET_ERROR || WSAGetLastError() == WSAEMSGSIZE) {
+                m_datagramsDropped++;
+            }
+            break;
+        }
+
+        sockaddr_storage peer_addr{};
+        socklen_t peer_addr_len = sizeof(sockaddr_storage);
+        const int read_bytes = recvfrom(m_socket, packet.data(), static_cast<int>(packet.capacity()), 0, reinterpret_cast<sockaddr*>(&peer_addr), &peer_addr_len);
+        if (read_bytes == SOCKET_ERROR) {
+            if (WSAGetLastError() == WSAEMSGSIZE) {
+                // truncated datagrams are discarded by the stack, keep draining
+                m_datagramsDropped++;
+                continue;
+            }
+            break;
+        }
+        packet.SetSize(static_cast<size_t>(read_bytes));
+        out[received].from = FromSockaddr(peer_addr);
+        out[received].packet = std::move(packet);
+        ++received;
+    }
+    return received;
+}
+
+int Falcon::SendBatchInternal(std::span<const QueuedDatagram> datagrams, const char* data)
+{
+    int sentTotal = 0;
+    for (const QueuedDatagram& datagram : datagrams) {
+        if (SendToInternal(datagram.to, {data + datagram.offset, datagram.size}) >= 0) {
+            m_sendCalls++;
+            m_datagramsSent++;
+            RecordBatch(m_maxSendBatch, 1);
+            ++sentTotal;
+        }
+    }
+    return sentTotal;
+}
@@ -0,0 +1,100 @@
+#include "log.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "spdlog/async.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+namespace {
+    constexpr std::array<const char*, static_cast<size_t>(LogCategory::Count)> categoryNames = {
+        "socket", "connection", "stream", "reliability", "fragmentation", "metrics"
+    };
+
+    struct RateLimit {
+        std::atomic<int64_t> windowStart{0};
+        std::atomic<uint32_t> count{0};
+        std::atomic<uint32_t> suppressed{0};
+    };
+
+    std::array<RateLimit, static_cast<size_t>(LogCategory::Count)> rateLimits;
+    std::atomic<uint32_t> maxMessagesPerSecond{LogConfig{}.maxMessagesPerSecond};
+
+    std::mutex loggersMutex;
+    // an async logger only holds its thread pool weakly, it is kept here next to it
+    struct Generation {
+        std::shared_ptr<spdlog::logger> logger;
+        std::shared_ptr<spdlog::details::thread_pool> pool;
+    };
+    // the logger a reconfiguration replaced stays alive until the next one, a network thread may still be
+    // logging through it; older ones are released so repeated reconfiguration doesn't pile them up
+    Generation installed;
+    Generation previous;
+    std::atomic<spdlog::logger*> current{nullptr};
+
+    Generation MakeLogger(const LogConfig& config) {
+        auto sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+        Generation generation;
+        if (config.async) {
+            generation.pool = std::make_shared<spdlog::details::thread_pool>(config.asyncQueueSize, 1);
+            // drop the oldest message rather than block the network thread when the queue is full
+            generation.logger = std::make_shared<spdlog::async_logger>("falcon", std::move(sink), generation.pool,
+                                                                       spdlog::async_overflow_policy::overrun_oldest);
+        }
+        else {
+            generation.logger = std::make_shared<spdlog::logger>("falcon", std::move(sink));
+        }
+        generation.logger->set_level(config.level);
+        return generation;
+    }
+
+    void Install(Generation generation) {
+        spdlog::drop("falcon");
+        spdlog::register_logger(generation.logger);
+        current.store(generation.logger.get(), std::memory_order_release);
+        previous = std::exchange(installed, std::move(generation));
+    }
+}
+
+void ConfigureFalconLogging(const LogConfig &config) {
+    std::lock_guard lock(loggersMutex);
+    maxMessagesPerSecond.store(config.maxMessagesPerSecond, std::memory_order_relaxed);
+    Install(MakeLogger(config));
+}
+
+spdlog::logger& FalconLogger() {
+    spdlog::logger* logger = current.load(std::memory_order_acquire);
+    if (logger) {
+        return *logger;
+    }
+    std::lock_guard lock(loggersMutex);
+    if (!current.load(std::memory_order_relaxed)) {
+        Install(MakeLogger(LogConfig{}));
+    }
+    return *current.load(std::memory_order_relaxed);
+}
+
+bool FalconLogAllowed(LogCategory category) {
+    RateLimit& limit = rateLimits[static_cast<size_t>(category)];
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    int64_t windowStart = limit.windowStart.load(std::memory_order_relaxed);
+    if (now - windowStart >= 1000 && limit.windowStart.compare_exchange_strong(windowStart, now, std::memory_order_relaxed)) {
+        limit.count.store(0, std::memory_order_relaxed);
+        const uint32_t suppressed = limit.suppressed.exchange(0, std::memory_order_relaxed);
+        if (suppressed > 0) {
+            FalconLogger().warn("{} {} log messages suppressed", suppressed, categoryNames[static_cast<size_t>(category)]);
+        }
+    }
+
+    if (limit.count.fetch_add(1, std::memory_order_relaxed) < maxMessagesPerSecond.load(std::memory_order_relaxed)) {
+        return true;
+    }
+    limit.suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
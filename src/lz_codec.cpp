@@ -0,0 +1,193 @@
+#include "lz_codec.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#include "wire.h"
+
+namespace {
+    constexpr int HASH_BITS = 12;
+    constexpr size_t TRAINING_SEGMENT = 8;
+
+    uint32_t Read32(const char* p) {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    size_t Hash(uint32_t value) {
+        return (value * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    void WriteLength(std::vector<char>& out, size_t length) {
+        for (; length >= 255; length -= 255) {
+            out.push_back(static_cast<char>(255));
+        }
+        out.push_back(static_cast<char>(length));
+    }
+
+    bool ReadLength(std::span<const char>& in, size_t& length) {
+        uint8_t byte;
+        do {
+            if (in.empty()) {
+                return false;
+            }
+            byte = static_cast<uint8_t>(in[0]);
+            in = in.subspan(1);
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    void WriteSequence(std::vector<char>& out, std::span<const char> literals, size_t offset, size_t matchLength) {
+        const size_t matchCode = matchLength == 0 ? 0 : matchLength - LZ_MIN_MATCH;
+        out.push_back(static_cast<char>(std::min<size_t>(literals.size(), 15) << 4 | std::min<size_t>(matchCode, 15)));
+        if (literals.size() >= 15) {
+            WriteLength(out, literals.size() - 15);
+        }
+        out.insert(out.end(), literals.begin(), literals.end());
+        if (matchLength == 0) {
+            return;
+        }
+        char encodedOffset[2];
+        WriteU16LE(static_cast<uint16_t>(offset), encodedOffset);
+        out.insert(out.end(), encodedOffset, encodedOffset + 2);
+        if (matchCode >= 15) {
+            WriteLength(out, matchCode - 15);
+        }
+    }
+}
+
+void LzCompress(std::span<const char> input, std::span<const char> dictionary, std::vector<char> &out)
+{
+    // matches are searched in dictionary + input as one buffer
+    std::vector<char> joined;
+    std::span<const char> window = input;
+    if (!dictionary.empty()) {
+        dictionary = dictionary.last(std::min(dictionary.size(), LZ_MAX_OFFSET));
+        joined.reserve(dictionary.size() + input.size());
+        joined.insert(joined.end(), dictionary.begin(), dictionary.end());
+        joined.insert(joined.end(), input.begin(), input.end());
+        window = joined;
+    }
+    const char* data = window.data();
+    const size_t start = dictionary.size();
+    const size_t end = window.size();
+
+    std::array<int64_t, size_t(1) << HASH_BITS> table;
+    table.fill(-1);
+    for (size_t i = 0; i + LZ_MIN_MATCH <= start; ++i) {
+        table[Hash(Read32(data + i))] = static_cast<int64_t>(i);
+    }
+
+    size_t anchor = start;
+    size_t pos = start;
+    while (pos + LZ_MIN_MATCH <= end) {
+        const uint32_t sample = Read32(data + pos);
+        const size_t slot = Hash(sample);
+        const int64_t candidate = table[slot];
+        table[slot] = static_cast<int64_t>(pos);
+        if (candidate < 0 || pos - candidate > LZ_MAX_OFFSET || Read32(data + candidate) != sample) {
+            // skip faster through data that doesn't compress
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < end && data[candidate + length] == data[pos + length]) {
+            ++length;
+        }
+        WriteSequence(out, window.subspan(anchor, pos - anchor), pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+    if (anchor < end) {
+        WriteSequence(out, window.subspan(anchor), 0, 0);
+    }
+}
+
+bool LzDecompress(std::span<const char> block, std::span<const char> dictionary, size_t originalSize, std::vector<char> &out)
+{
+    dictionary = dictionary.last(std::min(dictionary.size(), LZ_MAX_OFFSET));
+    out.clear();
+    out.reserve(originalSize);
+    while (out.size() < originalSize) {
+        if (block.empty()) {
+            return false;
+        }
+        const auto token = static_cast<uint8_t>(block[0]);
+        block = block.subspan(1);
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !ReadLength(block, literals)) {
+            return false;
+        }
+        if (literals > block.size() || literals > originalSize - out.size()) {
+            return false;
+        }
+        out.insert(out.end(), block.begin(), block.begin() + static_cast<std::ptrdiff_t>(literals));
+        block = block.subspan(literals);
+        if (out.size() == originalSize) {
+            break;
+        }
+
+        if (block.size() < 2) {
+            return false;
+        }
+        const size_t offset = ReadU16LE(block.data());
+        block = block.subspan(2);
+        size_t length = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15 && !ReadLength(block, length)) {
+            return false;
+        }
+        if (offset == 0 || offset > dictionary.size() + out.size() || length > originalSize - out.size()) {
+            return false;
+        }
+        // byte by byte, a match may overlap what it is copying
+        size_t from = dictionary.size() + out.size() - offset;
+        for (size_t i = 0; i < length; ++i, ++from) {
+            out.push_back(from < dictionary.size() ? dictionary[from] : out[from - dictionary.size()]);
+        }
+    }
+    return block.empty();
+}
+
+std::vector<char> TrainLzDictionary(std::span<const std::vector<char>> samples, size_t maxSize)
+{
+    // count every segment once per sample, a segment repeated inside one message compresses without help
+    std::unordered_map<std::string_view, size_t> counts;
+    for (const std::vector<char>& sample : samples) {
+        std::unordered_map<std::string_view, bool> seen;
+        for (size_t i = 0; i + TRAINING_SEGMENT <= sample.size(); ++i) {
+            const std::string_view segment(sample.data() + i, TRAINING_SEGMENT);
+            if (!seen.emplace(segment, true).second) {
+                continue;
+            }
+            counts[segment]++;
+        }
+    }
+
+    std::vector<std::pair<std::string_view, size_t>> ranked;
+    for (const auto& [segment, count] : counts) {
+        if (count > 1) {
+            ranked.emplace_back(segment, count);
+        }
+    }
+    std::ranges::sort(ranked, [](const auto& a, const auto& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+
+    // the most common segments go last, closest to the data and cheapest to reach
+    std::vector<char> dictionary;
+    for (auto it = ranked.begin(); it != ranked.end() && dictionary.size() + TRAINING_SEGMENT <= maxSize; ++it) {
+        const std::string_view chosen(dictionary.data(), dictionary.size());
+        if (chosen.find(it->first) != std::string_view::npos) {
+            continue;
+        }
+        dictionary.insert(dictionary.begin(), it->first.begin(), it->first.end());
+    }
+    return dictionary;
+}
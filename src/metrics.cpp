@@ -0,0 +1,106 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+size_t LatencyHistogram::BucketOf(uint64_t value)
+{
+    value = std::min<uint64_t>(value, (uint64_t{1} << MAX_VALUE_BITS) - 1);
+    if (value < 2 * SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    // keep the SUB_BUCKET_BITS bits under the leading one
+    const int shift = std::bit_width(value) - (SUB_BUCKET_BITS + 1);
+    return static_cast<size_t>(shift + 1) * SUB_BUCKETS + static_cast<size_t>(value >> shift) - SUB_BUCKETS;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(size_t bucket)
+{
+    if (bucket < 2 * SUB_BUCKETS) {
+        return bucket;
+    }
+    const int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+    const uint64_t leading = bucket % SUB_BUCKETS + SUB_BUCKETS;
+    return ((leading + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t value)
+{
+    counts[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::Read() const
+{
+    Snapshot snapshot;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+        snapshot.count += snapshot.counts[i];
+    }
+    snapshot.sum = sum.load(std::memory_order_relaxed);
+    snapshot.max = max.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+uint64_t LatencyHistogram::Snapshot::Percentile(double p) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(p, 0.0, 1.0) * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return std::min(BucketUpperBound(i), max);
+        }
+    }
+    return max;
+}
+
+void LatencyHistogram::Snapshot::Merge(const Snapshot &other)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    max = std::max(max, other.max);
+}
+
+void StreamStats::Read(const StreamCounters &counters)
+{
+    packetsSent = counters.packetsSent.load(std::memory_order_relaxed);
+    bytesSent = counters.bytesSent.load(std::memory_order_relaxed);
+    packetsReceived = counters.packetsReceived.load(std::memory_order_relaxed);
+    bytesReceived = counters.bytesReceived.load(std::memory_order_relaxed);
+    retransmissions = counters.retransmissions.load(std::memory_order_relaxed);
+    duplicates = counters.duplicates.load(std::memory_order_relaxed);
+    outOfWindow = counters.outOfWindow.load(std::memory_order_relaxed);
+    staleDropped = counters.staleDropped.load(std::memory_order_relaxed);
+    reordered = counters.reordered.load(std::memory_order_relaxed);
+    reorderRejected = counters.reorderRejected.load(std::memory_order_relaxed);
+}
+
+void ClientStats::Add(const StreamStats &stream)
+{
+    packetsSent += stream.packetsSent;
+    bytesSent += stream.bytesSent;
+    packetsReceived += stream.packetsReceived;
+    bytesReceived += stream.bytesReceived;
+    retransmissions += stream.retransmissions;
+    duplicates += stream.duplicates;
+    outOfWindow += stream.outOfWindow;
+    staleDropped += stream.staleDropped;
+    reordered += stream.reordered;
+    reorderRejected += stream.reorderRejected;
+    unacked += stream.unacked;
+    backlogMessages += stream.backlogMessages;
+    backlogBytes += stream.backlogBytes;
+    reorderMessages += stream.reorderMessages;
+    reorderBytes += stream.reorderBytes;
+    streams.push_back(stream);
+}
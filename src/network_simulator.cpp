@@ -0,0 +1,82 @@
+#include "network_simulator.h"
+
+#include <algorithm>
+
+NetworkSimulator::NetworkSimulator(const NetworkConditions &conditions)
+    : conditions(conditions), rng(conditions.seed)
+{
+}
+
+bool NetworkSimulator::Submit(const Endpoint &to, std::span<const char> data, Clock::time_point now)
+{
+    if (Chance(conditions.lossRate)) {
+        lost++;
+        return false;
+    }
+
+    Clock::time_point departure = now;
+    if (conditions.bandwidth > 0) {
+        // the datagram leaves once the ones before it are serialized
+        const auto start = std::max(now, linkFreeAt);
+        if (start - now > conditions.maxQueueDelay) {
+            lost++;
+            return false;
+        }
+        linkFreeAt = start + std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(data.size()) / static_cast<double>(conditions.bandwidth)));
+        departure = linkFreeAt;
+    }
+
+    const int copies = Chance(conditions.duplicateRate) ? 2 : 1;
+    duplicated += copies - 1;
+    bool earliest = false;
+    for (int i = 0; i < copies; ++i) {
+        Clock::time_point release = departure + SampleLatency();
+        if (Chance(conditions.reorderRate)) {
+            reordered++;
+            release += conditions.reorderDelay;
+        }
+        earliest |= inFlight.empty() || release < inFlight.top().release;
+        inFlight.push({release, nextOrder++, to, std::vector<char>(data.begin(), data.end())});
+    }
+    return earliest;
+}
+
+void NetworkSimulator::TakeDue(Clock::time_point now, std::vector<Datagram> &out)
+{
+    while (!inFlight.empty() && inFlight.top().release <= now) {
+        // moving out of top() is fine, pop only compares release and order
+        out.push_back(std::move(const_cast<Datagram&>(inFlight.top())));
+        inFlight.pop();
+    }
+}
+
+std::optional<NetworkSimulator::Clock::time_point> NetworkSimulator::NextRelease() const
+{
+    if (inFlight.empty()) {
+        return std::nullopt;
+    }
+    return inFlight.top().release;
+}
+
+NetworkSimulator::Clock::duration NetworkSimulator::SampleLatency()
+{
+    const double latency = static_cast<double>(conditions.latency.count());
+    const double jitter = static_cast<double>(conditions.jitter.count());
+    double sample = latency;
+    if (jitter > 0) {
+        if (conditions.distribution == LatencyDistribution::Normal) {
+            sample = std::normal_distribution<double>(latency, jitter)(rng);
+        } else {
+            sample = std::uniform_real_distribution<double>(latency - jitter, latency + jitter)(rng);
+        }
+    }
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(std::max(0.0, sample)));
+}
+
+bool NetworkSimulator::Chance(double rate)
+{
+    // rolls even at rate 0, so enabling one impairment doesn't shift the decisions of the others
+    const double roll = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    return roll < rate;
+}
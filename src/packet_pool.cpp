@@ -0,0 +1,95 @@
+#include "packet_pool.h"
+
+#include <utility>
+
+
+PacketHandle::PacketHandle(const PacketHandle& other)
+    : pool(other.pool), index(other.index), length(other.length)
+{
+    if (pool) {
+        pool->AddRef(index);
+    }
+}
+
+PacketHandle::PacketHandle(PacketHandle&& other) noexcept
+    : pool(std::exchange(other.pool, nullptr)), index(other.index), length(std::exchange(other.length, 0))
+{
+}
+
+PacketHandle& PacketHandle::operator=(PacketHandle other) noexcept
+{
+    std::swap(pool, other.pool);
+    std::swap(index, other.index);
+    std::swap(length, other.length);
+    return *this;
+}
+
+PacketHandle::~PacketHandle()
+{
+    if (pool) {
+        pool->Release(index);
+    }
+}
+
+char* PacketHandle::data() const
+{
+    return pool ? pool->storage.data() + index * pool->bufferSize : nullptr;
+}
+
+size_t PacketHandle::capacity() const
+{
+    return pool ? pool->bufferSize : 0;
+}
+
+
+PacketPool::PacketPool(size_t bufferSize, size_t count)
+    : bufferSize(bufferSize), count(count), storage(bufferSize * count),
+      refCounts(std::make_unique<std::atomic<uint32_t>[]>(count)),
+      next(std::make_unique<std::atomic<uint32_t>[]>(count)),
+      head(count > 0 ? 0 : EMPTY), available(count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        refCounts[i].store(0, std::memory_order_relaxed);
+        next[i].store(i + 1 < count ? static_cast<uint32_t>(i + 1) : EMPTY, std::memory_order_relaxed);
+    }
+}
+
+PacketHandle PacketPool::Acquire()
+{
+    uint64_t current = head.load(std::memory_order_acquire);
+    while (true) {
+        const auto index = static_cast<uint32_t>(current);
+        if (index == EMPTY) {
+            return {};
+        }
+        // the tag changes on every push/pop so a stale next value makes the CAS fail
+        const uint64_t replacement = ((current >> 32) + 1) << 32 | next[index].load(std::memory_order_relaxed);
+        if (head.compare_exchange_weak(current, replacement, std::memory_order_acquire, std::memory_order_acquire)) {
+            refCounts[index].store(1, std::memory_order_relaxed);
+            available.fetch_sub(1, std::memory_order_relaxed);
+            return {this, index};
+        }
+    }
+}
+
+void PacketPool::AddRef(uint32_t index)
+{
+    refCounts[index].fetch_add(1, std::memory_order_relaxed);
+}
+
+void PacketPool::Release(uint32_t index)
+{
+    if (refCounts[index].fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    available.fetch_add(1, std::memory_order_relaxed);
+    uint64_t current = head.load(std::memory_order_relaxed);
+    while (true) {
+        next[index].store(static_cast<uint32_t>(current), std::memory_order_relaxed);
+        const uint64_t replacement = ((current >> 32) + 1) << 32 | index;
+        if (head.compare_exchange_weak(current, replacement, std::memory_order_release, std::memory_order_relaxed)) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#include "rtt_estimator.h"
+
+#include <algorithm>
+
+
+// clock granularity G of RFC 6298, steady_clock is far finer but a sub-millisecond variance is mostly noise
+static constexpr RttEstimator::Duration CLOCK_GRANULARITY = std::chrono::milliseconds(1);
+
+RttEstimator::RttEstimator(Duration initialTimeout, Duration minTimeout, Duration maxTimeout)
+    : rto(initialTimeout), minTimeout(minTimeout), maxTimeout(maxTimeout)
+{
+}
+
+void RttEstimator::AddSample(Duration rtt)
+{
+    rtt = std::max(rtt, Duration::zero());
+    if (!hasSample) {
+        srtt = rtt;
+        rttvar = rtt / 2;
+        hasSample = true;
+    } else {
+        const Duration error = srtt > rtt ? srtt - rtt : rtt - srtt;
+        rttvar = (3 * rttvar + error) / 4;
+        srtt = (7 * srtt + rtt) / 8;
+    }
+    UpdateTimeout();
+}
+
+void RttEstimator::Backoff()
+{
+    rto = std::min(rto * 2, maxTimeout);
+}
+
+void RttEstimator::UpdateTimeout()
+{
+    rto = std::clamp(srtt + std::max(CLOCK_GRANULARITY, 4 * rttvar), minTimeout, maxTimeout);
+}
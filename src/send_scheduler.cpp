@@ -0,0 +1,78 @@
+#include "send_scheduler.h"
+
+#include <algorithm>
+
+#include "falcon.h"
+
+
+SendScheduler::SendScheduler(const SendSchedulerConfig& config)
+    : config(config)
+{
+}
+
+bool SendScheduler::Enqueue(const StreamPriority& priority, Message&& message)
+{
+    if (queuedBytes + message.data.size() > config.maxQueuedBytes) {
+        return false;
+    }
+    if (priority.deadline > std::chrono::milliseconds::zero() && !Stream::IsReliable(message.streamID)) {
+        message.expiry = message.queued + priority.deadline;
+    }
+
+    auto [stream, created] = streams.try_emplace(message.streamID);
+    stream->second.priority = priority;
+    const double start = created ? virtualTime : std::max(virtualTime, stream->second.lastFinish);
+    const double finish = start + static_cast<double>(std::max<size_t>(message.data.size(), 1)) / std::max<uint32_t>(priority.weight, 1);
+    stream->second.lastFinish = finish;
+    queuedBytes += message.data.size();
+    stream->second.entries.push_back({std::move(message), finish});
+    return true;
+}
+
+void SendScheduler::RunTick(Clock::time_point now, std::vector<Message>& out, std::vector<Message>& stale)
+{
+    // unused budget doesn't pile up across ticks, a debt does
+    credit = std::min<int64_t>(credit + static_cast<int64_t>(config.bytesPerTick), static_cast<int64_t>(config.bytesPerTick));
+
+    // messages of a stream share their deadline, the stale ones are at the front
+    for (auto it = streams.begin(); it != streams.end();) {
+        auto& entries = it->second.entries;
+        while (!entries.empty() && entries.front().message.expiry <= now) {
+            queuedBytes -= entries.front().message.data.size();
+            stale.push_back(std::move(entries.front().message));
+            entries.pop_front();
+        }
+        it = entries.empty() ? streams.erase(it) : std::next(it);
+    }
+
+    while (credit > 0 && !streams.empty()) {
+        auto best = streams.begin();
+        uint64_t bestLevel = EffectiveLevel(best->second, now);
+        for (auto it = std::next(streams.begin()); it != streams.end(); ++it) {
+            const uint64_t level = EffectiveLevel(it->second, now);
+            if (level > bestLevel || (level == bestLevel && it->second.entries.front().finish < best->second.entries.front().finish)) {
+                best = it;
+                bestLevel = level;
+            }
+        }
+
+        Entry& entry = best->second.entries.front();
+        virtualTime = std::max(virtualTime, entry.finish);
+        credit -= static_cast<int64_t>(entry.message.data.size());
+        queuedBytes -= entry.message.data.size();
+        out.push_back(std::move(entry.message));
+        best->second.entries.pop_front();
+        if (best->second.entries.empty()) {
+            streams.erase(best);
+        }
+    }
+}
+
+uint64_t SendScheduler::EffectiveLevel(const StreamQueue& stream, Clock::time_point now) const
+{
+    uint64_t level = stream.priority.level;
+    if (config.agingInterval > std::chrono::milliseconds::zero()) {
+        level += static_cast<uint64_t>((now - stream.entries.front().message.queued) / config.agingInterval);
+    }
+    return level;
+}
@@ -0,0 +1,142 @@
+#include "sharded_server.h"
+#include "log.h"
+
+#include <algorithm>
+
+
+std::unique_ptr<ShardedServer> ShardedServer::Listen(const std::string &endpoint, uint16_t port, size_t shardCount, const FalconConfig &config)
+{
+    if (shardCount == 0) {
+        FALCON_LOG_ERROR(LogCategory::Socket, "A sharded server needs at least one shard");
+        return nullptr;
+    }
+
+    auto server = std::make_unique<ShardedServer>();
+    server->shards.reserve(shardCount);
+    for (size_t i = 0; i < shardCount; ++i) {
+        FalconConfig shardConfig = config;
+        shardConfig.reusePort = true;
+        shardConfig.firstClientID = i + 1;
+        shardConfig.clientIDStride = shardCount;
+
+        auto shard = Falcon::Listen(endpoint, port, shardConfig);
+        if (!shard) {
+            FALCON_LOG_ERROR(LogCategory::Socket, "Failed to start shard {} on port {}", i, port);
+            return nullptr;
+        }
+        server->shards.push_back(std::move(shard));
+    }
+    return server;
+}
+
+void ShardedServer::OnClientConnected(const std::function<void(uint64_t)> &handler)
+{
+    for (const auto& shard : shards) {
+        shard->OnClientConnected(handler);
+    }
+}
+
+void ShardedServer::OnClientDisconnected(const std::function<void(uint64_t)> &handler)
+{
+    for (const auto& shard : shards) {
+        shard->OnClientDisconnected(handler);
+    }
+}
+
+void ShardedServer::OnStreamCreated(const std::function<void(uint32_t)> &handler)
+{
+    for (const auto& shard : shards) {
+        shard->OnStreamCreated(handler);
+    }
+}
+
+void ShardedServer::OnStreamOpened(const std::function<void(Stream&)> &handler)
+{
+    for (const auto& shard : shards) {
+        shard->OnStreamOpened(handler);
+    }
+}
+
+std::unique_ptr<Stream> ShardedServer::CreateStream(uint64_t client, StreamDelivery delivery, const CompressionOptions& compression)
+{
+    return ShardOf(client).CreateStream(client, delivery, compression);
+}
+
+std::unique_ptr<Stream> ShardedServer::CreateStream(uint64_t client, bool reliable, const CompressionOptions& compression)
+{
+    return ShardOf(client).CreateStream(client, reliable, compression);
+}
+
+void ShardedServer::RegisterDictionary(uint32_t id, std::span<const char> dictionary)
+{
+    for (const auto& shard : shards) {
+        shard->RegisterDictionary(id, dictionary);
+    }
+}
+
+void ShardedServer::CloseStream(const Stream &stream)
+{
+    ShardOf(stream.clientID).CloseStream(stream);
+}
+
+Client ShardedServer::GetClient(uint64_t id)
+{
+    return ShardOf(id).GetClient(id);
+}
+
+std::optional<RttEstimator> ShardedServer::GetRtt(uint64_t clientID)
+{
+    return ShardOf(clientID).GetRtt(clientID);
+}
+
+void ShardedServer::Flush()
+{
+    for (const auto& shard : shards) {
+        shard->Flush();
+    }
+}
+
+size_t ShardedServer::Poll(size_t maxEvents)
+{
+    size_t polled = 0;
+    for (const auto& shard : shards) {
+        polled += shard->Poll(maxEvents - polled);
+    }
+    return polled;
+}
+
+FalconStats ShardedServer::GetStats() const
+{
+    FalconStats total;
+    for (const auto& shard : shards) {
+        const FalconStats stats = shard->GetStats();
+        total.datagramsReceived += stats.datagramsReceived;
+        total.datagramsSent += stats.datagramsSent;
+        total.receiveCalls += stats.receiveCalls;
+        total.sendCalls += stats.sendCalls;
+        total.maxReceiveBatch = std::max(total.maxReceiveBatch, stats.maxReceiveBatch);
+        total.maxSendBatch = std::max(total.maxSendBatch, stats.maxSendBatch);
+        total.datagramsDropped += stats.datagramsDropped;
+        total.retransmissions += stats.retransmissions;
+        total.fastRetransmissions += stats.fastRetransmissions;
+        total.messagesCoalesced += stats.messagesCoalesced;
+        total.messagesFragmented += stats.messagesFragmented;
+        total.messagesReassembled += stats.messagesReassembled;
+        total.reassembliesDropped += stats.reassembliesDropped;
+        total.simulatedLost += stats.simulatedLost;
+        total.simulatedDuplicated += stats.simulatedDuplicated;
+        total.simulatedReordered += stats.simulatedReordered;
+        total.messagesCompressed += stats.messagesCompressed;
+        total.compressionSkipped += stats.compressionSkipped;
+        total.compressionInputBytes += stats.compressionInputBytes;
+        total.compressionOutputBytes += stats.compressionOutputBytes;
+        total.compressionTime += stats.compressionTime;
+        total.decompressionTime += stats.decompressionTime;
+        total.connectionChallenges += stats.connectionChallenges;
+        total.connectionCookiesRejected += stats.connectionCookiesRejected;
+        total.connectionsRateLimited += stats.connectionsRateLimited;
+        // client IDs don't overlap between shards
+        total.clients.insert(total.clients.end(), stats.clients.begin(), stats.clients.end());
+    }
+    return total;
+}
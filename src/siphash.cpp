@@ -0,0 +1,60 @@
+#include "siphash.h"
+
+#include <bit>
+
+
+namespace {
+struct SipState {
+    uint64_t v0, v1, v2, v3;
+
+    void Round() {
+        v0 += v1;
+        v1 = std::rotl(v1, 13);
+        v1 ^= v0;
+        v0 = std::rotl(v0, 32);
+        v2 += v3;
+        v3 = std::rotl(v3, 16);
+        v3 ^= v2;
+        v0 += v3;
+        v3 = std::rotl(v3, 21);
+        v3 ^= v0;
+        v2 += v1;
+        v1 = std::rotl(v1, 17);
+        v1 ^= v2;
+        v2 = std::rotl(v2, 32);
+    }
+
+    void Compress(uint64_t word) {
+        v3 ^= word;
+        Round();
+        Round();
+        v0 ^= word;
+    }
+};
+}
+
+uint64_t SipHash24(uint64_t k0, uint64_t k1, std::span<const uint8_t> data)
+{
+    SipState state{k0 ^ 0x736F6D6570736575ull, k1 ^ 0x646F72616E646F6Dull, k0 ^ 0x6C7967656E657261ull, k1 ^ 0x7465646279746573ull};
+
+    // little endian words, the last one holds the remaining bytes and the length in its top byte
+    size_t offset = 0;
+    for (; offset + 8 <= data.size(); offset += 8) {
+        uint64_t word = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            word |= uint64_t(data[offset + i]) << (8 * i);
+        }
+        state.Compress(word);
+    }
+    uint64_t last = uint64_t(data.size() & 0xFF) << 56;
+    for (size_t i = 0; offset + i < data.size(); ++i) {
+        last |= uint64_t(data[offset + i]) << (8 * i);
+    }
+    state.Compress(last);
+
+    state.v2 ^= 0xFF;
+    for (int i = 0; i < 4; ++i) {
+        state.Round();
+    }
+    return state.v0 ^ state.v1 ^ state.v2 ^ state.v3;
+}
@@ -0,0 +1,238 @@
+#include "snapshot_replicator.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "stream.h"
+#include "wire.h"
+
+namespace {
+    constexpr uint8_t SNAPSHOT_FULL = 0;
+    constexpr uint8_t SNAPSHOT_DELTA = 1;
+    constexpr uint8_t SNAPSHOT_ACK = 2;
+    constexpr size_t SNAPSHOT_ACK_SIZE = 1 + 2 + 8;
+    // unchanged bytes shorter than this stay inside the changed run, two varints would cost more
+    constexpr size_t MIN_UNCHANGED_RUN = 3;
+
+    char BaselineByte(std::span<const char> baseline, size_t index) {
+        return index < baseline.size() ? baseline[index] : char(0);
+    }
+
+    void AppendVarint(std::vector<char>& out, uint64_t value) {
+        char buffer[MAX_VARINT_SIZE];
+        out.insert(out.end(), buffer, buffer + WriteVarint(value, buffer));
+    }
+
+    void AppendU16(std::vector<char>& out, uint16_t value) {
+        char buffer[2];
+        WriteU16LE(value, buffer);
+        out.insert(out.end(), buffer, buffer + 2);
+    }
+}
+
+void EncodeSnapshotDelta(std::span<const char> baseline, std::span<const char> current, std::vector<char> &out)
+{
+    const auto changed = [&](size_t i) { return current[i] != BaselineByte(baseline, i); };
+    size_t pos = 0;
+    while (pos < current.size()) {
+        const size_t unchangedStart = pos;
+        while (pos < current.size() && !changed(pos)) {
+            ++pos;
+        }
+        AppendVarint(out, pos - unchangedStart);
+        if (pos == current.size()) {
+            break;
+        }
+
+        // extend the changed run over short unchanged gaps
+        const size_t changedStart = pos;
+        size_t changedEnd = pos;
+        while (pos < current.size()) {
+            if (changed(pos)) {
+                changedEnd = ++pos;
+                continue;
+            }
+            size_t gap = pos;
+            while (gap < current.size() && gap - pos < MIN_UNCHANGED_RUN && !changed(gap)) {
+                ++gap;
+            }
+            if (gap - pos >= MIN_UNCHANGED_RUN || gap == current.size()) {
+                break;
+            }
+            pos = gap;
+        }
+        pos = changedEnd;
+        AppendVarint(out, changedEnd - changedStart);
+        for (size_t i = changedStart; i < changedEnd; ++i) {
+            out.push_back(static_cast<char>(current[i] ^ BaselineByte(baseline, i)));
+        }
+    }
+}
+
+bool DecodeSnapshotDelta(std::span<const char> baseline, std::span<const char> delta, size_t stateSize, std::vector<char> &out)
+{
+    out.resize(stateSize);
+    size_t pos = 0;
+    while (pos < stateSize) {
+        uint64_t unchanged;
+        if (!ReadVarint(delta, unchanged) || unchanged > stateSize - pos) {
+            return false;
+        }
+        for (const size_t end = pos + unchanged; pos < end; ++pos) {
+            out[pos] = BaselineByte(baseline, pos);
+        }
+        if (pos == stateSize) {
+            break;
+        }
+
+        uint64_t changed;
+        if (!ReadVarint(delta, changed) || changed == 0 || changed > stateSize - pos || changed > delta.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < changed; ++i, ++pos) {
+            out[pos] = static_cast<char>(delta[i] ^ BaselineByte(baseline, pos));
+        }
+        delta = delta.subspan(changed);
+    }
+    return delta.empty();
+}
+
+SnapshotReplicator::SnapshotReplicator(Stream &stream)
+    : stream(stream)
+{
+    stream.OnDataReceived([shared = shared](std::span<const char> data) {
+        shared->HandleAck(data);
+    });
+}
+
+void SnapshotReplicator::Send(std::span<const char> state)
+{
+    std::lock_guard lock(shared->mutex);
+    const uint16_t sequence = shared->nextSequence++;
+    const std::vector<char>* baseline = shared->baseline ? shared->history.Find(*shared->baseline) : nullptr;
+
+    message.clear();
+    message.push_back(static_cast<char>(baseline ? SNAPSHOT_DELTA : SNAPSHOT_FULL));
+    AppendU16(message, sequence);
+    if (baseline) {
+        AppendU16(message, *shared->baseline);
+    }
+    AppendVarint(message, state.size());
+    EncodeSnapshotDelta(baseline ? std::span<const char>(*baseline) : std::span<const char>(), state, message);
+
+    // encoded first, inserting may evict the baseline
+    if (!baseline) {
+        shared->baseline.reset();
+    }
+    shared->history.Insert(sequence).assign(state.begin(), state.end());
+
+    (baseline ? shared->stats.deltaSnapshots : shared->stats.fullSnapshots)++;
+    shared->stats.stateBytes += state.size();
+    shared->stats.bytesSent += message.size();
+    stream.SendData(message);
+}
+
+SnapshotReplicator::Stats SnapshotReplicator::GetStats() const
+{
+    std::lock_guard lock(shared->mutex);
+    return shared->stats;
+}
+
+void SnapshotReplicator::Shared::HandleAck(std::span<const char> message)
+{
+    if (message.size() != SNAPSHOT_ACK_SIZE || static_cast<uint8_t>(message[0]) != SNAPSHOT_ACK) {
+        return;
+    }
+    const uint16_t latest = ReadU16LE(message.data() + 1);
+    uint64_t trace = 0;
+    for (int i = 0; i < 8; ++i) {
+        trace |= uint64_t(static_cast<uint8_t>(message[3 + i])) << (8 * i);
+    }
+
+    std::lock_guard lock(mutex);
+    // the newest acked snapshot we still have becomes the baseline, unless it is older than the current one
+    while (trace) {
+        const int delta = std::countl_zero(trace);
+        trace &= ~(RELIABLE_ACK_MASK >> delta);
+        const auto sequence = static_cast<uint16_t>(latest - delta);
+        if (!history.Find(sequence)) {
+            continue;
+        }
+        if (!baseline || !history.Find(*baseline) || static_cast<int16_t>(sequence - *baseline) > 0) {
+            baseline = sequence;
+        }
+        return;
+    }
+}
+
+SnapshotReceiver::SnapshotReceiver(Stream &stream, Handler handler)
+    : shared(std::make_shared<Shared>(stream, std::move(handler)))
+{
+    stream.OnDataReceived([shared = shared](std::span<const char> data) {
+        shared->HandleSnapshot(data);
+    });
+}
+
+SnapshotReceiver::Stats SnapshotReceiver::GetStats() const
+{
+    std::lock_guard lock(shared->mutex);
+    return shared->stats;
+}
+
+void SnapshotReceiver::Shared::HandleSnapshot(std::span<const char> message)
+{
+    std::lock_guard lock(mutex);
+    stats.received++;
+    if (message.size() < 3) {
+        stats.undecodable++;
+        return;
+    }
+    const auto type = static_cast<uint8_t>(message[0]);
+    const uint16_t sequence = ReadU16LE(message.data() + 1);
+    message = message.subspan(3);
+    if (window.IsOutOfWindow(sequence)) {
+        // its history slot belongs to a newer snapshot, which may still be a baseline
+        stats.stale++;
+        return;
+    }
+
+    const std::vector<char>* baseline = nullptr;
+    if (type == SNAPSHOT_DELTA) {
+        if (message.size() < 2 || !(baseline = history.Find(ReadU16LE(message.data())))) {
+            stats.undecodable++;
+            return;
+        }
+        message = message.subspan(2);
+    } else if (type != SNAPSHOT_FULL) {
+        stats.undecodable++;
+        return;
+    }
+
+    uint64_t stateSize;
+    if (!ReadVarint(message, stateSize) || stateSize > MAX_SNAPSHOT_SIZE ||
+        !DecodeSnapshotDelta(baseline ? std::span<const char>(*baseline) : std::span<const char>(), message, stateSize, decoded)) {
+        stats.undecodable++;
+        return;
+    }
+
+    // decoded snapshots can serve as baselines, even one that arrived too late to be applied
+    history.Insert(sequence) = decoded;
+    window.Record(sequence);
+
+    char ack[SNAPSHOT_ACK_SIZE];
+    ack[0] = static_cast<char>(SNAPSHOT_ACK);
+    WriteU16LE(window.latestID, ack + 1);
+    for (int i = 0; i < 8; ++i) {
+        ack[3 + i] = static_cast<char>(window.received >> (8 * i));
+    }
+    stream.SendData(ack);
+
+    if (lastApplied && static_cast<int16_t>(sequence - *lastApplied) <= 0) {
+        stats.stale++;
+        return;
+    }
+    lastApplied = sequence;
+    stats.applied++;
+    handler(sequence, decoded);
+}
@@ -1,27 +1,60 @@
 ﻿#include "stream.h"
-#include <iostream>
+#include "log.h"
+#include <string_view>
 #include <utility>
 
 
-Stream::Stream(uint32_t ID, std::string ip, int port, Falcon &falcon)
-    : streamID(ID), targetIP(std::move(ip)), targetPort(port), falcon(falcon)
+Stream::Stream(uint32_t ID, uint64_t clientID, const Endpoint& target, Falcon &falcon, const CompressionOptions& compression)
+    : streamID(ID), clientID(clientID), target(target), falcon(falcon), lifetime(falcon.m_lifetime), compression(compression)
 {
 }
 
-Stream::~Stream() = default;
+Stream::~Stream()
+{
+    Falcon* owner;
+    {
+        std::lock_guard lock(lifetime->mutex);
+        owner = lifetime->falcon;
+        if (!owner) {
+            return;
+        }
+        lifetime->pins++;
+    }
+    // a handler holding the registry lock may be destroying a stream of the same Falcon right now
+    owner->UnregisterStream(*this);
+    std::lock_guard lock(lifetime->mutex);
+    if (--lifetime->pins == 0) {
+        lifetime->unpinned.notify_all();
+    }
+}
 
 void Stream::SendData(std::span<const char> data)
 {
-    int sent = falcon.SendTo(targetIP, targetPort, data);
+    int sent;
+    std::vector<char> compressed;
+    if (compression.enabled && falcon.CompressPayload(data, compression.dictionaryID, compressed)) {
+        sent = falcon.ScheduleStreamData(streamID, clientID, target, compressed, true, priority);
+    } else {
+        sent = falcon.ScheduleStreamData(streamID, clientID, target, data, false, priority);
+    }
 
     if (sent < 0) {
-        std::cerr << "Failed to send data to " << targetIP << ":" << targetPort << "\n";
-    } else {
-        std::cout << "Data sent to " << targetIP << ":" << targetPort << "\n";
+        FALCON_LOG_ERROR(LogCategory::Stream, "Failed to send data to {}", target.ToString());
     }
 }
 
-void Stream::OnDataReceived(std::span<const char> data)
+void Stream::OnDataReceived(const std::function<void(std::span<const char>)> &handler)
+{
+    onDataReceivedHandlers.push_back(handler);
+}
+
+void Stream::HandleDataReceived(std::span<const char> data)
 {
-    std::cout << "Received data :\n" << std::string(data.begin(), data.end()) << "\n";
+    if (onDataReceivedHandlers.empty()) {
+        FALCON_LOG_DEBUG(LogCategory::Stream, "Received data on stream {} with no handler: {}", streamID, std::string_view(data.data(), data.size()));
+        return;
+    }
+    for (const auto& handler : onDataReceivedHandlers) {
+        handler(data);
+    }
 }
@@ -0,0 +1,62 @@
+#include "timer_queue.h"
+
+
+TimerQueue::TimerID TimerQueue::Schedule(Clock::time_point deadline, std::function<void()> callback)
+{
+    std::lock_guard lock(mutex);
+    const TimerID id = nextID++;
+    callbacks.emplace(id, std::move(callback));
+    heap.push({deadline, id});
+    return id;
+}
+
+bool TimerQueue::Cancel(TimerID id)
+{
+    std::lock_guard lock(mutex);
+    return callbacks.erase(id) > 0;
+}
+
+size_t TimerQueue::RunExpired(Clock::time_point now)
+{
+    size_t fired = 0;
+    while (true) {
+        std::function<void()> callback;
+        {
+            std::lock_guard lock(mutex);
+            DropCancelled();
+            if (heap.empty() || heap.top().deadline > now) {
+                return fired;
+            }
+            const auto it = callbacks.find(heap.top().id);
+            callback = std::move(it->second);
+            callbacks.erase(it);
+            heap.pop();
+        }
+        // callbacks may schedule or cancel timers
+        callback();
+        ++fired;
+    }
+}
+
+std::optional<TimerQueue::Clock::time_point> TimerQueue::NextDeadline()
+{
+    std::lock_guard lock(mutex);
+    DropCancelled();
+    if (heap.empty()) {
+        return std::nullopt;
+    }
+    return heap.top().deadline;
+}
+
+size_t TimerQueue::size() const
+{
+    std::lock_guard lock(mutex);
+    return callbacks.size();
+}
+
+void TimerQueue::DropCancelled()
+{
+    while (!heap.empty() && !callbacks.contains(heap.top().id)) {
+        heap.pop();
+    }
+}
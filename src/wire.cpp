@@ -0,0 +1,143 @@
+#include "wire.h"
+
+#include "falcon.h"
+
+
+static constexpr uint8_t FLAG_RELIABLE = 1 << 0;
+static constexpr uint8_t FLAG_SERVER = 1 << 1;
+static constexpr uint8_t FLAG_FRAGMENT = 1 << 2;
+static constexpr uint8_t FLAG_COMPRESSED = 1 << 3;
+static constexpr uint32_t STREAM_FLAG_BITS = RELIABLESTREAMMASK | SERVERSTREAMMASK | ORDEREDSTREAMMASK;
+
+size_t WriteVarint(uint64_t value, char* out)
+{
+    size_t size = 0;
+    while (value >= 0x80) {
+        out[size++] = static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out[size++] = static_cast<char>(value);
+    return size;
+}
+
+bool ReadVarint(std::span<const char>& in, uint64_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < in.size() && i < MAX_VARINT_SIZE; ++i) {
+        const auto byte = static_cast<uint8_t>(in[i]);
+        value |= static_cast<uint64_t>(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            in = in.subspan(i + 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WriteU16LE(uint16_t value, char* out)
+{
+    out[0] = static_cast<char>(value & 0xFF);
+    out[1] = static_cast<char>(value >> 8);
+}
+
+uint16_t ReadU16LE(const char* in)
+{
+    return static_cast<uint16_t>(static_cast<uint8_t>(in[0]) | static_cast<uint8_t>(in[1]) << 8);
+}
+
+size_t EncodeStandardHeader(const StandardHeader& header, char* out)
+{
+    uint8_t flags = 0;
+    if (header.streamID & RELIABLESTREAMMASK) {
+        flags |= FLAG_RELIABLE;
+    }
+    if (header.streamID & SERVERSTREAMMASK) {
+        flags |= FLAG_SERVER;
+    }
+    if (header.IsFragment()) {
+        flags |= FLAG_FRAGMENT;
+    }
+    if (header.compressed) {
+        flags |= FLAG_COMPRESSED;
+    }
+
+    size_t size = 0;
+    out[size++] = static_cast<char>(MSG_STANDARD);
+    out[size++] = static_cast<char>(WIRE_VERSION << 4 | flags);
+    size += WriteVarint(header.clientID, out + size);
+    size += WriteVarint(uint64_t(header.streamID & ~STREAM_FLAG_BITS) << 1 | (header.streamID & ORDEREDSTREAMMASK ? 1 : 0), out + size);
+    WriteU16LE(header.sequence, out + size);
+    size += 2;
+    if (header.IsFragment()) {
+        size += WriteVarint(header.fragmentIndex, out + size);
+        size += WriteVarint(header.fragmentCount, out + size);
+        size += WriteVarint(header.fragmentSize, out + size);
+    }
+    size += WriteVarint(header.payloadSize, out + size);
+    return size;
+}
+
+size_t DecodeStandardHeader(std::span<const char> in, StandardHeader& header)
+{
+    const size_t total = in.size();
+    if (total < 2 || static_cast<uint8_t>(in[0]) != MSG_STANDARD) {
+        return 0;
+    }
+    const auto versionAndFlags = static_cast<uint8_t>(in[1]);
+    if (versionAndFlags >> 4 != WIRE_VERSION) {
+        return 0;
+    }
+    in = in.subspan(2);
+
+    uint64_t streamID;
+    uint64_t payloadSize;
+    if (!ReadVarint(in, header.clientID) || !ReadVarint(in, streamID) || streamID >> 1 & ~uint64_t(~STREAM_FLAG_BITS)) {
+        return 0;
+    }
+    if (in.size() < 2) {
+        return 0;
+    }
+    header.sequence = ReadU16LE(in.data());
+    in = in.subspan(2);
+
+    header.fragmentIndex = 0;
+    header.fragmentCount = 0;
+    header.fragmentSize = 0;
+    if (versionAndFlags & FLAG_FRAGMENT) {
+        uint64_t index, count, fragmentSize;
+        if (!ReadVarint(in, index) || !ReadVarint(in, count) || !ReadVarint(in, fragmentSize)) {
+            return 0;
+        }
+        if (count < 2 || count > UINT32_MAX || index >= count || fragmentSize == 0 || fragmentSize > UINT32_MAX) {
+            return 0;
+        }
+        header.fragmentIndex = static_cast<uint32_t>(index);
+        header.fragmentCount = static_cast<uint32_t>(count);
+        header.fragmentSize = static_cast<uint32_t>(fragmentSize);
+    }
+
+    if (!ReadVarint(in, payloadSize) || payloadSize > UINT32_MAX) {
+        return 0;
+    }
+    if (header.IsFragment()) {
+        // only the last fragment may be shorter, and none is empty
+        const bool last = header.fragmentIndex == header.fragmentCount - 1;
+        if (last ? payloadSize == 0 || payloadSize > header.fragmentSize : payloadSize != header.fragmentSize) {
+            return 0;
+        }
+    }
+
+    header.streamID = static_cast<uint32_t>(streamID >> 1);
+    if (streamID & 1) {
+        header.streamID |= ORDEREDSTREAMMASK;
+    }
+    if (versionAndFlags & FLAG_RELIABLE) {
+        header.streamID |= RELIABLESTREAMMASK;
+    }
+    if (versionAndFlags & FLAG_SERVER) {
+        header.streamID |= SERVERSTREAMMASK;
+    }
+    header.payloadSize = static_cast<uint32_t>(payloadSize);
+    header.compressed = versionAndFlags & FLAG_COMPRESSED;
+    return total - in.size();
+}
@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <set>
 #include <string>
 #include <span>
 #include <thread>
@@ -5,6 +10,12 @@
 #include <catch2/catch_test_macros.hpp>
 
 #include "falcon.h"
+#include "flat_hash_map.h"
+#include "log.h"
+#include "lz_codec.h"
+#include "sharded_server.h"
+#include "siphash.h"
+#include "snapshot_replicator.h"
 #include "spdlog/spdlog.h"
 
 TEST_CASE("Can Listen", "[falcon]") {
@@ -122,11 +133,1603 @@ TEST_CASE("Stream sends and receives data", "[Stream]") {
         hasReceivedData = true;
     });
 
-    clientStream->SendData(Falcon::SerializeMessage(MsgStandard{MSG_STANDARD, 0, 0,0, "Hello, World!"}));
+    clientStream->SendData(std::string("Hello, World!"));
 
     std::this_thread::sleep_for(std::chrono::seconds(1));
 
     client->CloseStream(*clientStream);
 
     REQUIRE(hasReceivedData == true);
-}
\ No newline at end of file
+}
+TEST_CASE("Batched I/O connects and reports batch sizes", "[falcon]") {
+    spdlog::set_level(spdlog::level::debug);
+
+    FalconConfig config;
+    config.ioBatchSize = 16;
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    const auto client = std::make_unique<Falcon>(config);
+
+    bool connectionSuccess = false;
+
+    client->OnConnectionEvent([&](bool success, uint64_t id) {
+        connectionSuccess = success;
+    });
+
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    REQUIRE(connectionSuccess == true);
+
+    const FalconStats serverStats = server->GetStats();
+    REQUIRE(serverStats.datagramsReceived >= 1);
+    REQUIRE(serverStats.maxReceiveBatch >= 1);
+    REQUIRE(serverStats.maxSendBatch >= 1);
+    REQUIRE(client->GetStats().datagramsReceived >= 1);
+}
+
+TEST_CASE("Packet pool hands out and recycles buffers", "[PacketPool]") {
+    PacketPool pool(64, 2);
+
+    PacketHandle first = pool.Acquire();
+    PacketHandle second = pool.Acquire();
+    REQUIRE(first);
+    REQUIRE(second);
+    REQUIRE(first.data() != second.data());
+    REQUIRE(first.capacity() == 64);
+    REQUIRE(pool.Available() == 0);
+    REQUIRE_FALSE(pool.Acquire());
+
+    // copies share the buffer, it only goes back to the pool with the last handle
+    PacketHandle copy = first;
+    first = {};
+    REQUIRE(pool.Available() == 0);
+    copy = {};
+    REQUIRE(pool.Available() == 1);
+
+    PacketHandle third = pool.Acquire();
+    REQUIRE(third);
+    REQUIRE(pool.Available() == 0);
+}
+
+TEST_CASE("Endpoints compare and hash without strings", "[Endpoint]") {
+    const Endpoint v4 = Endpoint::Parse("127.0.0.1", 5555);
+    const Endpoint mapped = Endpoint::Parse("::ffff:127.0.0.1", 5555);
+    const Endpoint v6 = Endpoint::Parse("::1", 5555);
+
+    REQUIRE(v4.IsValid());
+    REQUIRE(v4 == mapped);
+    REQUIRE(v4.Hash() == mapped.Hash());
+    REQUIRE_FALSE(v4 == Endpoint::Parse("127.0.0.1", 5556));
+    REQUIRE(v6.GetFamily() == Endpoint::Family::IPv6);
+    REQUIRE(v4.ToString() == "127.0.0.1:5555");
+    REQUIRE(v6.ToString() == "[::1]:5555");
+    REQUIRE_FALSE(Endpoint::Parse("not an ip", 5555).IsValid());
+}
+
+TEST_CASE("Dual-stack server accepts IPv4 clients", "[falcon]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("::", 5555);
+    REQUIRE(server != nullptr);
+
+    const auto client = std::make_unique<Falcon>();
+    bool connectionSuccess = false;
+    client->OnConnectionEvent([&](bool success, uint64_t id) {
+        connectionSuccess = success;
+    });
+
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    REQUIRE(connectionSuccess == true);
+}
+
+TEST_CASE("Client table keeps its endpoint index in sync", "[ClientTable]") {
+    ClientTable table;
+    const Endpoint first = Endpoint::Parse("127.0.0.1", 6000);
+    const Endpoint second = Endpoint::Parse("127.0.0.1", 6001);
+
+    table.Add({1, first, false, std::chrono::steady_clock::now()});
+    table.Add({2, second, false, std::chrono::steady_clock::now()});
+
+    REQUIRE(table.FindByEndpoint(first)->ID == 1);
+    REQUIRE(table.FindByEndpoint(second)->ID == 2);
+
+    REQUIRE(table.Erase(1));
+    REQUIRE(table.FindByEndpoint(first) == nullptr);
+    REQUIRE(table.Find(1) == nullptr);
+    REQUIRE(table.size() == 1);
+}
+
+TEST_CASE("Timer queue fires expired timers in deadline order", "[TimerQueue]") {
+    TimerQueue timers;
+    const auto now = TimerQueue::Clock::now();
+    std::vector<int> fired;
+
+    timers.Schedule(now + std::chrono::milliseconds(20), [&] { fired.push_back(2); });
+    timers.Schedule(now + std::chrono::milliseconds(10), [&] { fired.push_back(1); });
+    const auto cancelled = timers.Schedule(now + std::chrono::milliseconds(5), [&] { fired.push_back(0); });
+    timers.Schedule(now + std::chrono::seconds(10), [&] { fired.push_back(3); });
+
+    REQUIRE(timers.Cancel(cancelled));
+    REQUIRE(timers.NextDeadline() == now + std::chrono::milliseconds(10));
+    REQUIRE(timers.RunExpired(now + std::chrono::milliseconds(30)) == 2);
+    REQUIRE(fired == std::vector<int>{1, 2});
+    REQUIRE(timers.size() == 1);
+}
+
+TEST_CASE("Keep-alive intervals are configurable", "[falcon]") {
+    FalconConfig config;
+    config.pingInterval = std::chrono::milliseconds(50);
+    config.timeout = std::chrono::milliseconds(200);
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    auto client = std::make_unique<Falcon>(config);
+
+    std::atomic<bool> connected = false;
+    std::atomic<bool> clientDisconnected = false;
+    std::atomic<bool> serverLost = false;
+
+    server->OnClientDisconnected([&](uint64_t id) { clientDisconnected = true; });
+    client->OnConnectionEvent([&](bool success, uint64_t id) { connected = success; });
+    client->OnDisconnect([&] { serverLost = true; });
+
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+
+    // idle for many ping intervals, pings and pongs keep both sides alive
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    REQUIRE(connected == true);
+    REQUIRE(clientDisconnected == false);
+    REQUIRE(serverLost == false);
+
+    client.reset();
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    REQUIRE(clientDisconnected == true);
+}
+
+TEST_CASE("Sequence buffers track the reliable window", "[SequenceBuffer]") {
+    SequenceBuffer<int, RELIABLE_WINDOW> sent;
+    sent.Insert(3) = 30;
+    sent.Insert(250) = 2500;
+
+    REQUIRE(*sent.Find(3) == 30);
+    REQUIRE(sent.Find(3 + RELIABLE_WINDOW) == nullptr);
+    REQUIRE_FALSE(sent.IsFree(3 + RELIABLE_WINDOW));
+    sent.Remove(3);
+    REQUIRE(sent.IsFree(3 + RELIABLE_WINDOW));
+
+    // the receive window keeps working across the uint16_t messageID wrap
+    ReceiveWindow received;
+    received.Record(65534);
+    received.Record(1);
+    received.Record(65535);
+    REQUIRE(received.latestID == 1);
+    REQUIRE(received.received == (RELIABLE_ACK_MASK | RELIABLE_ACK_MASK >> 2 | RELIABLE_ACK_MASK >> 3));
+}
+
+TEST_CASE("RTT estimator follows RFC 6298", "[RttEstimator]") {
+    using namespace std::chrono_literals;
+    RttEstimator rtt(1000ms, 100ms, 10000ms);
+    REQUIRE_FALSE(rtt.HasSample());
+    REQUIRE(rtt.Timeout() == 1000ms);
+
+    rtt.AddSample(200ms);
+    REQUIRE(rtt.SmoothedRtt() == 200ms);
+    REQUIRE(rtt.RttVariance() == 100ms);
+    REQUIRE(rtt.Timeout() == 600ms);
+
+    rtt.AddSample(100ms);
+    REQUIRE(rtt.SmoothedRtt() == 187500us);
+    REQUIRE(rtt.RttVariance() == 100ms);
+
+    rtt.Backoff();
+    REQUIRE(rtt.Timeout() == 2 * (187500us + 400ms));
+    for (int i = 0; i < 10; ++i) {
+        rtt.Backoff();
+    }
+    REQUIRE(rtt.Timeout() == 10000ms);
+}
+
+TEST_CASE("Reliable streams are acked and measure RTT", "[Stream]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto clientStream = client->CreateStream(true);
+    const std::string payload = "reliable";
+    for (int i = 0; i < 5; ++i) {
+        clientStream->SendData(payload);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const auto rtt = client->GetRtt();
+    REQUIRE(rtt.has_value());
+    REQUIRE(rtt->SmoothedRtt() < std::chrono::milliseconds(100));
+    REQUIRE(client->GetStats().retransmissions == 0);
+    REQUIRE(client->GetStats().fastRetransmissions == 0);
+
+    client->CloseStream(*clientStream);
+}
+
+TEST_CASE("Stream messages use the compact wire format", "[Wire]") {
+    char buffer[MAX_STANDARD_HEADER_SIZE];
+    const StandardHeader header{42, 7 | RELIABLESTREAMMASK | SERVERSTREAMMASK, 0xBEEF, 16};
+    const size_t size = EncodeStandardHeader(header, buffer);
+
+    // a 16 byte position update costs 16 bytes plus a 7 byte header
+    REQUIRE(size == 7);
+    REQUIRE(static_cast<uint8_t>(buffer[0]) == MSG_STANDARD);
+    REQUIRE(static_cast<uint8_t>(buffer[4]) == 0xEF); // little endian sequence
+    REQUIRE(static_cast<uint8_t>(buffer[5]) == 0xBE);
+
+    StandardHeader decoded{};
+    REQUIRE(DecodeStandardHeader({buffer, size}, decoded) == size);
+    REQUIRE(decoded.clientID == header.clientID);
+    REQUIRE(decoded.streamID == header.streamID);
+    REQUIRE(decoded.sequence == header.sequence);
+    REQUIRE(decoded.payloadSize == header.payloadSize);
+
+    // the ordered bit still fits a small stream ID in one varint byte
+    const StandardHeader ordered{42, 7 | RELIABLESTREAMMASK | ORDEREDSTREAMMASK, 1, 16};
+    REQUIRE(EncodeStandardHeader(ordered, buffer) == 7);
+    REQUIRE(DecodeStandardHeader({buffer, 7}, decoded) == 7);
+    REQUIRE(decoded.streamID == ordered.streamID);
+    REQUIRE(EncodeStandardHeader(header, buffer) == size);
+
+    // truncated headers and other versions are rejected
+    REQUIRE(DecodeStandardHeader({buffer, size - 1}, decoded) == 0);
+    buffer[1] = static_cast<char>((WIRE_VERSION + 1) << 4);
+    REQUIRE(DecodeStandardHeader({buffer, size}, decoded) == 0);
+
+    char varint[MAX_VARINT_SIZE];
+    REQUIRE(WriteVarint(UINT64_MAX, varint) == MAX_VARINT_SIZE);
+    std::span<const char> in(varint, MAX_VARINT_SIZE);
+    uint64_t value = 0;
+    REQUIRE(ReadVarint(in, value));
+    REQUIRE(value == UINT64_MAX);
+    REQUIRE(in.empty());
+}
+
+TEST_CASE("Coalesced messages share datagrams", "[falcon]") {
+    FalconConfig config;
+    config.coalesceMessages = true;
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    const auto client = std::make_unique<Falcon>(config);
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto clientStream = client->CreateStream(true);
+    const uint64_t sentBefore = client->GetStats().datagramsSent;
+    const uint64_t receivedBefore = server->GetStats().datagramsReceived;
+
+    const std::string update(16, 'x');
+    for (int i = 0; i < 20; ++i) {
+        clientStream->SendData(update);
+    }
+    client->Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // 20 messages of 16 bytes fit in a single datagram, the server unpacks and acks all of them
+    REQUIRE(client->GetStats().datagramsSent - sentBefore == 1);
+    REQUIRE(client->GetStats().messagesCoalesced == 20);
+    REQUIRE(server->GetStats().datagramsReceived - receivedBefore == 1);
+    REQUIRE(client->GetRtt().has_value());
+
+    client->CloseStream(*clientStream);
+}
+
+TEST_CASE("Large messages are fragmented and reassembled", "[Stream]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto reliableStream = client->CreateStream(true);
+    auto unreliableStream = client->CreateStream(false);
+    reliableStream->SendData(std::string(6000, 'r'));
+    unreliableStream->SendData(std::string(3000, 'u'));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    REQUIRE(client->GetStats().messagesFragmented == 2);
+    REQUIRE(server->GetStats().messagesReassembled == 2);
+    REQUIRE(server->GetStats().reassembliesDropped == 0);
+
+    client->CloseStream(*reliableStream);
+    client->CloseStream(*unreliableStream);
+}
+
+TEST_CASE("Late duplicate fragments don't start a new reassembly", "[Stream]") {
+    FalconConfig serverConfig;
+    serverConfig.reassemblyTimeout = std::chrono::milliseconds(300);
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, serverConfig);
+    // every fragment twice, one copy of many held back until its message was complete
+    FalconConfig clientConfig;
+    clientConfig.simulation.enabled = true;
+    clientConfig.simulation.duplicateRate = 1;
+    clientConfig.simulation.reorderRate = 0.3;
+    clientConfig.simulation.reorderDelay = std::chrono::milliseconds(50);
+    const auto client = std::make_unique<Falcon>(clientConfig);
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto stream = client->CreateStream(false);
+    for (int i = 0; i < 20; ++i) {
+        stream->SendData(std::string(3000, static_cast<char>('a' + i)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(800));
+
+    const FalconStats stats = server->GetStats();
+    REQUIRE(stats.messagesReassembled == 20);
+    REQUIRE(stats.reassembliesDropped == 0);
+    REQUIRE(stats.clients.size() == 1);
+    REQUIRE(stats.clients.front().duplicates > 0);
+
+    client->CloseStream(*stream);
+}
+
+TEST_CASE("Fragment headers round trip", "[Wire]") {
+    char buffer[MAX_STANDARD_HEADER_SIZE];
+    StandardHeader header{3, 1 | RELIABLESTREAMMASK, 100, 500, 4, 5, 1100};
+    StandardHeader decoded{};
+    REQUIRE(DecodeStandardHeader({buffer, EncodeStandardHeader(header, buffer)}, decoded) > 0);
+    REQUIRE(decoded.fragmentIndex == 4);
+    REQUIRE(decoded.fragmentCount == 5);
+    REQUIRE(decoded.fragmentSize == 1100);
+
+    // only the last fragment may be shorter than the others
+    header.fragmentIndex = 3;
+    REQUIRE(DecodeStandardHeader({buffer, EncodeStandardHeader(header, buffer)}, decoded) == 0);
+    header.fragmentIndex = 5;
+    REQUIRE(DecodeStandardHeader({buffer, EncodeStandardHeader(header, buffer)}, decoded) == 0);
+}
+
+TEST_CASE("Sharded server spreads clients over its shards", "[ShardedServer]") {
+    const std::unique_ptr<ShardedServer> server = ShardedServer::Listen("127.0.0.1", 5557, 4);
+    REQUIRE(server != nullptr);
+    REQUIRE(server->ShardCount() == 4);
+
+    std::mutex connectedMutex;
+    std::vector<uint64_t> connected;
+    server->OnClientConnected([&](uint64_t id) {
+        std::lock_guard lock(connectedMutex);
+        connected.push_back(id);
+    });
+
+    std::vector<std::unique_ptr<Falcon>> clients;
+    for (int i = 0; i < 8; ++i) {
+        clients.push_back(std::make_unique<Falcon>());
+        REQUIRE_NOTHROW(clients.back()->ConnectTo("127.0.0.1", 5557));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    {
+        std::lock_guard lock(connectedMutex);
+        REQUIRE(connected.size() == 8);
+        std::sort(connected.begin(), connected.end());
+        REQUIRE(std::adjacent_find(connected.begin(), connected.end()) == connected.end());
+    }
+
+    for (const auto& client : clients) {
+        // each client talks to a single shard, which owns its ID and answers from the shared port
+        const uint64_t id = client->GetClientInfoFromServer().ID;
+        REQUIRE(id != 0);
+        REQUIRE(server->GetClient(id).ID == id);
+    }
+    REQUIRE(server->GetStats().datagramsReceived >= 8);
+
+    // stream handlers reach every shard
+    std::atomic<int> received = 0;
+    server->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char>) { received++; });
+    });
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (const auto& client : clients) {
+        streams.push_back(client->CreateStream(true));
+        streams.back()->SendData(std::string("hello"));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    REQUIRE(received == 8);
+    for (size_t i = 0; i < streams.size(); ++i) {
+        clients[i]->CloseStream(*streams[i]);
+    }
+}
+
+TEST_CASE("Pongs give RTT samples only for timestamps we could have sent", "[Connection]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    std::atomic<uint64_t> clientID = 0;
+    server->OnClientConnected([&](uint64_t id) { clientID = id; });
+    const auto client = std::make_unique<Falcon>();
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    const auto now = std::chrono::steady_clock::now();
+    const auto sendPong = [](Falcon& from, std::chrono::steady_clock::time_point time) {
+        MessageBuffer<Ping> buffer;
+        REQUIRE(from.SendTo("127.0.0.1", 5555, {buffer.data(), Falcon::SerializeMessage(Ping{PONG, 0, 0, time}, buffer)}) > 0);
+    };
+    // from an endpoint that isn't connected, and from the client with timestamps from the future and the past
+    const std::unique_ptr<Falcon> stranger = Falcon::Listen("127.0.0.1", 5556);
+    sendPong(*stranger, now - std::chrono::milliseconds(20));
+    sendPong(*client, now + std::chrono::hours(1));
+    sendPong(*client, now - std::chrono::hours(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE_FALSE(server->GetRtt(0).has_value());
+    REQUIRE_FALSE(server->GetRtt(clientID).has_value());
+
+    sendPong(*client, std::chrono::steady_clock::now() - std::chrono::milliseconds(20));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(server->GetRtt(clientID).has_value());
+}
+
+TEST_CASE("Streams may be destroyed after their Falcon", "[Stream]") {
+    auto client = std::make_unique<Falcon>();
+    auto stream = client->CreateStream(true);
+    client.reset();
+    // unregistering from the destroyed Falcon would be a use after free
+    stream.reset();
+    REQUIRE(stream == nullptr);
+}
+
+TEST_CASE("Streams closed by handlers and by the application don't deadlock", "[Stream]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    // the handler runs under the registry lock and destroys the stream the peer opened
+    std::atomic<int> opened = 0;
+    server->OnStreamOpened([&](Stream& stream) {
+        server->CloseStream(stream);
+        opened++;
+    });
+    std::atomic<uint64_t> clientID = 0;
+    server->OnClientConnected([&](uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    std::atomic<bool> running = true;
+    std::thread churn([&]() {
+        while (running) {
+            auto stream = server->CreateStream(clientID, false);
+        }
+    });
+    std::vector<std::unique_ptr<Stream>> streams;
+    for (int i = 0; i < 200; ++i) {
+        streams.push_back(client->CreateStream(false));
+        streams.back()->SendData(std::to_string(i));
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    running = false;
+    churn.join();
+    REQUIRE(opened == 200);
+}
+
+TEST_CASE("SPSC queue hands values over in order", "[SpscQueue]") {
+    SpscQueue<int> queue(64);
+    REQUIRE(queue.Capacity() == 64);
+
+    constexpr int count = 100000;
+    std::thread producer([&queue]() {
+        for (int i = 0; i < count; ++i) {
+            int value = i;
+            while (!queue.TryPush(std::move(value))) {
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    int expected = 0;
+    int value;
+    bool inOrder = true;
+    while (expected < count) {
+        if (queue.TryPop(value)) {
+            inOrder &= value == expected;
+            ++expected;
+        }
+    }
+    producer.join();
+    REQUIRE(inOrder);
+    REQUIRE_FALSE(queue.TryPop(value));
+}
+
+TEST_CASE("Poll mode runs handlers on the polling thread", "[falcon]") {
+    FalconConfig config;
+    config.pollEvents = true;
+    config.eventQueueSize = 2; // small enough to spill into the overflow
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    const auto client = std::make_unique<Falcon>(config);
+
+    const auto pollingThread = std::this_thread::get_id();
+    std::vector<uint64_t> connected;
+    int streamsCreated = 0;
+    bool onPollingThread = true;
+    server->OnClientConnected([&](uint64_t id) {
+        onPollingThread &= std::this_thread::get_id() == pollingThread;
+        connected.push_back(id);
+    });
+    server->OnStreamCreated([&](uint32_t) {
+        onPollingThread &= std::this_thread::get_id() == pollingThread;
+        streamsCreated++;
+    });
+
+    uint64_t clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // nothing runs until polled
+    REQUIRE(connected.empty());
+    REQUIRE(clientID == 0);
+    REQUIRE(client->Poll() == 1);
+    REQUIRE(clientID != 0);
+    REQUIRE(client->GetClientInfoFromServer().ID == clientID);
+
+    auto clientStream = client->CreateStream(false);
+    for (int i = 0; i < 5; ++i) {
+        clientStream->SendData(std::string("update"));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    // connection and 5 messages (the first one opens the stream), in order even though most went through the overflow
+    REQUIRE(server->Poll(1) == 1);
+    REQUIRE(connected == std::vector<uint64_t>{clientID});
+    REQUIRE(server->GetClient(clientID).ID == clientID);
+    REQUIRE(server->Poll() == 5);
+    REQUIRE(streamsCreated == 1);
+    REQUIRE(onPollingThread);
+    REQUIRE(server->Poll() == 0);
+
+    client->CloseStream(*clientStream);
+}
+
+TEST_CASE("Flat hash map keeps entries reachable under churn", "[FlatHashMap]") {
+    FlatHashMap<int> map;
+    for (uint64_t key = 0; key < 1000; ++key) {
+        auto [value, inserted] = map.TryEmplace(key << 32 | 1);
+        REQUIRE(inserted);
+        *value = static_cast<int>(key);
+    }
+    REQUIRE(map.size() == 1000);
+    REQUIRE_FALSE(map.TryEmplace(uint64_t{7} << 32 | 1).second);
+
+    // erase every other entry, the rest must still be found after the backward shifts
+    for (uint64_t key = 0; key < 1000; key += 2) {
+        REQUIRE(map.Erase(key << 32 | 1));
+    }
+    REQUIRE_FALSE(map.Erase(0));
+    REQUIRE(map.size() == 500);
+    bool found = true;
+    for (uint64_t key = 0; key < 1000; ++key) {
+        const int* value = map.Find(key << 32 | 1);
+        found &= key % 2 == 0 ? value == nullptr : value != nullptr && *value == static_cast<int>(key);
+    }
+    REQUIRE(found);
+}
+
+TEST_CASE("Streams deliver data to their own handlers", "[Stream]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::mutex mutex;
+    std::vector<std::string> serverReceived;
+    std::vector<std::string> clientReceived;
+    std::vector<std::unique_ptr<Stream>> replies;
+    server->OnStreamOpened([&](Stream& stream) {
+        // reply on a stream of our own to the client that opened this one
+        replies.push_back(server->CreateStream(stream.clientID, true));
+        Stream* reply = replies.back().get();
+        stream.OnDataReceived([&, reply](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            serverReceived.emplace_back(data.begin(), data.end());
+            reply->SendData(std::string("pong"));
+        });
+    });
+    client->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            clientReceived.emplace_back(data.begin(), data.end());
+        });
+    });
+
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const auto first = client->CreateStream(true);
+    const auto second = client->CreateStream(true);
+    int onSecond = 0;
+    second->OnDataReceived([&](std::span<const char>) { onSecond++; });
+    first->SendData(std::string("ping 1"));
+    second->SendData(std::string("ping 2"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    std::lock_guard lock(mutex);
+    std::ranges::sort(serverReceived);
+    REQUIRE(serverReceived == std::vector<std::string>{"ping 1", "ping 2"});
+    REQUIRE(clientReceived == std::vector<std::string>{"pong", "pong"});
+    // replies come back on the server's streams, not on the ones the client opened
+    REQUIRE(onSecond == 0);
+}
+
+TEST_CASE("Log categories are rate limited", "[Log]") {
+    LogConfig config;
+    config.async = true;
+    config.maxMessagesPerSecond = 5;
+    ConfigureFalconLogging(config);
+    // start from a fresh one second window
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+
+    int allowed = 0;
+    for (int i = 0; i < 50; ++i) {
+        allowed += FalconLogAllowed(LogCategory::Fragmentation);
+    }
+    REQUIRE(allowed == 5);
+    // other categories have their own budget
+    REQUIRE(FalconLogAllowed(LogCategory::Connection));
+
+    ConfigureFalconLogging(LogConfig{});
+}
+
+TEST_CASE("Reconfiguring logging releases the loggers it replaced", "[Log]") {
+    LogConfig config;
+    config.async = true;
+    ConfigureFalconLogging(config);
+    const std::weak_ptr<spdlog::logger> first = spdlog::get("falcon");
+    REQUIRE_FALSE(first.expired());
+
+    // the one just replaced may still be in use by another thread, the one before it is released
+    ConfigureFalconLogging(config);
+    REQUIRE_FALSE(first.expired());
+    for (int i = 0; i < 100; ++i) {
+        ConfigureFalconLogging(config);
+        FalconLogger().info("reconfigured {}", i);
+    }
+    REQUIRE(first.expired());
+
+    ConfigureFalconLogging(LogConfig{});
+}
+
+TEST_CASE("Network simulator replays the same conditions from a seed", "[NetworkSimulator]") {
+    NetworkConditions conditions;
+    conditions.enabled = true;
+    conditions.seed = 42;
+    conditions.lossRate = 0.25;
+    conditions.duplicateRate = 0.1;
+    conditions.latency = std::chrono::milliseconds(20);
+    conditions.jitter = std::chrono::milliseconds(5);
+    conditions.bandwidth = 1000 * 1000;
+
+    const auto run = [&](std::vector<NetworkSimulator::Datagram>& out) {
+        NetworkSimulator simulator(conditions);
+        const auto start = NetworkSimulator::Clock::time_point{};
+        const Endpoint to = Endpoint::Parse("127.0.0.1", 5555);
+        const std::vector<char> data(1000, 'x');
+        for (int i = 0; i < 1000; ++i) {
+            simulator.Submit(to, data, start);
+        }
+        // 1 MB/s moves one datagram per millisecond, the queue holds 100 ms of them
+        REQUIRE(simulator.NextRelease() >= start + std::chrono::milliseconds(15));
+        simulator.TakeDue(start + std::chrono::seconds(1), out);
+        REQUIRE_FALSE(simulator.NextRelease().has_value());
+        return simulator.Lost();
+    };
+
+    std::vector<NetworkSimulator::Datagram> first;
+    std::vector<NetworkSimulator::Datagram> second;
+    const uint64_t lost = run(first);
+    REQUIRE(run(second) == lost);
+    REQUIRE(lost > 850); // random loss plus everything past the queue limit
+    REQUIRE(first.size() == second.size());
+    bool sameReleases = true;
+    for (size_t i = 0; i < first.size(); ++i) {
+        sameReleases &= first[i].release == second[i].release;
+        sameReleases &= i == 0 || first[i - 1].release <= first[i].release;
+    }
+    REQUIRE(sameReleases);
+}
+
+TEST_CASE("Reliable streams deliver everything over a simulated bad network", "[Stream]") {
+    FalconConfig config;
+    config.initialRetransmitTimeout = std::chrono::milliseconds(200);
+    config.minRetransmitTimeout = std::chrono::milliseconds(50);
+    config.simulation.enabled = true;
+    config.simulation.lossRate = 0.2;
+    config.simulation.duplicateRate = 0.1;
+    config.simulation.reorderRate = 0.1;
+    config.simulation.latency = std::chrono::milliseconds(10);
+    config.simulation.jitter = std::chrono::milliseconds(5);
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    config.simulation.seed = 2;
+    const auto client = std::make_unique<Falcon>(config);
+
+    std::mutex mutex;
+    std::multiset<std::string> received;
+    server->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            received.emplace(data.begin(), data.end());
+        });
+    });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto clientStream = client->CreateStream(true);
+    for (int i = 0; i < 50; ++i) {
+        clientStream->SendData(std::to_string(i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+
+    {
+        std::lock_guard lock(mutex);
+        // every message exactly once, even the duplicated ones
+        REQUIRE(received.size() == 50);
+        REQUIRE(std::set<std::string>(received.begin(), received.end()).size() == 50);
+    }
+    const FalconStats stats = client->GetStats();
+    REQUIRE(stats.simulatedLost > 0);
+    REQUIRE(stats.retransmissions + stats.fastRetransmissions > 0);
+
+    client->CloseStream(*clientStream);
+}
+
+TEST_CASE("Latency histograms keep percentiles within a bucket", "[Metrics]") {
+    LatencyHistogram histogram;
+    for (uint64_t value = 1; value <= 10000; ++value) {
+        histogram.Record(value);
+    }
+    const LatencyHistogram::Snapshot snapshot = histogram.Read();
+    REQUIRE(snapshot.count == 10000);
+    REQUIRE(snapshot.max == 10000);
+    REQUIRE(snapshot.Mean() == 5000.5);
+    // 1/16 relative precision
+    REQUIRE(snapshot.Percentile(0.5) >= 5000);
+    REQUIRE(snapshot.Percentile(0.5) <= 5000 + 5000 / 16);
+    REQUIRE(snapshot.Percentile(0.99) >= 9900);
+    REQUIRE(snapshot.Percentile(0.99) <= 9900 + 9900 / 16);
+    REQUIRE(snapshot.Percentile(1.0) == 10000);
+    // small values are exact, huge ones are clamped to the last bucket
+    REQUIRE(LatencyHistogram::BucketUpperBound(LatencyHistogram::BucketOf(17)) == 17);
+    REQUIRE(LatencyHistogram::BucketOf(UINT64_MAX) == LatencyHistogram::BUCKET_COUNT - 1);
+    bool boundsHold = true;
+    for (uint64_t value = 0; value < 100000; value += 7) {
+        const size_t bucket = LatencyHistogram::BucketOf(value);
+        boundsHold &= value <= LatencyHistogram::BucketUpperBound(bucket);
+        boundsHold &= bucket == 0 || value > LatencyHistogram::BucketUpperBound(bucket - 1);
+    }
+    REQUIRE(boundsHold);
+}
+
+TEST_CASE("Stats report per connection and per stream counters", "[Metrics]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto reliable = client->CreateStream(true);
+    auto unreliable = client->CreateStream(false);
+    for (int i = 0; i < 10; ++i) {
+        reliable->SendData(std::string("0123456789"));
+        unreliable->SendData(std::string("01234"));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const FalconStats clientStats = client->GetStats();
+    REQUIRE(clientStats.clients.size() == 1);
+    const ClientStats& connection = clientStats.clients[0];
+    REQUIRE(connection.clientID == clientID);
+    REQUIRE(connection.streams.size() == 2);
+    REQUIRE(connection.packetsSent == 20);
+    REQUIRE(connection.bytesSent == 150);
+    REQUIRE(connection.unacked == 0);
+    REQUIRE(connection.smoothedRtt.has_value());
+    REQUIRE(connection.ackLatency.count == 10);
+    REQUIRE(connection.ackLatency.Percentile(0.99) < 100000);
+
+    const FalconStats serverStats = server->GetStats();
+    const auto served = std::find_if(serverStats.clients.begin(), serverStats.clients.end(), [&](const ClientStats& c) {
+        return c.clientID == clientID;
+    });
+    REQUIRE(served != serverStats.clients.end());
+    REQUIRE(served->packetsReceived == 20);
+    REQUIRE(served->bytesReceived == 150);
+    REQUIRE(served->duplicates == 0);
+
+    client->CloseStream(*reliable);
+    client->CloseStream(*unreliable);
+}
+
+TEST_CASE("Snapshot deltas round trip", "[Snapshot]") {
+    std::vector<char> baseline(1000, 'a');
+    std::vector<char> current = baseline;
+    current[10] = 'b';
+    current[12] = 'c'; // short gap, stays in one changed run
+    current[500] = 'd';
+    current.resize(1100, 'e'); // past the end of the baseline
+
+    std::vector<char> delta;
+    EncodeSnapshotDelta(baseline, current, delta);
+    REQUIRE(delta.size() < 150);
+    std::vector<char> decoded;
+    REQUIRE(DecodeSnapshotDelta(baseline, delta, current.size(), decoded));
+    REQUIRE(decoded == current);
+
+    // a shorter state only keeps the start of the baseline
+    std::vector<char> shorter(baseline.begin(), baseline.begin() + 100);
+    delta.clear();
+    EncodeSnapshotDelta(baseline, shorter, delta);
+    REQUIRE(DecodeSnapshotDelta(baseline, delta, shorter.size(), decoded));
+    REQUIRE(decoded == shorter);
+
+    // truncated deltas are rejected
+    delta.clear();
+    EncodeSnapshotDelta(baseline, current, delta);
+    delta.pop_back();
+    REQUIRE_FALSE(DecodeSnapshotDelta(baseline, delta, current.size(), decoded));
+}
+
+TEST_CASE("Snapshots are replicated as deltas against acked baselines", "[Snapshot]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::mutex mutex;
+    std::vector<char> replica;
+    std::unique_ptr<SnapshotReceiver> receiver;
+    client->OnStreamOpened([&](Stream& stream) {
+        receiver = std::make_unique<SnapshotReceiver>(stream, [&](uint16_t, std::span<const char> state) {
+            std::lock_guard lock(mutex);
+            replica.assign(state.begin(), state.end());
+        });
+    });
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto stream = server->CreateStream(clientID, false);
+    SnapshotReplicator replicator(*stream);
+    // 1000 entities of 8 bytes, a few of them move every tick
+    std::vector<char> world(8000, 0);
+    for (int tick = 0; tick < 60; ++tick) {
+        for (int i = 0; i < 10; ++i) {
+            world[((tick * 10 + i) * 97 % 1000) * 8]++;
+        }
+        replicator.Send(world);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(replica == world);
+    }
+    const SnapshotReplicator::Stats stats = replicator.GetStats();
+    REQUIRE(stats.deltaSnapshots > 50);
+    REQUIRE(stats.bytesSent * 10 < stats.stateBytes);
+    REQUIRE(receiver->GetStats().undecodable == 0);
+}
+
+TEST_CASE("Snapshots older than the ack window don't replace a baseline", "[Snapshot]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+
+    std::mutex mutex;
+    std::vector<uint16_t> applied;
+    std::unique_ptr<SnapshotReceiver> receiver;
+    client->OnStreamOpened([&](Stream& stream) {
+        receiver = std::make_unique<SnapshotReceiver>(stream, [&](uint16_t sequence, std::span<const char>) {
+            std::lock_guard lock(mutex);
+            applied.push_back(sequence);
+        });
+    });
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    // snapshots written by hand, sequence 36 is 64 behind 100 and shares its history slot
+    const std::vector<char> state(8, 'a');
+    std::vector<char> changed = state;
+    changed[3] = 'b';
+    const auto snapshot = [](uint8_t type, uint16_t sequence, std::optional<uint16_t> baseline,
+        std::span<const char> from, std::span<const char> to) {
+        std::vector<char> message = {static_cast<char>(type), static_cast<char>(sequence & 0xFF), static_cast<char>(sequence >> 8)};
+        if (baseline) {
+            message.insert(message.end(), {static_cast<char>(*baseline & 0xFF), static_cast<char>(*baseline >> 8)});
+        }
+        message.push_back(static_cast<char>(to.size()));
+        EncodeSnapshotDelta(from, to, message);
+        return message;
+    };
+    auto stream = server->CreateStream(clientID, false);
+    for (const auto& message : {snapshot(0, 100, std::nullopt, {}, state), snapshot(0, 36, std::nullopt, {}, state),
+            snapshot(1, 101, 100, state, changed)}) {
+        stream->SendData(message);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(applied == std::vector<uint16_t>{100, 101});
+    }
+    const SnapshotReceiver::Stats stats = receiver->GetStats();
+    REQUIRE(stats.stale == 1);
+    REQUIRE(stats.undecodable == 0);
+}
+
+TEST_CASE("LZ codec round trips with and without a dictionary", "[Compression]") {
+    const auto roundTrip = [](const std::string& text, std::span<const char> dictionary) {
+        std::vector<char> block;
+        LzCompress(text, dictionary, block);
+        std::vector<char> decoded;
+        REQUIRE(LzDecompress(block, dictionary, text.size(), decoded));
+        REQUIRE(std::string(decoded.begin(), decoded.end()) == text);
+        return block.size();
+    };
+
+    REQUIRE(roundTrip("", {}) == 0);
+    REQUIRE(roundTrip("abc", {}) > 0);
+    // runs longer than the 255 byte length steps, and matches overlapping what they copy
+    REQUIRE(roundTrip(std::string(5000, 'a'), {}) < 50);
+    std::string inventory;
+    for (int i = 0; i < 200; ++i) {
+        inventory += "{\"item\":\"sword\",\"slot\":" + std::to_string(i % 7) + "}";
+    }
+    REQUIRE(roundTrip(inventory, {}) * 5 < inventory.size());
+
+    // random bytes don't shrink
+    std::string noise(2000, '\0');
+    uint32_t seed = 1;
+    for (char& c : noise) {
+        seed = seed * 1664525 + 1013904223;
+        c = static_cast<char>(seed >> 24);
+    }
+    REQUIRE(roundTrip(noise, {}) >= noise.size());
+
+    // a short message barely compresses alone, a dictionary trained on similar ones helps
+    std::vector<std::vector<char>> samples;
+    for (int i = 0; i < 20; ++i) {
+        const std::string sample = "[chat] player" + std::to_string(i) + " joined the team channel";
+        samples.emplace_back(sample.begin(), sample.end());
+    }
+    const std::vector<char> dictionary = TrainLzDictionary(samples, 256);
+    REQUIRE(!dictionary.empty());
+    REQUIRE(dictionary.size() <= 256);
+    const std::string message = "[chat] player42 joined the team channel";
+    REQUIRE(roundTrip(message, dictionary) * 2 < roundTrip(message, {}));
+
+    // a block that doesn't decode to the announced size is rejected
+    std::vector<char> block;
+    LzCompress(inventory, {}, block);
+    std::vector<char> decoded;
+    REQUIRE_FALSE(LzDecompress(block, {}, inventory.size() - 1, decoded));
+    REQUIRE_FALSE(LzDecompress(std::span<const char>(block).first(block.size() / 2), {}, inventory.size(), decoded));
+}
+
+TEST_CASE("Compressed streams deliver the original messages", "[Compression]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    const auto client = std::make_unique<Falcon>();
+    const std::string dictionary = "[chat] player joined the team channel [chat] player left the team channel ";
+    server->RegisterDictionary(7, dictionary);
+    client->RegisterDictionary(7, dictionary);
+
+    std::mutex mutex;
+    std::vector<std::string> received;
+    server->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            received.emplace_back(data.begin(), data.end());
+        });
+    });
+
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto stream = client->CreateStream(true, {true, 7});
+    std::vector<std::string> sent;
+    for (int i = 0; i < 10; ++i) {
+        sent.push_back("[chat] player" + std::to_string(i) + (i % 2 ? " left" : " joined") + " the team channel");
+    }
+    // compressed, then fragmented
+    std::string level;
+    uint32_t seed = 1;
+    for (int i = 0; i < 20000; ++i) {
+        seed = seed * 1664525 + 1013904223;
+        level += "wall"[seed >> 30];
+    }
+    sent.push_back(level);
+    // doesn't shrink, sent raw
+    sent.emplace_back("x");
+    for (const std::string& message : sent) {
+        stream->SendData(message);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(received == sent);
+    }
+    const FalconStats stats = client->GetStats();
+    REQUIRE(stats.messagesCompressed == 11);
+    REQUIRE(stats.compressionSkipped == 1);
+    REQUIRE(stats.messagesFragmented == 1);
+    REQUIRE(stats.CompressionRatio() > 1.5);
+    REQUIRE(stats.compressionTime.count() > 0);
+    REQUIRE(server->GetStats().decompressionTime.count() > 0);
+
+    client->CloseStream(*stream);
+}
+
+TEST_CASE("Congestion controller backs off on loss and paces sends", "[Congestion]") {
+    using namespace std::chrono_literals;
+    CongestionConfig config;
+    config.initialWindow = 10000;
+    config.minWindow = 2000;
+    config.maxBurst = 4000;
+    CongestionController controller(config, 1000);
+    auto now = std::chrono::steady_clock::now();
+
+    // slow start: the window grows by what is acked
+    for (int i = 0; i < 10; ++i) {
+        REQUIRE(controller.CanSend(now));
+        controller.OnReliableSent(1000, now);
+    }
+    REQUIRE_FALSE(controller.CanSend(now));
+    REQUIRE_FALSE(controller.NextSendTime(now));
+    const auto firstSent = now;
+    now += 100ms;
+    for (int i = 0; i < 10; ++i) {
+        controller.OnAcked(1000, firstSent);
+    }
+    REQUIRE(controller.Window() == 20000);
+    REQUIRE(controller.BytesInFlight() == 0);
+    REQUIRE(controller.InSlowStart());
+
+    // losses of one flight halve the window once
+    controller.OnReliableSent(1000, now);
+    const auto lostSent = now;
+    now += 10ms;
+    controller.OnLoss(lostSent, now);
+    controller.OnLoss(lostSent, now);
+    REQUIRE(controller.Window() == 10000);
+    REQUIRE_FALSE(controller.InSlowStart());
+    REQUIRE(controller.CongestionEvents() == 1);
+    controller.OnAcked(1000, lostSent);
+
+    // then grows by one datagram per window acked
+    now += 10ms;
+    for (int i = 0; i < 10; ++i) {
+        controller.OnReliableSent(1000, now);
+        controller.OnAcked(1000, now);
+    }
+    REQUIRE(controller.Window() == 11000);
+
+    // paced at gain * window / srtt once there is an RTT sample
+    controller.OnRttSample(10ms, 10ms, now);
+    REQUIRE(std::abs(controller.PacingRate() - 2.0 * 11000 / 0.01) < 1);
+    controller.OnUnreliableSent(8000, now); // unreliable sends are never refused, but spend the budget
+    REQUIRE_FALSE(controller.CanSend(now));
+    const auto next = controller.NextSendTime(now);
+    REQUIRE(next);
+    REQUIRE(*next > now);
+    REQUIRE(controller.CanSend(*next));
+
+    // queuing delay shrinks the window, a timeout drops it to the minimum
+    now = *next + 20ms;
+    controller.OnRttSample(100ms, 20ms, now);
+    REQUIRE(controller.Window() == 11000 * 85 / 100);
+    now += 1ms;
+    controller.OnReliableSent(1000, now);
+    const auto timedOut = now;
+    now += 50ms;
+    controller.OnTimeout(timedOut, now);
+    REQUIRE(controller.Window() == 2000);
+}
+
+TEST_CASE("Congestion controller forgets the minimum RTT of an old path", "[Congestion]") {
+    using namespace std::chrono_literals;
+    CongestionConfig config;
+    config.minRttWindow = 1000ms;
+    CongestionController controller(config, 1000);
+    auto now = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < 50; ++i) {
+        controller.OnRttSample(20ms, 20ms, now);
+        now += 10ms;
+    }
+    REQUIRE(controller.CongestionEvents() == 0);
+
+    // the path gets 100 ms longer: taken for a queue while the 20 ms samples are in the window, not after
+    for (int i = 0; i < 120; ++i) {
+        controller.OnRttSample(120ms, 120ms, now);
+        now += 10ms;
+    }
+    const uint64_t events = controller.CongestionEvents();
+    REQUIRE(events > 0);
+    for (int i = 0; i < 200; ++i) {
+        controller.OnRttSample(120ms, 120ms, now);
+        now += 10ms;
+    }
+    REQUIRE(controller.CongestionEvents() == events);
+
+    // a real queue on the new path is still seen
+    controller.OnRttSample(200ms, 130ms, now);
+    REQUIRE(controller.CongestionEvents() == events + 1);
+}
+
+TEST_CASE("Reliable streams back off on a congested link", "[Congestion]") {
+    FalconConfig config;
+    config.initialRetransmitTimeout = std::chrono::milliseconds(200);
+    config.minRetransmitTimeout = std::chrono::milliseconds(50);
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    // a 250 KB/s link with 50 ms of buffer, the reliable window alone would overflow it
+    config.simulation.enabled = true;
+    config.simulation.latency = std::chrono::milliseconds(5);
+    config.simulation.bandwidth = 250 * 1000;
+    config.simulation.maxQueueDelay = std::chrono::milliseconds(50);
+    const auto client = std::make_unique<Falcon>(config);
+
+    std::atomic<int> reliableReceived = 0;
+    std::atomic<int> unreliableReceived = 0;
+    server->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&, reliable = Stream::IsReliable(stream.streamID)](std::span<const char>) {
+            (reliable ? reliableReceived : unreliableReceived)++;
+        });
+    });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto bulk = client->CreateStream(true);
+    auto input = client->CreateStream(false);
+    for (int i = 0; i < 300; ++i) {
+        bulk->SendData(std::string(1000, 'b'));
+        if (i % 10 == 0) {
+            input->SendData("input");
+        }
+    }
+    for (int i = 0; i < 100 && reliableReceived < 300; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    REQUIRE(reliableReceived == 300);
+    REQUIRE(unreliableReceived > 0);
+    const FalconStats stats = client->GetStats();
+    REQUIRE(stats.clients.size() == 1);
+    const ClientStats& connection = stats.clients[0];
+    REQUIRE(connection.congestionEvents > 0);
+    REQUIRE(connection.congestionWindow >= config.congestion.minWindow);
+    REQUIRE(connection.congestionWindow < config.congestion.initialWindow);
+    REQUIRE(connection.pacingRate > 0);
+    REQUIRE(connection.bytesInFlight == 0);
+
+    client->CloseStream(*bulk);
+    client->CloseStream(*input);
+}
+
+TEST_CASE("Send scheduler shares the tick budget by priority and weight", "[Scheduler]") {
+    using namespace std::chrono_literals;
+    SendSchedulerConfig config;
+    config.bytesPerTick = 1000;
+    config.agingInterval = 100ms;
+    SendScheduler scheduler(config);
+    auto now = std::chrono::steady_clock::now();
+    const auto message = [&](uint32_t streamID, size_t size) {
+        return SendScheduler::Message{streamID, {}, std::vector<char>(size), false, now};
+    };
+
+    // a high level stream goes first, then two same level streams share by weight, 3:1
+    const uint32_t input = 1, world = 2 | RELIABLESTREAMMASK, chat = 3 | RELIABLESTREAMMASK;
+    for (int i = 0; i < 20; ++i) {
+        REQUIRE(scheduler.Enqueue({0, 3}, message(world, 100)));
+        REQUIRE(scheduler.Enqueue({0, 1}, message(chat, 100)));
+    }
+    REQUIRE(scheduler.Enqueue({5, 1}, message(input, 100)));
+    REQUIRE(scheduler.QueuedBytes() == 4100);
+
+    std::vector<SendScheduler::Message> out, stale;
+    scheduler.RunTick(now, out, stale);
+    REQUIRE(out.size() == 10);
+    REQUIRE(out[0].streamID == input);
+    const auto worldSent = std::count_if(out.begin(), out.end(), [&](const auto& m) { return m.streamID == world; });
+    REQUIRE(worldSent == 7);
+    REQUIRE(scheduler.QueuedBytes() == 3100);
+
+    // a message bigger than the budget still goes, the next tick pays for it
+    out.clear();
+    REQUIRE(scheduler.Enqueue({9, 1}, message(input, 2500)));
+    scheduler.RunTick(now, out, stale);
+    REQUIRE(out.size() == 1);
+    out.clear();
+    scheduler.RunTick(now, out, stale);
+    REQUIRE(out.empty());
+    scheduler.RunTick(now, out, stale);
+    REQUIRE(out.size() == 5);
+
+    // waiting raises the level, after 300 ms the level 0 messages left overtake a fresh level 2 one
+    out.clear();
+    now += 300ms;
+    REQUIRE(scheduler.Enqueue({2, 1}, message(5, 100)));
+    scheduler.RunTick(now, out, stale);
+    REQUIRE(out.front().streamID != 5);
+
+    // unreliable messages past their deadline are dropped, reliable ones wait
+    SendScheduler deadlines(config);
+    REQUIRE(deadlines.Enqueue({0, 1, 50ms}, message(7, 100)));
+    REQUIRE(deadlines.Enqueue({0, 1, 50ms}, message(8 | RELIABLESTREAMMASK, 100)));
+    out.clear();
+    deadlines.RunTick(now + 60ms, out, stale);
+    REQUIRE(stale.size() == 1);
+    REQUIRE(stale[0].streamID == 7);
+    REQUIRE(out.size() == 1);
+    REQUIRE(deadlines.Empty());
+
+    // the queue of a client is bounded
+    config.maxQueuedBytes = 150;
+    SendScheduler bounded(config);
+    REQUIRE(bounded.Enqueue({}, message(1, 100)));
+    REQUIRE_FALSE(bounded.Enqueue({}, message(1, 100)));
+}
+
+TEST_CASE("Prioritized streams beat cosmetic traffic under a budget", "[Scheduler]") {
+    FalconConfig config;
+    config.scheduler.bytesPerTick = 2000;
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    const auto client = std::make_unique<Falcon>();
+
+    std::mutex mutex;
+    std::vector<size_t> received; // sizes in arrival order
+    client->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            received.push_back(data.size());
+        });
+    });
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    auto cosmetic = server->CreateStream(clientID, false);
+    cosmetic->SetPriority({0, 1, std::chrono::milliseconds(100)});
+    auto input = server->CreateStream(clientID, false);
+    input->SetPriority({10, 1, std::chrono::milliseconds(100)});
+    for (int i = 0; i < 20; ++i) {
+        cosmetic->SendData(std::string(500, 'c'));
+    }
+    for (int i = 0; i < 5; ++i) {
+        input->SendData(std::string(100, 'i'));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(received.empty()); // nothing leaves before the tick
+    }
+
+    server->Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(received == std::vector<size_t>{100, 100, 100, 100, 100, 500, 500, 500});
+    }
+    REQUIRE(server->GetStats().clients.at(0).scheduledBytes == 17 * 500);
+
+    // the rest missed its deadline
+    server->Flush();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const FalconStats stats = server->GetStats();
+    REQUIRE(stats.clients.at(0).staleDropped == 17);
+    REQUIRE(stats.clients.at(0).scheduledBytes == 0);
+    std::lock_guard lock(mutex);
+    REQUIRE(received.size() == 8);
+}
+
+TEST_CASE("Ordered streams deliver in send order without blocking other streams", "[Stream]") {
+    FalconConfig config;
+    config.initialRetransmitTimeout = std::chrono::milliseconds(200);
+    config.minRetransmitTimeout = std::chrono::milliseconds(50);
+    config.simulation.enabled = true;
+    config.simulation.lossRate = 0.2;
+    config.simulation.reorderRate = 0.2;
+    config.simulation.latency = std::chrono::milliseconds(10);
+    config.simulation.jitter = std::chrono::milliseconds(5);
+    // a few lost pings in a row must not drop the connection before the stats are read
+    config.timeout = std::chrono::milliseconds(10000);
+
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+    config.simulation.seed = 3;
+    const auto client = std::make_unique<Falcon>(config);
+
+    std::mutex mutex;
+    std::vector<std::string> ordered;
+    std::set<std::string> unordered;
+    server->OnStreamOpened([&](Stream& stream) {
+        const bool isOrdered = Stream::IsOrdered(stream.streamID);
+        stream.OnDataReceived([&, isOrdered](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            if (isOrdered) {
+                ordered.emplace_back(data.begin(), data.end());
+            } else {
+                unordered.emplace(data.begin(), data.end());
+            }
+        });
+    });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    auto orderedStream = client->CreateStream(StreamDelivery::ReliableOrdered);
+    auto unorderedStream = client->CreateStream(StreamDelivery::ReliableUnordered);
+    REQUIRE(Stream::IsOrdered(orderedStream->streamID));
+    REQUIRE_FALSE(Stream::IsOrdered(unorderedStream->streamID));
+
+    std::vector<std::string> sent;
+    for (int i = 0; i < 50; ++i) {
+        // a fragmented message now and then takes several sequence numbers
+        sent.push_back(i % 10 == 5 ? std::string(3000, static_cast<char>('a' + i % 26)) : std::to_string(i));
+        orderedStream->SendData(sent.back());
+        unorderedStream->SendData(std::to_string(i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(3000));
+
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(ordered == sent);
+        REQUIRE(unordered.size() == 50);
+    }
+    const FalconStats stats = server->GetStats();
+    REQUIRE(stats.clients.size() == 1);
+    const ClientStats& connection = stats.clients.front();
+    REQUIRE(connection.reordered > 0);
+    REQUIRE(connection.reorderMessages == 0);
+    REQUIRE(connection.reorderBytes == 0);
+
+    client->CloseStream(*orderedStream);
+    client->CloseStream(*unorderedStream);
+}
+
+namespace {
+struct PlayerState {
+    uint32_t entity = 0;
+    int16_t health = 0;
+    float x = 0;
+    float heading = 0;
+    bool crouching = false;
+    int64_t velocity = 0;
+};
+using PlayerStateSchema = MessageSchema<PlayerState, VarintField<&PlayerState::entity>, RangedField<&PlayerState::health, -10, 100>,
+    QuantizedField<&PlayerState::x, -512.f, 512.f, 0.01f>, QuantizedField<&PlayerState::heading, 0.f, 360.f, 1.f>,
+    BoolField<&PlayerState::crouching>, VarintField<&PlayerState::velocity>>;
+}
+
+TEST_CASE("Bit packed schemas round trip within their bounds", "[Wire]") {
+    // sizes are known at compile time: 80 + 7 + 17 + 9 + 1 + 80 bits
+    static_assert(PlayerStateSchema::MAX_BITS == 194);
+    static_assert(PlayerStateSchema::MAX_SIZE == 25);
+
+    const PlayerState state{300, -7, 123.456f, 359.f, true, -3};
+    std::array<char, PlayerStateSchema::MAX_SIZE> buffer{};
+    const size_t size = PlayerStateSchema::Write(state, buffer);
+    // 16 + 7 + 17 + 9 + 1 + 8 bits instead of the padded struct
+    REQUIRE(size == 8);
+
+    PlayerState decoded;
+    REQUIRE(PlayerStateSchema::Read({buffer.data(), size}, decoded));
+    REQUIRE(decoded.entity == 300);
+    REQUIRE(decoded.health == -7);
+    REQUIRE(std::abs(decoded.x - state.x) <= 0.005f);
+    REQUIRE(decoded.heading == 359.f);
+    REQUIRE(decoded.crouching);
+    REQUIRE(decoded.velocity == -3);
+
+    // every truncation is caught
+    for (size_t i = 0; i < size; ++i) {
+        REQUIRE_FALSE(PlayerStateSchema::Read({buffer.data(), i}, decoded));
+    }
+    // too small a buffer or a value out of range fails the write
+    REQUIRE(PlayerStateSchema::Write(state, std::span<char>(buffer.data(), size - 1)) == 0);
+    PlayerState outOfRange = state;
+    outOfRange.health = 101;
+    REQUIRE(PlayerStateSchema::Write(outOfRange, buffer) == 0);
+
+    // 127 fits the 7 bits of the range but not the range
+    std::array<char, 2> ranged{};
+    BitWriter writer(ranged);
+    writer.WriteBits(127, 7);
+    REQUIRE(writer.Flush() == 1);
+    BitReader reader(std::span<const char>(ranged.data(), 1));
+    int64_t value = 0;
+    REQUIRE_FALSE(reader.ReadRanged(-10, 100, value));
+    REQUIRE(reader.Failed());
+
+    // control messages are smaller than their structs
+    const MsgAck ack{MSG_ACK, 5, 7 | RELIABLESTREAMMASK, 0xBEEF, 0xF0F0};
+    MessageBuffer<MsgAck> ackBuffer;
+    const size_t ackSize = Falcon::SerializeMessage(ack, ackBuffer);
+    REQUIRE(ackSize == 16);
+    REQUIRE(ackSize < sizeof(MsgAck));
+    MsgAck decodedAck{};
+    REQUIRE(Falcon::DeserializeMessage(Msg{Endpoint{}, {}, {ackBuffer.data(), ackSize}}, MSG_ACK, decodedAck));
+    REQUIRE(decodedAck.clientID == ack.clientID);
+    REQUIRE(decodedAck.streamID == ack.streamID);
+    REQUIRE(decodedAck.messageID == ack.messageID);
+    REQUIRE(decodedAck.trace == ack.trace);
+    REQUIRE_FALSE(Falcon::DeserializeMessage(Msg{Endpoint{}, {}, {ackBuffer.data(), ackSize - 1}}, MSG_ACK, decodedAck));
+    REQUIRE_FALSE(Falcon::DeserializeMessage(Msg{Endpoint{}, {}, {ackBuffer.data(), ackSize}}, MSG_CONN_ACK, decodedAck));
+
+    const Ping ping{PING, 1u << 20, 3, std::chrono::steady_clock::now()};
+    MessageBuffer<Ping> pingBuffer;
+    Ping decodedPing{};
+    REQUIRE(Falcon::DeserializeMessage(Msg{Endpoint{}, {}, {pingBuffer.data(), Falcon::SerializeMessage(ping, pingBuffer)}}, PING, decodedPing));
+    REQUIRE(decodedPing.clientID == ping.clientID);
+    REQUIRE(decodedPing.pingID == ping.pingID);
+    REQUIRE(decodedPing.time == ping.time);
+}
+
+TEST_CASE("SipHash matches the reference vectors", "[Connection]") {
+    // from the SipHash paper, key 00..0f
+    std::array<uint8_t, 15> input{};
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>(i);
+    }
+    REQUIRE(SipHash24(0x0706050403020100ull, 0x0F0E0D0C0B0A0908ull, {}) == 0x726FDB47DD0E0E31ull);
+    REQUIRE(SipHash24(0x0706050403020100ull, 0x0F0E0D0C0B0A0908ull, input) == 0xA129CA6149BE45E5ull);
+}
+
+TEST_CASE("Connection requests are rate limited per source prefix", "[Connection]") {
+    ConnectionLimiter limiter(10, 5, 2);
+    const auto start = ConnectionLimiter::Clock::time_point{} + std::chrono::hours(1);
+    const Endpoint flooder = Endpoint::FromIPv4({10, 0, 0, 1}, 1000);
+    const Endpoint neighbour = Endpoint::FromIPv4({10, 0, 0, 200}, 2000); // same /24
+    const Endpoint other = Endpoint::FromIPv4({10, 0, 1, 1}, 1000);
+    int allowed = 0;
+    for (int i = 0; i < 100; ++i) {
+        allowed += limiter.Allow(flooder, start);
+    }
+    REQUIRE(allowed == 5);
+    REQUIRE_FALSE(limiter.Allow(neighbour, start));
+    REQUIRE(limiter.Allow(other, start));
+    // 10 per second refill
+    REQUIRE(limiter.Allow(flooder, start + std::chrono::milliseconds(100)));
+    REQUIRE_FALSE(limiter.Allow(flooder, start + std::chrono::milliseconds(100)));
+
+    // past maxPrefixes new prefixes share a bucket, idle ones are forgotten
+    REQUIRE(limiter.TrackedPrefixes() == 2);
+    const Endpoint third = Endpoint::FromIPv4({10, 0, 2, 1}, 1000);
+    REQUIRE(limiter.Allow(third, start));
+    REQUIRE(limiter.TrackedPrefixes() == 2);
+    REQUIRE(limiter.Allow(third, start + std::chrono::seconds(10)));
+    REQUIRE(limiter.TrackedPrefixes() == 1);
+}
+
+TEST_CASE("Servers keep no state for connection requests without a valid cookie", "[Connection]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    std::atomic<int> connected = 0;
+    server->OnClientConnected([&](uint64_t) { connected++; });
+
+    // an attacker that never reads the challenges: empty, forged and replayed-looking cookies
+    const std::unique_ptr<Falcon> attacker = Falcon::Listen("127.0.0.1", 5556);
+    for (uint64_t i = 0; i < 50; ++i) {
+        const MsgConn request = {MSG_CONN, static_cast<uint32_t>(i % 2 == 0 ? 0 : i), i % 2 == 0 ? 0 : i * 0x9E3779B97F4A7C15ull};
+        MessageBuffer<MsgConn> buffer;
+        REQUIRE(attacker->SendTo("127.0.0.1", 5555, {buffer.data(), Falcon::SerializeMessage(request, buffer)}) > 0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(connected == 0);
+    FalconStats stats = server->GetStats();
+    REQUIRE(stats.connectionChallenges == 25); // forged cookies get no reply
+    REQUIRE(stats.connectionCookiesRejected == 25);
+
+    // a real client answers the challenge and gets in
+    const auto client = std::make_unique<Falcon>();
+    std::atomic<bool> accepted = false;
+    client->OnConnectionEvent([&](bool success, uint64_t) { accepted = success; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(accepted);
+    REQUIRE(connected == 1);
+    stats = server->GetStats();
+    REQUIRE(stats.connectionChallenges == 26);
+    REQUIRE(stats.connectionCookiesRejected == 25);
+}
+
+TEST_CASE("Stream data is only taken from connected peers", "[Connection]") {
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555);
+    std::mutex mutex;
+    std::vector<std::string> received;
+    server->OnStreamOpened([&](Stream& stream) {
+        stream.OnDataReceived([&](std::span<const char> data) {
+            std::lock_guard lock(mutex);
+            received.emplace_back(data.begin(), data.end());
+        });
+    });
+    const auto client = std::make_unique<Falcon>();
+    std::atomic<uint64_t> clientID = 0;
+    client->OnConnectionEvent([&](bool success, uint64_t id) { clientID = id; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(clientID != 0);
+
+    // an unconnected socket claiming the client's ID, and one nobody has
+    const std::unique_ptr<Falcon> attacker = Falcon::Listen("127.0.0.1", 5556);
+    for (const uint64_t claimed : {clientID.load(), uint64_t(999)}) {
+        const std::string payload = "forged";
+        char buffer[MAX_STANDARD_HEADER_SIZE + 16];
+        const size_t size = EncodeStandardHeader({claimed, 3 | RELIABLESTREAMMASK, 0, static_cast<uint32_t>(payload.size())}, buffer);
+        std::memcpy(buffer + size, payload.data(), payload.size());
+        REQUIRE(attacker->SendTo("127.0.0.1", 5555, {buffer, size + payload.size()}) > 0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(server->GetStats().clients.empty()); // no stream state for either
+
+    auto stream = client->CreateStream(true);
+    stream->SendData(std::string("real"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    {
+        std::lock_guard lock(mutex);
+        REQUIRE(received == std::vector<std::string>{"real"});
+    }
+    client->CloseStream(*stream);
+}
+
+TEST_CASE("Requests without a valid cookie don't count against the prefix limit", "[Connection]") {
+    FalconConfig config;
+    config.connectionRatePerPrefix = 0.1;
+    config.connectionBurstPerPrefix = 2;
+    const std::unique_ptr<Falcon> server = Falcon::Listen("127.0.0.1", 5555, config);
+
+    // requests claiming to come from the client's /24: without a cookie, and with forged ones
+    const std::unique_ptr<Falcon> attacker = Falcon::Listen("127.0.0.1", 5556);
+    for (uint64_t i = 0; i < 50; ++i) {
+        const MsgConn request = {MSG_CONN, static_cast<uint32_t>(i % 2 == 0 ? 0 : i), i % 2 == 0 ? 0 : i * 0x9E3779B97F4A7C15ull};
+        MessageBuffer<MsgConn> buffer;
+        REQUIRE(attacker->SendTo("127.0.0.1", 5555, {buffer.data(), Falcon::SerializeMessage(request, buffer)}) > 0);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    const auto client = std::make_unique<Falcon>();
+    std::atomic<bool> accepted = false;
+    client->OnConnectionEvent([&](bool success, uint64_t) { accepted = success; });
+    REQUIRE_NOTHROW(client->ConnectTo("127.0.0.1", 5555));
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(accepted);
+    REQUIRE(server->GetStats().connectionsRateLimited == 0);
+
+    // verified requests still do, past the burst the prefix waits for the rate
+    std::vector<std::unique_ptr<Falcon>> others;
+    std::atomic<int> othersAccepted = 0;
+    for (int i = 0; i < 2; ++i) {
+        others.push_back(std::make_unique<Falcon>());
+        others.back()->OnConnectionEvent([&](bool success, uint64_t) { othersAccepted += success; });
+        REQUIRE_NOTHROW(others.back()->ConnectTo("127.0.0.1", 5555));
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    REQUIRE(othersAccepted == 1);
+    REQUIRE(server->GetStats().connectionsRateLimited > 0);
+}